@@ -0,0 +1,1112 @@
+// Headless microbenchmarks for the hot paths, see README for the command line
+//
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+#include "Canvas.h"
+#include "Figure.h"
+#include "Texture.h"
+#include "Scene.h"
+#include "MeshFile.h"
+#include "FrameCapture.h"
+#include "Physics.h"
+#include "World.h"
+#include "Broadphase.h"
+#include "StaticMesh.h"
+#include "JobSystem.h"
+#include "Vecd.h"
+#include "Matd.h"
+
+
+struct BenchResult
+{
+	std::string name;
+	double nsPerOp = 0.0;
+	uint64_t iterations = 0;
+	std::string error;
+	std::string note;	// Extra counters of the case, shown next to the time
+};
+
+struct BenchOptions
+{
+	std::string filter;
+	std::string outPath;
+	std::string baselinePath;
+	double threshold = 0.10;	// Allowed slowdown against the baseline
+	unsigned samples = 7;		// Median of these is reported
+	double sampleMs = 50.0;
+	bool verify = false;		// Checks FastMath against libm instead of timing anything
+};
+
+// Results go here, so the compiler cant throw the work away
+volatile double benchSink = 0.0;
+
+
+//// HARNESS ////
+
+
+BenchResult measure(const BenchOptions& opts, const std::string& name, const std::function<void()>& op)
+{
+	using clock = std::chrono::steady_clock;
+	BenchResult result{ name };
+
+	try
+	{
+		// Calibrating, so one sample takes about sampleMs
+		uint64_t iterations(1);
+		while (true)
+		{
+			auto start = clock::now();
+			for (uint64_t i(0); i < iterations; ++i)
+				op();
+			double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+			if (ms >= opts.sampleMs * 0.5 || iterations >= (1ULL << 30))
+			{
+				iterations = std::max<uint64_t>(1, uint64_t(iterations * opts.sampleMs / std::max(ms, 1e-3)));
+				break;
+			}
+			iterations *= 2;
+		}
+
+		std::vector<double> samples;
+		for (unsigned s(0); s < opts.samples; ++s)
+		{
+			auto start = clock::now();
+			for (uint64_t i(0); i < iterations; ++i)
+				op();
+			samples.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations);
+		}
+
+		std::sort(samples.begin(), samples.end());
+		result.nsPerOp = samples[samples.size() / 2];
+		result.iterations = iterations;
+	}
+	catch (const char* err)
+	{
+		result.error = err;
+	}
+
+	return result;
+}
+
+
+//// RASTERIZER ////
+
+
+// Owns the buffers Canvas would pass to figures
+struct RasterTarget
+{
+	const unsigned width, height, samplesCount;
+	std::vector<uint32_t> pixels;
+	std::vector<float> depth;
+	std::vector<uint32_t> samples;
+	std::vector<Vecd<2>> offsets;
+
+	RasterTarget(unsigned width, unsigned height, unsigned samplesCount)
+		: width(width), height(height), samplesCount(samplesCount),
+		pixels((size_t)width * height), depth((size_t)width * height * samplesCount),
+		samples(samplesCount > 1 ? (size_t)width * height * samplesCount : 0)
+	{
+		// Regular grid is enough for timing
+		for (unsigned s(0); s < samplesCount; ++s)
+			offsets.push_back(Vecd<2>{ (s + 0.5) / samplesCount, (s + 0.5) / samplesCount });
+	}
+
+	CanvasData getData(CullMode cullMode)
+	{
+		return CanvasData{ pixels.data(), width, height, samplesCount, offsets.data(), depth.data(),
+			samplesCount > 1 ? samples.data() : nullptr, cullMode };
+	}
+
+	/// @brief Clears the depth of window pixels inside bounds only, so small triangles dont pay for the whole buffer
+	void clearDepth(const PixelRect& bounds)
+	{
+		for (int y(bounds.minY); y <= bounds.maxY; ++y)
+		{
+			float* row = depth.data() + (size_t)(height - y - 1) * width * samplesCount;
+			std::fill(row + (size_t)bounds.minX * samplesCount, row + (size_t)(bounds.maxX + 1) * samplesCount, 0.0f);
+		}
+	}
+};
+
+void benchTriangles(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	// Clip space vertices, canvas is 512x512, so 1.0 is 256 pixels
+	struct Shape { const char* name; Vecd<4> vertices[3]; CullMode cullMode = CullMode::NONE; BlendMode blendMode = BlendMode::NONE; };
+	const double px = 1.0 / 256;
+	const Shape shapes[]
+	{
+		{ "small", { { 0.0, 0.0, 0.5, 1.0 }, { 8 * px, 0.0, 0.5, 1.0 }, { 0.0, 8 * px, 0.5, 1.0 } } },
+		{ "medium", { { -0.25, -0.25, 0.5, 1.0 }, { 0.25, -0.25, 0.5, 1.0 }, { -0.25, 0.25, 0.5, 1.0 } } },
+		{ "medium/over", { { -0.25, -0.25, 0.5, 1.0 }, { 0.25, -0.25, 0.5, 1.0 }, { -0.25, 0.25, 0.5, 1.0 } }, CullMode::NONE, BlendMode::OVER },
+		{ "medium/add", { { -0.25, -0.25, 0.5, 1.0 }, { 0.25, -0.25, 0.5, 1.0 }, { -0.25, 0.25, 0.5, 1.0 } }, CullMode::NONE, BlendMode::ADD },
+		{ "large", { { -0.9, -0.9, 0.5, 1.0 }, { 0.9, -0.9, 0.5, 1.0 }, { -0.9, 0.9, 0.5, 1.0 } } },
+		{ "sliver", { { -0.9, -0.9, 0.5, 1.0 }, { 0.9, 0.9, 0.5, 1.0 }, { 0.9, 0.9 - 2 * px, 0.5, 1.0 } } },
+		{ "backfacing", { { -0.25, -0.25, 0.5, 1.0 }, { -0.25, 0.25, 0.5, 1.0 }, { 0.25, -0.25, 0.5, 1.0 } } },
+		{ "backfacing/cull", { { -0.25, -0.25, 0.5, 1.0 }, { -0.25, 0.25, 0.5, 1.0 }, { 0.25, -0.25, 0.5, 1.0 } }, CullMode::BACK },
+		{ "subpixel", { { 0.6 * px, 0.6 * px, 0.5, 1.0 }, { 0.9 * px, 0.6 * px, 0.5, 1.0 }, { 0.6 * px, 0.9 * px, 0.5, 1.0 } } },
+	};
+
+	Vecd<4> perVertex[3][2]{
+		{ { 0.0, 1.0, 0.0, 1.0 }, {} },
+		{ { 1.0, 0.0, 0.0, 1.0 }, {} },
+		{ { 0.0, 0.0, 1.0, 1.0 }, {} }
+	};
+
+	for (unsigned samplesCount : { 1u, 4u })
+	{
+		RasterTarget target(512, 512, samplesCount);
+		for (const Shape& shape : shapes)
+		{
+			std::string name = std::string("triangle/") + shape.name + (samplesCount > 1 ? "/msaa4" : "");
+			if (name.find(opts.filter) == std::string::npos)
+				continue;
+
+			Vecd<4> vertices[3]{ shape.vertices[0], shape.vertices[1], shape.vertices[2] };
+			results.push_back(measure(opts, name, [&]() {
+				CanvasData cd = target.getData(shape.cullMode);
+
+				// draw works in place, so the triangle is built every time
+				Triangle<4> triag(vertices);
+				triag.setPerVertexInfo(perVertex);
+				triag.setBlendMode(shape.blendMode);
+
+				// Same as draw, then the depth it may have written is cleared, so every run does the full work
+				if (triag.setup(cd))
+				{
+					triag.rasterize(cd, PixelRect{ 0, 0, (int)cd.width - 1, (int)cd.height - 1 });
+					target.clearDepth(triag.getBounds());
+				}
+			}));
+		}
+	}
+}
+
+void benchCanvas(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	Canvas::Params params;
+	params.colorsCount = 4;
+	Canvas cnv(512, 512, params);
+
+	// Opaque fill is only recorded, the render graph clears during render, so an empty frame is timed
+	if (std::string("canvas/clear").find(opts.filter) != std::string::npos)
+		results.push_back(measure(opts, "canvas/clear", [&]() {
+			cnv.fill(RGB(0, 0, 0), 1.0f);
+			cnv.render();
+		}));
+	if (std::string("canvas/fill/blend").find(opts.filter) != std::string::npos)
+		results.push_back(measure(opts, "canvas/fill/blend", [&]() { cnv.fill(RGB(10, 20, 30), 0.5f); }));
+
+	// Same empty frame presented as 24 bit, so it adds the conversion from packed pixels
+	if (std::string("canvas/clear/rgb24").find(opts.filter) != std::string::npos)
+	{
+		Canvas::Params rgbParams;
+		rgbParams.colorsCount = 3;
+		Canvas rgbCnv(512, 512, rgbParams);
+		results.push_back(measure(opts, "canvas/clear/rgb24", [&]() {
+			rgbCnv.fill(RGB(0, 0, 0), 1.0f);
+			rgbCnv.render();
+		}));
+	}
+
+	// Mostly static view, a grid of triangles and a small one moving, drawn whole or only where it changed
+	for (bool partial : { false, true })
+	{
+		std::string name = partial ? "canvas/dashboard/partial" : "canvas/dashboard/full";
+		if (name.find(opts.filter) == std::string::npos)
+			continue;
+
+		Canvas::Params dashParams;
+		dashParams.colorsCount = 4;
+		dashParams.partialRedraw = partial;
+		Canvas dashCnv(512, 512, dashParams);
+		unsigned frame(0);
+		results.push_back(measure(opts, name, [&]() {
+			dashCnv.fill(RGB(0, 0, 0), 1.0f);
+			for (unsigned i(0); i < 256; ++i)
+			{
+				double x = -1.0 + (i % 16) * 0.125, y = -1.0 + (i / 16) * 0.125;
+				Vecd<4> cell[3]{ { x, y, 0.5, 1.0 }, { x + 0.12, y, 0.5, 1.0 }, { x, y + 0.12, 0.5, 1.0 } };
+				dashCnv.addFigure(new Triangle<4>(cell));
+			}
+
+			double x = (frame++ % 2) * 0.05;
+			Vecd<4> moving[3]{ { x, 0.0, 0.2, 1.0 }, { x + 0.1, 0.0, 0.2, 1.0 }, { x, 0.1, 0.2, 1.0 } };
+			dashCnv.addFigure(new Triangle<4>(moving));
+			dashCnv.render();
+		}));
+	}
+
+	// Whole frames, serial and in bands of rows on every hardware thread
+	JobSystem jobs({});
+	for (bool threaded : { false, true })
+	{
+		params.samplesCount = 4;
+		Canvas msaaCnv(512, 512, params);
+		if (threaded)
+		{
+			cnv.setJobSystem(&jobs);
+			msaaCnv.setJobSystem(&jobs);
+		}
+
+		std::string clearName = threaded ? "canvas/clear/jobs" : "";
+		if (threaded && clearName.find(opts.filter) != std::string::npos)
+			results.push_back(measure(opts, clearName, [&]() {
+				cnv.fill(RGB(0, 0, 0), 1.0f);
+				cnv.render();
+			}));
+
+		std::string renderName = threaded ? "canvas/render/msaa4/jobs" : "canvas/render/msaa4";
+		if (renderName.find(opts.filter) == std::string::npos)
+			continue;
+
+		Vecd<4> vertices[3]{ { -0.9, -0.9, 0.5, 1.0 }, { 0.9, -0.9, 0.5, 1.0 }, { -0.9, 0.9, 0.5, 1.0 } };
+		results.push_back(measure(opts, renderName, [&]() {
+			msaaCnv.fill(RGB(0, 0, 0), 1.0f);
+			msaaCnv.addFigure(new Triangle<4>(vertices));
+			msaaCnv.render();
+		}));
+	}
+	cnv.setJobSystem(nullptr);
+}
+
+
+//// JOBS ////
+
+
+void benchJobs(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	// Scheduling overhead only, every job is empty
+	JobSystem jobs({});
+	auto wanted = [&](const char* name) { return std::string(name).find(opts.filter) != std::string::npos; };
+
+	if (wanted("jobs/parallelFor/64"))
+		results.push_back(measure(opts, "jobs/parallelFor/64", [&]() {
+			jobs.parallelFor(64, 1, [](size_t first, size_t) { benchSink = double(first); });
+		}));
+
+	if (wanted("jobs/run+wait"))
+		results.push_back(measure(opts, "jobs/run+wait", [&]() {
+			JobSystem::Counter done;
+			jobs.run([]() { benchSink = 1.0; }, &done);
+			jobs.wait(done);
+		}));
+
+	if (wanted("jobs/fanout/64"))
+		results.push_back(measure(opts, "jobs/fanout/64", [&]() {
+			JobSystem::Counter done;
+			for (int i(0); i < 64; ++i)
+				jobs.run([]() { benchSink = 1.0; }, &done);
+			jobs.wait(done);
+		}));
+
+	// Every job waits for the previous one
+	if (wanted("jobs/chain/64"))
+	{
+		std::vector<JobSystem::Counter> counters(64);
+		results.push_back(measure(opts, "jobs/chain/64", [&]() {
+			for (size_t i(0); i < counters.size(); ++i)
+				jobs.run([]() { benchSink = 1.0; }, &counters[i], i ? &counters[i - 1] : nullptr);
+			jobs.wait(counters.back());
+		}));
+	}
+}
+
+
+//// TEXTURES ////
+
+
+void benchTextures(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	const size_t size = 256;
+	std::vector<UCHAR> pixels(size * size * 4);
+	for (size_t i(0); i < pixels.size(); ++i)
+		pixels[i] = UCHAR(i * 2654435761u >> 24);
+	Texture tex(pixels.data(), size, size, 4);
+
+	// 4096 lookups per op
+	const size_t lookups = 4096;
+	std::vector<Vecd<2>> sequential, strided, random;
+	std::mt19937 rng(18);
+	std::uniform_real_distribution<double> uniform(-4.0, 4.0);
+	for (size_t i(0); i < lookups; ++i)
+	{
+		sequential.push_back(Vecd<2>{ (i % size + 0.5) / size, (i / size + 0.5) / size });
+		strided.push_back(Vecd<2>{ (i / size + 0.5) / size, (i % size + 0.5) / size });
+		random.push_back(Vecd<2>{ uniform(rng), uniform(rng) });
+	}
+
+	std::pair<const char*, std::vector<Vecd<2>>*> patterns[]{
+		{ "texture/sequential", &sequential },
+		{ "texture/strided", &strided },
+		{ "texture/random", &random }
+	};
+	for (auto& pattern : patterns)
+	{
+		if (std::string(pattern.first).find(opts.filter) == std::string::npos)
+			continue;
+
+		auto& coords = *pattern.second;
+		results.push_back(measure(opts, pattern.first, [&]() {
+			double sum(0.0);
+			for (const auto& coord : coords)
+				sum += tex.getPixel(coord.x(), coord.y()).r();
+			benchSink = sum;
+		}));
+	}
+}
+
+
+//// MATH ////
+
+
+void benchMath(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	const size_t count = 1024;
+	std::vector<Vecd<4>> vectors(count);
+	std::mt19937 rng(26);
+	std::uniform_real_distribution<double> uniform(-10.0, 10.0);
+	for (auto& vec : vectors)
+		vec = Vecd<4>{ uniform(rng), uniform(rng), uniform(rng), 1.0 };
+
+	Matd<4, 4> mat4{ { 1, 2, 3, 4 }, { 5, 6, 7, 8 }, { 9, 10, 11, 12 }, { 0, 0, 0, 1 } };
+	Matd<3, 3> mat3{ { 0.58, 0.11, 0.0 }, { 0.11, 2.59, 0.0 }, { 0.0, 0.0, 0.47 } };
+
+	std::vector<std::pair<const char*, std::function<void()>>> cases{
+		{ "vecd/normalize", [&]() {
+			double sum(0.0);
+			for (const auto& vec : vectors)
+				sum += normalize((Vecd<3>)vec).x();
+			benchSink = sum;
+		} },
+		{ "vecd/cross+dot", [&]() {
+			double sum(0.0);
+			for (size_t i(1); i < count; ++i)
+				sum += dot(cross((Vecd<3>)vectors[i - 1], (Vecd<3>)vectors[i]), (Vecd<3>)vectors[i]);
+			benchSink = sum;
+		} },
+		{ "matd/mat4*vec4", [&]() {
+			double sum(0.0);
+			for (const auto& vec : vectors)
+				sum += (mat4 * vec).w();
+			benchSink = sum;
+		} },
+		{ "matd/mat3*mat3", [&]() {
+			Matd<3, 3> acc = mat3;
+			for (size_t i(0); i < count; ++i)
+				acc = (acc * mat3) * 0.5;
+			benchSink = acc[0][0];
+		} },
+		{ "matd/orthonormalize", [&]() {
+			Matd<3, 3> acc = mat3;
+			for (size_t i(0); i < count; ++i)
+				acc.orthonormalize3D();
+			benchSink = acc[0][0];
+		} }
+	};
+
+	for (auto& benchCase : cases)
+		if (std::string(benchCase.first).find(opts.filter) != std::string::npos)
+			results.push_back(measure(opts, benchCase.first, benchCase.second));
+
+	// Batched FastMath over the same arrays, sincos in both tiers
+	std::vector<double> inputs(count), outputs(count), cosines(count), xs(count), ys(count), zs(count);
+	for (size_t i(0); i < count; ++i)
+		inputs[i] = 0.01 + std::abs(vectors[i].x());
+
+	if (std::string("fastmath/rsqrt").find(opts.filter) != std::string::npos)
+		results.push_back(measure(opts, "fastmath/rsqrt", [&]() {
+			fmath::rsqrt(inputs.data(), outputs.data(), count);
+			benchSink = outputs[count / 2];
+		}));
+
+	if (std::string("fastmath/normalize3").find(opts.filter) != std::string::npos)
+		results.push_back(measure(opts, "fastmath/normalize3", [&]() {
+			// Normalized in place, so the vectors are copied back every time
+			for (size_t i(0); i < count; ++i)
+			{
+				xs[i] = vectors[i].x();
+				ys[i] = vectors[i].y();
+				zs[i] = vectors[i].z();
+			}
+			fmath::normalize3(xs.data(), ys.data(), zs.data(), count);
+			benchSink = xs[count / 2];
+		}));
+
+	for (bool isFast : { false, true })
+	{
+		const char* name = isFast ? "fastmath/sincos/fast" : "fastmath/sincos";
+		if (std::string(name).find(opts.filter) == std::string::npos)
+			continue;
+
+		results.push_back(measure(opts, name, [&, isFast]() {
+			isFast ? fmath::sincos<Precision::Fast>(inputs.data(), outputs.data(), cosines.data(), count) :
+				fmath::sincos<Precision::Exact>(inputs.data(), outputs.data(), cosines.data(), count);
+			benchSink = outputs[count / 2] + cosines[count / 2];
+		}));
+	}
+}
+
+/// @brief Sweeps Fast sincos against libm and checks normalize on extreme lengths, prints the worst errors
+/// @return How many checks exceed the bound documented in FastMath.h
+int verifyFastMath()
+{
+	const size_t count = 1 << 20;
+	std::mt19937_64 rng(26);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	int failedCount(0);
+
+	// NaN is the worst error of all, so it is kept once seen
+	auto track = [](double& worst, double error) {
+		if (error > worst || error != error)
+			worst = error;
+	};
+	auto report = [&](const char* name, double worst, double bound) {
+		const bool passed = worst <= bound;
+		std::cerr << std::left << std::setw(28) << name << std::right << std::scientific << std::setprecision(2)
+			<< std::setw(10) << worst << "  bound " << bound << (passed ? "" : "  FAILED") << std::endl;
+		failedCount += !passed;
+	};
+
+	std::vector<double> inputs(count), sines(count), cosines(count);
+	for (double& val : inputs)
+		val = -1e5 + unit(rng) * 2e5;
+
+	double worst(0.0);
+	for (double val : inputs)
+	{
+		double sinVal, cosVal;
+		fmath::sincos<Precision::Fast>(val, sinVal, cosVal);
+		track(worst, std::abs(sinVal - std::sin(val)));
+		track(worst, std::abs(cosVal - std::cos(val)));
+	}
+	report("sincos", worst, 3e-8);
+
+	// Inputs Fast hands to libm, mixed into a batch, both versions have to give libm bits there
+	const double special[]{ 1e5, -1e5, 1e30, -1e300, HUGE_VAL, -HUGE_VAL, std::nan("") };
+	for (size_t i(0); i < sizeof(special) / sizeof(special[0]); ++i)
+		inputs[i * 7] = special[i];
+	fmath::sincos<Precision::Fast>(inputs.data(), sines.data(), cosines.data(), count);
+
+	// NaN counts as the same as NaN
+	auto same = [](double lhs, double rhs) { return lhs == rhs || (lhs != lhs && rhs != rhs); };
+	double mismatches(0.0);
+	for (size_t i(0); i < count; ++i)
+	{
+		double sinVal, cosVal;
+		fmath::sincos<Precision::Fast>(inputs[i], sinVal, cosVal);
+		mismatches += !same(sines[i], sinVal) || !same(cosines[i], cosVal);
+	}
+	for (double val : special)
+	{
+		double sinVal, cosVal;
+		fmath::sincos<Precision::Fast>(val, sinVal, cosVal);
+		mismatches += !same(sinVal, std::sin(val)) || !same(cosVal, std::cos(val));
+	}
+	report("sincos/batched+special", mismatches, 0.0);
+
+	// Squared lengths from denormal to infinite, Vecd and batched have to agree and point the right way
+	const double scales[]{ 0.0, 1e-320, 1e-200, 1e-160, 1e-100, 1.0, 1e100, 1e155, 1e200, 1e300, HUGE_VAL, std::nan("") };
+	std::vector<double> xs, ys, zs;
+	for (double scale : scales)
+	{
+		xs.push_back(scale);
+		ys.push_back(-2.0 * scale);
+		zs.push_back(0.5 * scale);
+	}
+	fmath::normalize3(xs.data(), ys.data(), zs.data(), xs.size());
+
+	const double expected[3]{ 1.0 / std::sqrt(5.25), -2.0 / std::sqrt(5.25), 0.5 / std::sqrt(5.25) };
+	worst = 0.0;
+	mismatches = 0.0;
+	for (size_t i(0); i < xs.size(); ++i)
+	{
+		const double scale = scales[i];
+		const Vecd<3> vec = normalize(Vecd<3>{ scale, -2.0 * scale, 0.5 * scale });
+		mismatches += !same(vec.x(), xs[i]) || !same(vec.y(), ys[i]) || !same(vec.z(), zs[i]);
+
+		// Zero stays zero, infinite and NaN give NaN
+		if (scale == 0.0)
+			mismatches += vec.sqLength() != 0.0;
+		else if (!(scale <= 1e300))
+			mismatches += vec.x() == vec.x();
+		else
+			for (int axis(0); axis < 3; ++axis)
+				track(worst, std::abs(vec[axis] - expected[axis]));
+	}
+	report("normalize/scales", worst, 1e-15);
+	report("normalize/batched+special", mismatches, 0.0);
+
+	return failedCount;
+}
+
+
+//// SCENE ////
+
+
+void benchScene(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	// Camera at the origin looking down -z (w = -z), 90 degrees wide
+	Matd<4, 4> viewProjection{
+		{ 1.0, 0.0, 0.0, 0.0 },
+		{ 0.0, 1.0, 0.0, 0.0 },
+		{ 0.0, 0.0, -1.0, 0.0 },
+		{ 0.0, 0.0, -1.0, 0.0 }
+	};
+	const Frustum frustum(viewProjection, 0.1);
+	const Vecd<3> triangle[3]{ { -0.5, -0.5, 0.0 }, { 0.5, -0.5, 0.0 }, { 0.0, 0.7, 0.3 } };
+
+	// Same 256 objects in view every time, the rest of the scene is out of it
+	for (size_t count : { 1024u, 65536u })
+	{
+		std::string name = "scene/cull/" + std::to_string(count / 1024) + "k";
+		if (name.find(opts.filter) == std::string::npos)
+			continue;
+
+		Scene scene;
+		Scene::MeshId mesh = scene.addMesh({ { triangle[0], triangle[1], triangle[2] } });
+		std::mt19937 rng(44);
+		std::uniform_real_distribution<double> uniform(-200.0, 200.0);
+		size_t inView(0);
+		while (scene.getObjectsCount() < count)
+		{
+			Vecd<3> pos{ uniform(rng), uniform(rng), uniform(rng) };
+			bool visible = !frustum.isOutside(pos, 0.0, 0x1f);
+			if (visible ? inView >= 256 : !frustum.isOutside(pos, 2.0, 0x1f))
+				continue;
+			inView += visible;
+			scene.addObject(mesh, pos, Matd<3, 3>::getIdentityMatrix());
+		}
+
+		std::vector<Scene::ObjectId> visible;
+		scene.collectVisible(frustum, visible);
+		results.push_back(measure(opts, name, [&]() {
+			benchSink = double(scene.collectVisible(frustum, visible));
+		}));
+	}
+}
+
+
+void benchMeshFile(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	auto wanted = [&](const char* name) { return std::string(name).find(opts.filter) != std::string::npos; };
+	if (!wanted("mesh/import/8k") && !wanted("mesh/load"))
+		return;
+
+	// 64x64 quads grid with texture coords and normals
+	const char* objPath = "bench_mesh.obj";
+	const char* meshPath = "bench_mesh.csmb";
+	{
+		std::ofstream obj(objPath);
+		const int size = 64;
+		for (int y(0); y <= size; ++y)
+			for (int x(0); x <= size; ++x)
+				obj << "v " << x << " 0 " << y << "\nvt " << double(x) / size << " " << double(y) / size << "\n";
+		obj << "vn 0 1 0\n";
+		for (int y(0); y < size; ++y)
+			for (int x(0); x < size; ++x)
+			{
+				int v = y * (size + 1) + x + 1;
+				obj << "f " << v << "/" << v << "/1 " << v + size + 1 << "/" << v + size + 1 << "/1 " <<
+					v + size + 2 << "/" << v + size + 2 << "/1 " << v + 1 << "/" << v + 1 << "/1\n";
+			}
+	}
+
+	MeshFile::importObj(objPath, meshPath);
+	if (wanted("mesh/import/8k"))
+		results.push_back(measure(opts, "mesh/import/8k", [&]() {
+			benchSink = double(MeshFile::importObj(objPath, meshPath).triangles);
+		}));
+	// Mapping and the header check only, the way a level is loaded
+	if (wanted("mesh/load"))
+		results.push_back(measure(opts, "mesh/load", [&]() {
+			MeshFile file(meshPath);
+			benchSink = double(file.getTrianglesCount());
+		}));
+
+	std::remove(objPath);
+	std::remove(meshPath);
+}
+
+
+//// CAPTURE ////
+
+
+void benchCapture(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+#ifdef _WIN32
+	const char* nullPath = "NUL";
+#else
+	const char* nullPath = "/dev/null";
+#endif
+	std::vector<UCHAR> pixels((size_t)1024 * 512 * 4);
+	for (size_t i(0); i < pixels.size(); ++i)
+		pixels[i] = UCHAR(i * 7 + i / 4096);
+
+	// Cost left on the rendering thread when a buffer is free, so every timed submit is a full copy:
+	// the writer is drained between rounds (not timed), then each round fills every buffer once
+	if (std::string("capture/submit/1024x512").find(opts.filter) != std::string::npos)
+	{
+		using clock = std::chrono::steady_clock;
+		const FrameCapture::Params params;
+		const unsigned roundsPerSample = 8;
+		FrameCapture capture(nullPath, 1024, 512, params);
+		BenchResult result{ "capture/submit/1024x512" };
+
+		std::vector<double> samples;
+		uint64_t submitted(0);
+		try
+		{
+			for (unsigned s(0); s < opts.samples; ++s)
+			{
+				std::chrono::duration<double, std::nano> elapsed{};
+				for (unsigned round(0); round < roundsPerSample; ++round)
+				{
+					while (capture.getWrittenCount() + capture.getDroppedCount() < submitted)
+						std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+					for (unsigned frame(0); frame < params.buffers; ++frame)
+					{
+						auto start = clock::now();
+						benchSink = double(capture.submit(pixels.data(), 4));
+						elapsed += clock::now() - start;
+						submitted++;
+					}
+				}
+				samples.push_back(elapsed.count() / (roundsPerSample * params.buffers));
+			}
+
+			std::sort(samples.begin(), samples.end());
+			result.nsPerOp = samples[samples.size() / 2];
+			result.iterations = roundsPerSample * params.buffers;
+			result.note = "dropped " + std::to_string(capture.getDroppedCount()) + " of " + std::to_string(submitted);
+		}
+		catch (const char* err)
+		{
+			result.error = err;
+		}
+		results.push_back(result);
+	}
+
+	// Waiting for buffers, so it is the writer throughput (conversion and write)
+	for (FrameCapture::Format format : { FrameCapture::Format::Y4M, FrameCapture::Format::RAW_RGB })
+	{
+		std::string name = format == FrameCapture::Format::Y4M ? "capture/y4m/1024x512" : "capture/rgb/1024x512";
+		if (name.find(opts.filter) == std::string::npos)
+			continue;
+
+		FrameCapture::Params params;
+		params.format = format;
+		params.blockWhenFull = true;
+		FrameCapture capture(nullPath, 1024, 512, params);
+		results.push_back(measure(opts, name, [&]() {
+			benchSink = double(capture.submit(pixels.data(), 4));
+		}));
+	}
+}
+
+
+//// PHYSICS ////
+
+
+void benchPhysics(const BenchOptions& opts, std::vector<BenchResult>& results)
+{
+	// Same body as in Main
+	const Vecd<3> vertices[3]{ { -0.5, +1.5, +0.0 }, { -0.2, -1.0, +0.0 }, { +0.7, -0.5, +0.0 } };
+	const Matd<3, 3> IbodyInv{ { 0.58, 0.11, 0.00 }, { 0.11, 2.59, 0.00 }, { 0.00, 0.00, 0.47 } };
+	const double dTime = 1.0 / 60;
+
+	const struct { const char* name; Integrator integrator; } integrators[]{
+		{ "physics/freefall", Integrator::EXPLICIT_EULER },
+		{ "physics/freefall/symplectic", Integrator::SYMPLECTIC_EULER },
+		{ "physics/freefall/rk4", Integrator::RK4 }
+	};
+
+	for (const auto& integ : integrators)
+	{
+		if (std::string(integ.name).find(opts.filter) == std::string::npos)
+			continue;
+
+		Simulator sim(vertices, IbodyInv, 1.0, 5.0, integ.integrator);
+		sim.setAngularMomentum(Vecd<3>{ 0.3, 0.0, 0.2 });
+		results.push_back(measure(opts, integ.name, [&]() {
+			// Thrown back up before it reaches the floor
+			if (sim.getCenterPos().y() < 0.0)
+			{
+				sim.setCenterPos(Vecd<3>{ 0.0, 1000.0, 0.0 });
+				sim.setLinearVelocity(Vecd<3>{});
+			}
+			benchSink = sim.updatePhysics(dTime)[0].y();
+		}));
+	}
+
+	if (std::string("physics/contact").find(opts.filter) != std::string::npos)
+	{
+		// Lying on the floor and bouncing around on it
+		Simulator sim(vertices, IbodyInv, 1.0, 5.0);
+		sim.setCenterPos(Vecd<3>{ 0.0, -3.0, 0.0 });
+		sim.setAngularMomentum(Vecd<3>{ 0.3, 0.0, 0.2 });
+		for (int i(0); i < 120; ++i)
+			sim.updatePhysics(dTime);
+
+		results.push_back(measure(opts, "physics/contact", [&]() {
+			sim.applyForce(Vecd<3>{}); // Keeps it from falling asleep
+			benchSink = sim.updatePhysics(dTime)[0].y();
+		}));
+	}
+
+	if (std::string("physics/world/1024").find(opts.filter) != std::string::npos)
+	{
+		// Grid of bodies, half of them already resting on the floor
+		World world(5.0);
+		world.reserve(1024);
+		for (int i(0); i < 1024; ++i)
+		{
+			auto id = world.addBody(vertices, IbodyInv, 1.0, Vecd<3>{ 3.0 * (i % 32), (i & 1) ? 20.0 : -3.0, 3.0 * (i / 32) });
+			world.setAngularMomentum(id, Vecd<3>{ 0.3, 0.0, 0.2 });
+		}
+		for (int i(0); i < 60; ++i)
+			world.step(dTime);
+
+		results.push_back(measure(opts, "physics/world/1024", [&]() {
+			// Applied force wakes a body up, so every step here is a full one
+			for (World::BodyId id(0); id < world.getBodyCount(); ++id)
+				world.applyForce(id, Vecd<3>{});
+			world.step(dTime);
+			benchSink = world.getVertex(0, 0).y();
+		}));
+	}
+
+	if (std::string("physics/world/1024/springs").find(opts.filter) != std::string::npos)
+	{
+		// Every body hanging on its own spring, plus drag on all of them
+		World world(5.0);
+		world.reserve(1024);
+		ForceGenerators& generators = world.getForceGenerators();
+		for (int i(0); i < 1024; ++i)
+		{
+			Vecd<3> pos{ 3.0 * (i % 32), 5.0, 3.0 * (i / 32) };
+			uint32_t id = uint32_t(world.addBody(vertices, IbodyInv, 1.0, pos));
+			generators.addSpring({ id, vertices[0], pos + Vecd<3>{ 0.5, 3.0, 0.0 }, 10.0, 1.0, 0.0, true });
+		}
+		generators.addDrag({ 0.0, 0.1 });
+
+		results.push_back(measure(opts, "physics/world/1024/springs", [&]() {
+			for (World::BodyId id(0); id < world.getBodyCount(); ++id)
+				world.applyForce(id, Vecd<3>{});
+			world.step(dTime);
+			benchSink = world.getVertex(0, 0).y();
+		}));
+	}
+
+	// Same step on the calling thread and as jobs on every hardware thread
+	for (bool threaded : { false, true })
+	{
+		const char* name = threaded ? "physics/world/16k/jobs" : "physics/world/16k/serial";
+		if (std::string(name).find(opts.filter) == std::string::npos)
+			continue;
+
+		JobSystem jobs({});
+		World world(5.0);
+		world.reserve(16384);
+		if (threaded)
+			world.setJobSystem(&jobs);
+		for (int i(0); i < 16384; ++i)
+		{
+			auto id = world.addBody(vertices, IbodyInv, 1.0, Vecd<3>{ 3.0 * (i % 128), (i & 1) ? 20.0 : -3.0, 3.0 * (i / 128) });
+			world.setAngularMomentum(id, Vecd<3>{ 0.3, 0.0, 0.2 });
+		}
+
+		results.push_back(measure(opts, name, [&]() {
+			for (World::BodyId id(0); id < world.getBodyCount(); ++id)
+				world.applyForce(id, Vecd<3>{});
+			world.step(dTime);
+			benchSink = world.getVertex(0, 0).y();
+		}));
+	}
+
+	// Same bodies after they all landed, with one of them kept moving
+	std::pair<const char*, Broadphase::Method> asleepCases[]
+	{
+		{ "physics/world/1024/asleep", Broadphase::Method::SWEEP_AND_PRUNE },
+		{ "physics/world/1024/asleep/grid", Broadphase::Method::HASH_GRID }
+	};
+	for (auto& asleepCase : asleepCases)
+	{
+		if (std::string(asleepCase.first).find(opts.filter) == std::string::npos)
+			continue;
+
+		Broadphase::Params params;
+		params.method = asleepCase.second;
+		World world(5.0, params);
+		for (int i(0); i < 1024; ++i)
+			world.addBody(vertices, IbodyInv, 1.0, Vecd<3>{ 3.0 * (i % 32), -3.0, 3.0 * (i / 32) });
+		for (int i(0); i < 300; ++i)
+			world.step(dTime);
+
+		results.push_back(measure(opts, asleepCase.first, [&]() {
+			world.applyForce(0, Vecd<3>{ 0.0, 9.8, 0.0 });
+			world.step(dTime);
+			benchSink = world.getVertex(0, 0).y();
+		}));
+	}
+
+	// Boxes scattered over a 64x64 area, drifting a little every frame
+	std::pair<const char*, Broadphase::Method> broadphaseCases[]
+	{
+		{ "physics/broadphase/sap", Broadphase::Method::SWEEP_AND_PRUNE },
+		{ "physics/broadphase/grid", Broadphase::Method::HASH_GRID }
+	};
+	for (auto& broadphaseCase : broadphaseCases)
+	{
+		if (std::string(broadphaseCase.first).find(opts.filter) == std::string::npos)
+			continue;
+
+		const size_t count = 2048;
+		std::mt19937 rng(33);
+		std::uniform_real_distribution<double> uniform(0.0, 64.0);
+		Vec3Array boxMin, boxMax;
+		boxMin.resize(count);
+		boxMax.resize(count);
+		for (size_t i(0); i < count; ++i)
+		{
+			Vecd<3> corner{ uniform(rng), uniform(rng) / 16, uniform(rng) };
+			boxMin.set(i, corner);
+			boxMax.set(i, corner + Vecd<3>{ 1.5, 1.5, 1.5 });
+		}
+
+		Broadphase::Params params;
+		params.method = broadphaseCase.second;
+		params.cellSize = 2.0;
+		Broadphase broadphase(params);
+		broadphase.update(boxMin, boxMax);
+
+		size_t frame(0);
+		results.push_back(measure(opts, broadphaseCase.first, [&]() {
+			double drift = (frame++ & 64) ? -0.01 : 0.01;
+			for (size_t i(0); i < count; ++i)
+			{
+				boxMin.x[i] += drift * (i % 3);
+				boxMax.x[i] += drift * (i % 3);
+			}
+			benchSink = (double)broadphase.update(boxMin, boxMax).size();
+		}));
+	}
+
+	// Wavy terrain of size x size quads, like level geometry
+	auto makeTerrain = [](int size) {
+		std::vector<Vecd<3>> verts;
+		std::vector<uint32_t> indices;
+		for (int z(0); z <= size; ++z)
+			for (int x(0); x <= size; ++x)
+				verts.push_back(Vecd<3>{ double(x), -2.0 + 0.5 * std::sin(x * 0.3) * std::cos(z * 0.2), double(z) });
+		for (int z(0); z < size; ++z)
+			for (int x(0); x < size; ++x)
+			{
+				uint32_t corner = z * (size + 1) + x;
+				indices.insert(indices.end(), { corner, corner + size + 1, corner + 1, corner + 1, corner + size + 1, corner + size + 2 });
+			}
+		return StaticMesh(verts, indices);
+	};
+
+	const std::pair<const char*, int> meshCases[]{
+		{ "physics/mesh/query/1k", 22 },
+		{ "physics/mesh/query/16k", 90 },
+		{ "physics/mesh/query/256k", 360 }
+	};
+
+	for (const auto& meshCase : meshCases)
+	{
+		if (std::string(meshCase.first).find(opts.filter) == std::string::npos)
+			continue;
+
+		StaticMesh mesh = makeTerrain(meshCase.second);
+		std::vector<uint32_t> found;
+		std::mt19937 rng(34);
+		std::uniform_real_distribution<double> uniform(0.0, meshCase.second);
+
+		// Body sized boxes all over the terrain
+		results.push_back(measure(opts, meshCase.first, [&]() {
+			Vecd<3> center{ uniform(rng), -2.0, uniform(rng) };
+			mesh.query(center - 1.5, center + 1.5, found);
+			benchSink = (double)found.size();
+		}));
+	}
+
+	if (std::string("physics/mesh/contact").find(opts.filter) != std::string::npos)
+	{
+		// Lying on the 256k triangles terrain
+		StaticMesh mesh = makeTerrain(360);
+		Simulator sim(vertices, IbodyInv, 1.0, 5.0);
+		sim.setEnvironment(&mesh);
+		sim.setCenterPos(Vecd<3>{ 180.0, 0.0, 180.0 });
+		sim.setAngularMomentum(Vecd<3>{ 0.3, 0.0, 0.2 });
+		for (int i(0); i < 120; ++i)
+			sim.updatePhysics(dTime);
+
+		results.push_back(measure(opts, "physics/mesh/contact", [&]() {
+			sim.applyForce(Vecd<3>{}); // Keeps it from falling asleep
+			benchSink = sim.updatePhysics(dTime)[0].y();
+		}));
+	}
+}
+
+
+//// REPORTS ////
+
+
+void writeJson(std::ostream& out, const std::vector<BenchResult>& results)
+{
+	out << "{\n  \"results\": [";
+	for (size_t i(0); i < results.size(); ++i)
+	{
+		out << (i ? ",\n" : "\n") << "    { \"name\": \"" << results[i].name << "\", \"nsPerOp\": "
+			<< std::fixed << std::setprecision(2) << results[i].nsPerOp << ", \"iterations\": " << results[i].iterations;
+		if (!results[i].error.empty())
+			out << ", \"error\": \"" << results[i].error << "\"";
+		if (!results[i].note.empty())
+			out << ", \"note\": \"" << results[i].note << "\"";
+		out << " }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+// Reads only what writeJson writes
+std::map<std::string, double> readBaseline(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw "Cant open baseline file";
+
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	const std::string text = buffer.str();
+
+	std::map<std::string, double> toRet;
+	size_t pos(0);
+	while ((pos = text.find("\"name\": \"", pos)) != std::string::npos)
+	{
+		pos += 9;
+		size_t nameEnd = text.find('"', pos);
+		size_t valuePos = text.find("\"nsPerOp\": ", nameEnd);
+		if (nameEnd == std::string::npos || valuePos == std::string::npos)
+			throw "Broken baseline file";
+
+		toRet[text.substr(pos, nameEnd - pos)] = atof(text.c_str() + valuePos + 11);
+		pos = valuePos;
+	}
+	return toRet;
+}
+
+
+int main(int argc, char* argv[])
+{
+	BenchOptions opts;
+	for (int i(1); i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--filter" && hasValue) opts.filter = argv[++i];
+		else if (arg == "--out" && hasValue) opts.outPath = argv[++i];
+		else if (arg == "--baseline" && hasValue) opts.baselinePath = argv[++i];
+		else if (arg == "--threshold" && hasValue) opts.threshold = atof(argv[++i]);
+		else if (arg == "--quick") { opts.samples = 3; opts.sampleMs = 10.0; }
+		else if (arg == "--verify") opts.verify = true;
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--filter text] [--out results.json]"
+				" [--baseline baseline.json] [--threshold 0.10] [--quick] [--verify]" << std::endl;
+			return 2;
+		}
+	}
+
+	if (opts.verify)
+		return verifyFastMath() ? 1 : 0;
+
+	std::vector<BenchResult> results;
+	benchTriangles(opts, results);
+	benchCanvas(opts, results);
+	benchJobs(opts, results);
+	benchTextures(opts, results);
+	benchMath(opts, results);
+	benchScene(opts, results);
+	benchMeshFile(opts, results);
+	benchCapture(opts, results);
+	benchPhysics(opts, results);
+
+	if (opts.outPath.empty())
+		writeJson(std::cout, results);
+	else
+	{
+		std::ofstream out(opts.outPath);
+		writeJson(out, results);
+	}
+
+	// Human readable table and the baseline verdict go to stderr, so stdout stays valid JSON
+	int exitCode(0);
+	std::map<std::string, double> baseline;
+	try
+	{
+		if (!opts.baselinePath.empty())
+			baseline = readBaseline(opts.baselinePath);
+	}
+	catch (const char* err)
+	{
+		std::cerr << err << std::endl;
+		return 2;
+	}
+
+	for (const auto& result : results)
+	{
+		std::cerr << std::left << std::setw(28) << result.name << std::right << std::setw(14)
+			<< std::fixed << std::setprecision(1) << result.nsPerOp << " ns";
+
+		if (!result.error.empty())
+		{
+			std::cerr << "  ERROR: " << result.error;
+			exitCode = 2;
+		}
+		else if (baseline.count(result.name) && baseline[result.name] > 0.0)
+		{
+			double ratio = result.nsPerOp / baseline[result.name];
+			std::cerr << std::setw(9) << std::setprecision(2) << ratio << "x";
+			if (ratio > 1.0 + opts.threshold)
+			{
+				std::cerr << "  REGRESSION";
+				exitCode = exitCode ? exitCode : 1;
+			}
+		}
+		if (!result.note.empty())
+			std::cerr << "  (" << result.note << ")";
+		std::cerr << std::endl;
+	}
+
+	// Baseline cases the filter selects but nothing ran (removed or renamed) fail too
+	for (const auto& baselineCase : baseline)
+	{
+		if (baselineCase.first.find(opts.filter) == std::string::npos)
+			continue;
+		auto found = std::find_if(results.begin(), results.end(), [&](const BenchResult& result) {
+			return result.name == baselineCase.first;
+		});
+		if (found != results.end())
+			continue;
+
+		std::cerr << std::left << std::setw(28) << baselineCase.first << "  MISSING (in the baseline, not run)" << std::endl;
+		exitCode = exitCode ? exitCode : 1;
+	}
+
+	return exitCode;
+}
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Broadphase.h"
+
+
+namespace
+{
+	bool overlaps(const Vec3Array& aabbMin, const Vec3Array& aabbMax, size_t a, size_t b)
+	{
+		return aabbMin.x[a] <= aabbMax.x[b] && aabbMin.x[b] <= aabbMax.x[a] &&
+			aabbMin.y[a] <= aabbMax.y[b] && aabbMin.y[b] <= aabbMax.y[a] &&
+			aabbMin.z[a] <= aabbMax.z[b] && aabbMin.z[b] <= aabbMax.z[a];
+	}
+
+	const std::vector<double>& axisOf(const Vec3Array& arr, int axis)
+	{
+		return axis == 0 ? arr.x : (axis == 1 ? arr.y : arr.z);
+	}
+}
+
+
+Broadphase::Broadphase(const Params& params) :
+	params(params)
+{
+	if (params.sweepAxis < 0 || params.sweepAxis > 2)
+		throw "Sweep axis can be only 0, 1 or 2";
+	if (params.cellSize <= 0.0)
+		throw "Cell size can be only > 0.0";
+}
+
+
+const std::vector<Broadphase::Pair>& Broadphase::update(const Vec3Array& aabbMin, const Vec3Array& aabbMax)
+{
+	PROFILE_SCOPE("broadphase");
+
+	// Every body counts as moved
+	const size_t count = aabbMin.x.size();
+	movedBodies.resize(count);
+	for (uint32_t body(0); body < count; ++body)
+		movedBodies[body] = body;
+	isMoved.assign(count, 1);
+
+	findPairs(aabbMin, aabbMax);
+	return pairs;
+}
+
+const std::vector<Broadphase::Pair>& Broadphase::update(const Vec3Array& aabbMin, const Vec3Array& aabbMax, const std::vector<uint32_t>& moved)
+{
+	PROFILE_SCOPE("broadphase");
+
+	const size_t count = aabbMin.x.size();
+	isMoved.resize(count);
+	movedBodies.clear();
+	for (uint32_t body : moved)
+		if (!isMoved[body])
+		{
+			isMoved[body] = 1;
+			movedBodies.push_back(body);
+		}
+	for (uint32_t body = uint32_t(bodyCount); body < count; ++body)
+		if (!isMoved[body])
+		{
+			isMoved[body] = 1;
+			movedBodies.push_back(body);
+		}
+
+	findPairs(aabbMin, aabbMax);
+	return pairs;
+}
+
+
+void Broadphase::findPairs(const Vec3Array& aabbMin, const Vec3Array& aabbMax)
+{
+	stats = {};
+	movedPairs.clear();
+
+	if (params.method == Method::SWEEP_AND_PRUNE)
+		sweepAndPrune(aabbMin, aabbMax);
+	else
+		hashGrid(aabbMin, aabbMax);
+
+	// Both methods give the same order, whatever order the pairs were found in
+	auto isLess = [](const Pair& lhs, const Pair& rhs) {
+		return lhs.first < rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+	};
+	std::sort(movedPairs.begin(), movedPairs.end(), isLess);
+
+	// Unmoved bodies overlap just like before
+	size_t kept(0);
+	for (const Pair& pair : pairs)
+		if (!isMoved[pair.first] && !isMoved[pair.second])
+			pairs[kept++] = pair;
+	pairs.resize(kept);
+	pairs.insert(pairs.end(), movedPairs.begin(), movedPairs.end());
+	std::inplace_merge(pairs.begin(), pairs.begin() + kept, pairs.end(), isLess);
+
+	for (uint32_t body : movedBodies)
+		isMoved[body] = 0;
+	bodyCount = aabbMin.x.size();
+	stats.pairsFound = pairs.size();
+}
+
+
+//// THREADING ////
+
+
+template <class Func>
+void Broadphase::runJobs(size_t count, const Func& func)
+{
+	// Pieces depend only on the count, every one has its own pairs and tests count
+	const size_t jobsCount = (count + jobGrain - 1) / jobGrain;
+	jobPairs.resize(std::max(jobPairs.size(), jobsCount));
+	jobTested.assign(jobsCount, 0);
+	for (size_t jobId(0); jobId < jobsCount; ++jobId)
+		jobPairs[jobId].clear();
+
+	auto piece = [&](size_t first, size_t last) {
+		func(first, last, jobPairs[first / jobGrain], jobTested[first / jobGrain]);
+	};
+	if (jobs)
+		jobs->parallelFor(count, jobGrain, piece);
+	else
+		for (size_t first(0); first < count; first += jobGrain)
+			piece(first, std::min(first + jobGrain, count));
+}
+
+void Broadphase::mergeJobs(size_t count)
+{
+	const size_t jobsCount = (count + jobGrain - 1) / jobGrain;
+	for (size_t jobId(0); jobId < jobsCount; ++jobId)
+	{
+		movedPairs.insert(movedPairs.end(), jobPairs[jobId].begin(), jobPairs[jobId].end());
+		stats.pairsTested += jobTested[jobId];
+	}
+}
+
+
+//// SWEEP AND PRUNE ////
+
+
+void Broadphase::sweepAndPrune(const Vec3Array& aabbMin, const Vec3Array& aabbMax)
+{
+	const size_t count = aabbMin.x.size();
+	const std::vector<double>& axisMin = axisOf(aabbMin, params.sweepAxis);
+	const std::vector<double>& axisMax = axisOf(aabbMax, params.sweepAxis);
+
+	// New bodies go to the end, insertion sort moves them to their place once
+	for (uint32_t body = uint32_t(endpoints.size() / 2); body < count; ++body)
+	{
+		endpoints.push_back({ 0.0, body, 0 });
+		endpoints.push_back({ 0.0, body, 1 });
+	}
+	activeSlot.resize(count);
+
+	for (auto& point : endpoints)
+		if (isMoved[point.body])
+			point.value = point.isMax ? axisMax[point.body] : axisMin[point.body];
+
+	// Order from the last frame is almost right, so this is close to linear
+	// Min goes before max at the same value, so touching boxes overlap
+	for (size_t i(1); i < endpoints.size(); ++i)
+	{
+		Endpoint point = endpoints[i];
+		size_t j = i;
+		while (j > 0 && (endpoints[j - 1].value > point.value ||
+			(endpoints[j - 1].value == point.value && endpoints[j - 1].isMax > point.isMax)))
+		{
+			endpoints[j] = endpoints[j - 1];
+			--j;
+		}
+		endpoints[j] = point;
+		stats.sortSwaps += i - j;
+	}
+
+	// Sweep, every body is tested only against boxes open on the sweep axis (and only if one of them moved)
+	const uint8_t* moved = isMoved.data();
+	active.clear();
+	for (auto& point : endpoints)
+	{
+		if (point.isMax)
+		{
+			uint32_t slot = activeSlot[point.body];
+			active[slot] = active.back();
+			activeSlot[active[slot]] = slot;
+			active.pop_back();
+			continue;
+		}
+
+		for (uint32_t other : active)
+		{
+			if (!(moved[point.body] | moved[other]))
+				continue;
+
+			stats.pairsTested++;
+			if (overlaps(aabbMin, aabbMax, point.body, other))
+				movedPairs.push_back({ std::min(point.body, other), std::max(point.body, other) });
+		}
+
+		activeSlot[point.body] = uint32_t(active.size());
+		active.push_back(point.body);
+	}
+}
+
+
+//// HASH GRID ////
+
+
+uint64_t Broadphase::cellKey(int32_t x, int32_t y, int32_t z)
+{
+	// 21 bits per axis
+	return (uint64_t(uint32_t(x) & 0x1fffff) << 42) | (uint64_t(uint32_t(y) & 0x1fffff) << 21) | uint64_t(uint32_t(z) & 0x1fffff);
+}
+
+Broadphase::CellRange Broadphase::getCellRange(const Vec3Array& aabbMin, const Vec3Array& aabbMax, size_t body) const
+{
+	const double invCell = 1.0 / params.cellSize;
+	return CellRange{
+		{ int32_t(std::floor(aabbMin.x[body] * invCell)), int32_t(std::floor(aabbMin.y[body] * invCell)), int32_t(std::floor(aabbMin.z[body] * invCell)) },
+		{ int32_t(std::floor(aabbMax.x[body] * invCell)), int32_t(std::floor(aabbMax.y[body] * invCell)), int32_t(std::floor(aabbMax.z[body] * invCell)) }
+	};
+}
+
+void Broadphase::insertIntoCells(uint32_t body, const CellRange& range)
+{
+	for (int32_t x = range.lo[0]; x <= range.hi[0]; ++x)
+		for (int32_t y = range.lo[1]; y <= range.hi[1]; ++y)
+			for (int32_t z = range.lo[2]; z <= range.hi[2]; ++z)
+				cells[cellKey(x, y, z)].push_back(body);
+}
+
+void Broadphase::removeFromCells(uint32_t body, const CellRange& range)
+{
+	for (int32_t x = range.lo[0]; x <= range.hi[0]; ++x)
+		for (int32_t y = range.lo[1]; y <= range.hi[1]; ++y)
+			for (int32_t z = range.lo[2]; z <= range.hi[2]; ++z)
+			{
+				auto cell = cells.find(cellKey(x, y, z));
+				auto& bodies = cell->second;
+				*std::find(bodies.begin(), bodies.end(), body) = bodies.back();
+				bodies.pop_back();
+				if (bodies.empty())
+					cells.erase(cell);
+			}
+}
+
+void Broadphase::hashGrid(const Vec3Array& aabbMin, const Vec3Array& aabbMax)
+{
+	// Only bodies which crossed a cell border touch the grid
+	for (uint32_t body : movedBodies)
+	{
+		CellRange range = getCellRange(aabbMin, aabbMax, body);
+		if (body >= bodyCount)
+		{
+			if (body >= bodyCells.size())
+				bodyCells.resize(body + 1);
+			bodyCells[body] = range;
+			insertIntoCells(body, range);
+			continue;
+		}
+
+		CellRange& old = bodyCells[body];
+		if (std::equal(old.lo, old.lo + 3, range.lo) && std::equal(old.hi, old.hi + 3, range.hi))
+			continue;
+
+		removeFromCells(body, old);
+		insertIntoCells(body, range);
+		old = range;
+	}
+
+	if (movedBodies.size() == bodyCells.size())
+	{
+		// Everything moved, every cell is tested whole
+		cellList.clear();
+		for (auto& cell : cells)
+			cellList.push_back(&cell);
+
+		runJobs(cellList.size(), [&](size_t first, size_t last, std::vector<Pair>& found, size_t& tested) {
+			for (size_t cellId(first); cellId < last; ++cellId)
+			{
+				const auto& bodies = cellList[cellId]->second;
+				for (size_t i(0); i < bodies.size(); ++i)
+					for (size_t j(i + 1); j < bodies.size(); ++j)
+					{
+						uint32_t a = bodies[i], b = bodies[j];
+						tested++;
+						if (!overlaps(aabbMin, aabbMax, a, b))
+							continue;
+
+						// A pair sharing several cells is reported only from the lowest one of them
+						const CellRange& rangeA = bodyCells[a];
+						const CellRange& rangeB = bodyCells[b];
+						if (cellKey(std::max(rangeA.lo[0], rangeB.lo[0]), std::max(rangeA.lo[1], rangeB.lo[1]),
+							std::max(rangeA.lo[2], rangeB.lo[2])) != cellList[cellId]->first)
+							continue;
+
+						found.push_back({ std::min(a, b), std::max(a, b) });
+					}
+			}
+		});
+		mergeJobs(cellList.size());
+		return;
+	}
+
+	// Moved bodies are tested against their cells, two moved ones only from the lower one
+	// Cells are only read from here on
+	runJobs(movedBodies.size(), [&](size_t first, size_t last, std::vector<Pair>& found, size_t& tested) {
+		for (size_t movedId(first); movedId < last; ++movedId)
+		{
+			const uint32_t body = movedBodies[movedId];
+			const CellRange& range = bodyCells[body];
+			for (int32_t x = range.lo[0]; x <= range.hi[0]; ++x)
+				for (int32_t y = range.lo[1]; y <= range.hi[1]; ++y)
+					for (int32_t z = range.lo[2]; z <= range.hi[2]; ++z)
+					{
+						const uint64_t key = cellKey(x, y, z);
+						for (uint32_t other : cells.find(key)->second)
+						{
+							if (other == body || (isMoved[other] && other < body))
+								continue;
+
+							tested++;
+							if (!overlaps(aabbMin, aabbMax, body, other))
+								continue;
+
+							// A pair sharing several cells is reported only from the lowest one of them
+							const CellRange& rangeOther = bodyCells[other];
+							if (cellKey(std::max(range.lo[0], rangeOther.lo[0]), std::max(range.lo[1], rangeOther.lo[1]),
+								std::max(range.lo[2], rangeOther.lo[2])) != key)
+								continue;
+
+							found.push_back({ std::min(body, other), std::max(body, other) });
+						}
+					}
+		}
+	});
+	mergeJobs(movedBodies.size());
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Vecd.h"
+
+
+// Candidate body pairs from per-body AABBs, so narrowphase doesnt test every pair
+class Broadphase
+{
+public:
+	enum class Method
+	{
+		SWEEP_AND_PRUNE,	// Sorted endpoints along one axis, kept sorted between frames
+		HASH_GRID			// Uniform grid, bodies are moved between cells only when they cross one
+	};
+
+	struct Params
+	{
+		Method method = Method::SWEEP_AND_PRUNE;
+		int sweepAxis = 0;		// 0 - x, 1 - y, 2 - z. Pick one the bodies are spread along (not the up axis)
+		double cellSize = 4.0;	// Hash grid only, about the size of a body
+	};
+
+	struct Pair
+	{
+		uint32_t first, second; // first < second
+	};
+
+	struct Stats
+	{
+		size_t pairsTested = 0;	// AABB overlap tests
+		size_t pairsFound = 0;
+		size_t sortSwaps = 0;	// Sweep and prune only, small when bodies move coherently
+	};
+
+	Broadphase(const Params& params);
+
+	/// @brief Finds overlapping boxes, bodies are expected to be only added between calls
+	/// @return Pairs sorted by (first, second), same for both methods
+	const std::vector<Pair>& update(const Vec3Array& aabbMin, const Vec3Array& aabbMax);
+
+	/// @brief Same, but only boxes of the moved bodies (and new ones) changed since the last update
+	/// Pairs of two unmoved bodies are kept, only pairs with a moved body are tested
+	/// Hash grid cost follows the moved bodies, sweep and prune still walks all endpoints once
+	const std::vector<Pair>& update(const Vec3Array& aabbMin, const Vec3Array& aabbMax, const std::vector<uint32_t>& moved);
+
+	/// @brief Hash grid pair tests run as jobs on it, not owned, nullptr - on the calling thread
+	/// Pairs found by every job are merged in job order, so results dont depend on the threads count
+	/// Grid cell updates and the sweep and prune sweep (its open boxes carry over from endpoint to endpoint) stay serial
+	void setJobSystem(JobSystem* jobSystem)	{ jobs = jobSystem; }
+
+	const std::vector<Pair>& getPairs() const		{ return pairs; }
+	const std::vector<Pair>& getMovedPairs() const	{ return movedPairs; } // Pairs with a moved or new body, sorted the same way
+	const Stats& getStats() const				{ return stats; }
+	const Params& getParams() const				{ return params; }
+
+private:
+	const Params params;
+	std::vector<Pair> pairs;
+	std::vector<Pair> movedPairs;
+	Stats stats;
+
+	size_t bodyCount = 0;			// At the last update
+	std::vector<uint32_t> movedBodies;
+	std::vector<uint8_t> isMoved;	// Set only during an update
+
+	// Threading
+	static constexpr size_t jobGrain = 256; // Moved bodies (or cells) per job
+	JobSystem* jobs = nullptr;
+	std::vector<std::vector<Pair>> jobPairs;	// Found by every job, merged in job order
+	std::vector<size_t> jobTested;
+
+	template <class Func>
+	void runJobs(size_t count, const Func& func);
+	void mergeJobs(size_t count);
+
+	void findPairs(const Vec3Array& aabbMin, const Vec3Array& aabbMax);
+
+	// Sweep and prune
+	struct Endpoint
+	{
+		double value;
+		uint32_t body;
+		uint32_t isMax;
+	};
+
+	std::vector<Endpoint> endpoints;
+	std::vector<uint32_t> active;
+	std::vector<uint32_t> activeSlot;
+
+	void sweepAndPrune(const Vec3Array& aabbMin, const Vec3Array& aabbMax);
+
+	// Hash grid
+	struct CellRange
+	{
+		int32_t lo[3], hi[3];
+	};
+
+	std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+	std::vector<const std::pair<const uint64_t, std::vector<uint32_t>>*> cellList; // Cells split between jobs when everything moved
+	std::vector<CellRange> bodyCells;
+
+	void hashGrid(const Vec3Array& aabbMin, const Vec3Array& aabbMax);
+	CellRange getCellRange(const Vec3Array& aabbMin, const Vec3Array& aabbMax, size_t body) const;
+	void insertIntoCells(uint32_t body, const CellRange& range);
+	void removeFromCells(uint32_t body, const CellRange& range);
+	static uint64_t cellKey(int32_t x, int32_t y, int32_t z);
+};
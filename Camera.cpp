@@ -1,38 +1,74 @@
 #include "Camera.h"
 
 
+#ifdef _WIN32
 void Camera::processInput(double dTime)
+{
+	applyInput(pollInput(), dTime);
+	pollCustomKeys();
+}
+
+Camera::InputState Camera::pollInput()
+{
+	InputState input;
+
+	// KEYBOARD //
+	if (GetAsyncKeyState('W') & 0x8000)
+		input.keys |= InputState::Forward;
+	else if (GetAsyncKeyState('S') & 0x8000)
+		input.keys |= InputState::Backward;
+	if (GetAsyncKeyState('A') & 0x8000)
+		input.keys |= InputState::Left;
+	else if (GetAsyncKeyState('D') & 0x8000)
+		input.keys |= InputState::Right;
+	if (GetAsyncKeyState(' ') & 0x8000)
+		input.keys |= InputState::Up;
+	else if (GetAsyncKeyState(VK_SHIFT) & 0x8000)
+		input.keys |= InputState::Down;
+
+	// MOUSE //
+	POINT pos;
+	::GetCursorPos(&pos);
+	::SetCursorPos(int(0.5 * m_width), int(0.5f * m_height));
+
+	input.mouseDx = pos.x - m_lastX;
+	input.mouseDy = pos.y - m_lastY; // reversed since y-coordinates go from bottom to top
+
+	return input;
+}
+
+void Camera::pollCustomKeys()
+{
+	for (auto& key : customKeys)
+		setCustomKeyState(key.first, GetKeyState(key.first) & 0x8000);
+}
+#endif
+
+void Camera::applyInput(const InputState& input, double dTime)
 {
 	// KEYBOARD //
 	double cameraSpeed = -5.0 * dTime;
-	if (GetAsyncKeyState('W') & 0x8000) {
+	if (input.keys & InputState::Forward) {
 		cameraPos.x() += cameraSpeed * cameraFront.x();
 		cameraPos.z() += cameraSpeed * cameraFront.z();
 	}
-	else if (GetAsyncKeyState('S') & 0x8000) {
+	else if (input.keys & InputState::Backward) {
 		cameraPos.x() -= cameraSpeed * cameraFront.x();
 		cameraPos.z() -= cameraSpeed * cameraFront.z();
 	}
-	if (GetAsyncKeyState('A') & 0x8000)
+	if (input.keys & InputState::Left)
 		cameraPos = cameraPos - normalize(cross(cameraFront, cameraUp)) * cameraSpeed;
-	else if (GetAsyncKeyState('D') & 0x8000)
+	else if (input.keys & InputState::Right)
 		cameraPos = cameraPos + normalize(cross(cameraFront, cameraUp)) * cameraSpeed;
-	if (GetAsyncKeyState(' ') & 0x8000)
+	if (input.keys & InputState::Up)
 		cameraPos.y() -= cameraSpeed;
-	else if (GetAsyncKeyState(VK_SHIFT) & 0x8000)
+	else if (input.keys & InputState::Down)
 		cameraPos.y() += cameraSpeed;
 
 	// MOUSE //
-	POINT pos;
-	::GetCursorPos(&pos);
-	::SetCursorPos(int(0.5 * m_width), int(0.5f * m_height));
-
-	float xoffset = pos.x - m_lastX;
-	float yoffset = pos.y - m_lastY; // reversed since y-coordinates go from bottom to top
-
 	float sensitivity = 0.1f; // change this value to your liking
-	xoffset *= sensitivity;
-	yoffset *= sensitivity;
+	float xoffset = input.mouseDx * sensitivity;
+	float yoffset = input.mouseDy * sensitivity;
 
 	m_yaw += xoffset;
 	m_pitch += yoffset;
@@ -43,30 +79,22 @@ void Camera::processInput(double dTime)
 	if (m_pitch < -89.0f)
 		m_pitch = -89.0f;
 
-	cameraFront = normalize(Vecd<3>{
-		cos(M_PI* m_yaw / 180)* cos(M_PI* m_pitch / 180),
-			sin(M_PI* m_pitch / 180),
-			sin(M_PI* m_yaw / 180)* cos(M_PI* m_pitch / 180)
-	});
-
+	double sinYaw, cosYaw, sinPitch, cosPitch;
+	fmath::sincos(M_PI * m_yaw / 180, sinYaw, cosYaw);
+	fmath::sincos(M_PI * m_pitch / 180, sinPitch, cosPitch);
+	cameraFront = normalize(Vecd<3>{ cosYaw * cosPitch, sinPitch, sinYaw * cosPitch });
+}
 
-	// Custom keys
+void Camera::setCustomKeyState(long keyId, bool isPressed)
+{
 	for (auto& key : customKeys)
 	{
-		if (!key.second)
-		{
-			if (GetKeyState(key.first) & 0x8000) {
-				key.second = true;
-				customKeysCallback(key.first, key.second);
-			}
-		}
-		else
-		{
-			if (!(GetKeyState(key.first) & 0x8000)) {
-				key.second = false;
-				customKeysCallback(key.first, key.second);
-			}
-		}
+		if (key.first != keyId || key.second == isPressed)
+			continue;
+
+		key.second = isPressed;
+		if (customKeysCallback)
+			customKeysCallback(key.first, key.second);
 	}
 }
 
@@ -108,7 +136,7 @@ Matd<4, 4> Camera::perspective(double aspect, double nearPlane, double farPlane)
 
 double Camera::timeSinceStart()
 {
-	return 1e-9 * (std::chrono::high_resolution_clock::now() - startTime).count();
+	return 1e-9 * (std::chrono::steady_clock::now() - startTime).count();
 }
 
 void Camera::addTrackingKey(long keyId)
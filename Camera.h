@@ -1,9 +1,15 @@
 #pragma once
 
-#include <Windows.h>
+#ifdef _WIN32
 #include <corecrt_math_defines.h>
+#endif
+#include <cstdint>
+#include <cmath>
 #include <chrono>
 #include <vector>
+#include <algorithm>
+
+#include "Platform.h"
 
 #include "Vecd.h"
 #include "Matd.h"
@@ -12,14 +18,40 @@
 class Camera
 {
 public:
+	// Everything processInput reads from the keyboard and mouse in one frame
+	struct InputState
+	{
+		enum Keys : uint8_t
+		{
+			Forward = 1, Backward = 2, Left = 4, Right = 8, Up = 16, Down = 32
+		};
+
+		uint8_t keys = 0;
+		float mouseDx = 0.0f;
+		float mouseDy = 0.0f;
+	};
+
 	Camera(float screenWidth, float screenHeight, float FoV = 45.0f)
 		: m_width(screenWidth), m_height(screenHeight), m_lastX(0.5f * m_width), m_lastY(0.5f * m_height), m_fov(FoV)
 	{
+#ifdef _WIN32
 		::SetCursorPos((int)m_lastX, (int)m_lastY);
-		startTime = std::chrono::high_resolution_clock::now();
+#endif
+		startTime = std::chrono::steady_clock::now();
 	}
 
+#ifdef _WIN32
+	/// @brief Polls the keyboard and mouse, then applies them (live mode)
 	void processInput(double dTime);
+	InputState pollInput();
+	void pollCustomKeys();
+#endif
+
+	/// @brief Moves and rotates the camera, same for live input and replays
+	void applyInput(const InputState& input, double dTime);
+
+	/// @brief Calls the custom keys callback if the tracked key changed its state
+	void setCustomKeyState(long keyId, bool isPressed);
 
 	// Custom implementation of the LookAt and perspective functions
 	Matd<4, 4> lookAt();
@@ -1,10 +1,81 @@
 #include "Canvas.h"
 
 
+// Standard sample positions, relative to the upper left pixel corner
+static const Vecd<2> samplePattern1[1]{ { 0.5, 0.5 } };
+static const Vecd<2> samplePattern2[2]{ { 0.75, 0.75 }, { 0.25, 0.25 } };
+static const Vecd<2> samplePattern4[4]{
+	{ 0.375, 0.125 }, { 0.875, 0.375 }, { 0.125, 0.625 }, { 0.625, 0.875 }
+};
+static const Vecd<2> samplePattern8[8]{
+	{ 0.5625, 0.3125 }, { 0.4375, 0.6875 }, { 0.8125, 0.5625 }, { 0.3125, 0.1875 },
+	{ 0.1875, 0.8125 }, { 0.0625, 0.4375 }, { 0.6875, 0.9375 }, { 0.9375, 0.0625 }
+};
+
+static const Vecd<2>* getSamplePattern(unsigned samplesCount)
+{
+	switch (samplesCount)
+	{
+	case 1: return samplePattern1;
+	case 2: return samplePattern2;
+	case 4: return samplePattern4;
+	case 8: return samplePattern8;
+	default: throw("Unsupported samples count");
+	}
+}
+
+/// @brief Adds rect, merging every rect it overlaps into their bounds, so rects never overlap
+static void addDamage(std::vector<PixelRect>& rects, PixelRect rect, size_t maxRects)
+{
+	for (size_t i(0); i < rects.size();)
+	{
+		const PixelRect& other = rects[i];
+		if (other.minX > rect.maxX || other.maxX < rect.minX || other.minY > rect.maxY || other.maxY < rect.minY)
+		{
+			++i;
+			continue;
+		}
+
+		// The merged rect may overlap ones already passed
+		rect = PixelRect{ std::min(rect.minX, other.minX), std::min(rect.minY, other.minY),
+			std::max(rect.maxX, other.maxX), std::max(rect.maxY, other.maxY) };
+		rects.erase(rects.begin() + i);
+		i = 0;
+	}
+	rects.push_back(rect);
+
+	if (rects.size() > maxRects)
+	{
+		PixelRect bounds = rects[0];
+		for (const PixelRect& other : rects)
+			bounds = PixelRect{ std::min(bounds.minX, other.minX), std::min(bounds.minY, other.minY),
+				std::max(bounds.maxX, other.maxX), std::max(bounds.maxY, other.maxY) };
+		rects.assign(1, bounds);
+	}
+}
+
+/// @brief Calls func(row, firstColumn, lastColumn + 1) for every row of every rect within firstRow..lastRow-1
+static void forEachSpan(const std::vector<PixelRect>& rects, size_t firstRow, size_t lastRow,
+	const std::function<void(size_t, size_t, size_t)>& func)
+{
+	for (const PixelRect& rect : rects)
+	{
+		const size_t top = std::max((size_t)rect.minY, firstRow);
+		const size_t bottom = std::min((size_t)rect.maxY + 1, lastRow);
+		for (size_t row(top); row < bottom; ++row)
+			func(row, rect.minX, (size_t)rect.maxX + 1);
+	}
+}
+
+#ifdef _WIN32
 Canvas::Canvas(HWND windowHandler, unsigned width, unsigned height, const Params& params)
 	: m_windowHandler(windowHandler), m_width(width), m_height(height),
-	m_colorsCount(params.colorsCount), m_context(::GetDC(m_windowHandler))
+	m_colorsCount(params.colorsCount), m_samplesCount(params.samplesCount),
+	m_targetWidth(width), m_targetHeight(height),
+	m_isDynamicResolution(params.dynamicResolution), m_scaler(params.resolution),
+	m_isPartialRedraw(params.partialRedraw)
 {
+	m_context = ::GetDC(m_windowHandler);
 	if (!m_context)
 		throw("Cant get device context");
 
@@ -38,24 +109,75 @@ Canvas::Canvas(HWND windowHandler, unsigned width, unsigned height, const Params
 	if (!oldObj || oldObj == HGDI_ERROR)
 		throw("Cant select new bitmap");
 
+	init(params);
+	showCursor(!params.dontShowCursor);
+}
+#endif
+
+Canvas::Canvas(unsigned width, unsigned height, const Params& params)
+	: m_windowHandler(nullptr), m_width(width), m_height(height),
+	m_colorsCount(params.colorsCount), m_samplesCount(params.samplesCount),
+	m_targetWidth(width), m_targetHeight(height),
+	m_isDynamicResolution(params.dynamicResolution), m_scaler(params.resolution),
+	m_isPartialRedraw(params.partialRedraw)
+{
+	m_headlessPixels.resize(getPixelsSize());
+	m_framePixels = m_headlessPixels.data();
+
+	init(params);
+}
+
+void Canvas::init(const Params& params)
+{
+	getSamplePattern(m_samplesCount); // Throws if count is unsupported
+	if (m_colorsCount != 3 && m_colorsCount != 4)
+		throw("Unsupported colors count");
+	m_cullMode = params.cullMode;
+	if (m_samplesCount > 1)
+		m_samples.resize((size_t)m_width * m_height * m_samplesCount);
+
+	// Packed frame, the presented one is already packed with 4 colors (bitmap and vector memory is aligned)
+	if (m_colorsCount == 4)
+		m_packedFrame = (uint32_t*)m_framePixels;
+	else
+	{
+		m_packedFramePixels.resize((size_t)m_width * m_height);
+		m_packedFrame = m_packedFramePixels.data();
+	}
+
+	// Render target, buffers are big enough for the full resolution
+	buildRenderGraph();
+	m_targetPixels = m_graph.getBuffer<uint32_t>(m_targetBuffer);
+	if (m_isDynamicResolution)
+		setRenderScale(m_scaler.getScale());
+
 	// Fill entire canvas with white
 	memset(m_framePixels, 255, getPixelsSize());
+	std::fill(m_packedFrame, m_packedFrame + (size_t)m_width * m_height, 0xffffffff);
+	std::fill(m_targetPixels, m_targetPixels + (size_t)m_width * m_height, 0xffffffff);
+	std::fill(m_samples.begin(), m_samples.end(), 0x00ffffff);
 
 	// Additional settings
 	dontCloseWindow(params.dontCloseWindow);
-	showCursor(!params.dontShowCursor);
 	m_isShowMSPF = params.showMSPF;
 }
 
 Canvas::~Canvas()
 {
+#ifdef _WIN32
+	if (!m_windowHandler)
+		return;
+
 	::DeleteDC(m_memContext);
 	::DeleteObject(m_frameBitmap);
 
 	if (m_isDontCloseWindow) Sleep(INFINITE);
+#endif
 }
 
 
+#ifdef _WIN32
+
 
 void Canvas::setAlignment(int horizAlign, int vertAlign)
 {
@@ -104,28 +226,61 @@ void Canvas::setAlignment(Align align, int horizAlign, int vertAlign)
 		m_vertAlign += windowRect.bottom - m_height;
 }
 
+#endif
+
 void Canvas::setPixel(unsigned x, unsigned y, COLORREF rgb)
 {
-	if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+	if (x < 0 || y < 0 || x >= m_targetWidth || y >= m_targetHeight)
 		return;
+	flushClear();
+	m_isFullDamage = true;
 
 	//if (a < 0) a = 0;
 	//if (a > 1) a = 1;
 
-	int index = y * m_width * m_colorsCount + x * m_colorsCount;
 	rgb = _byteswap_ulong(rgb) >> 8;
-	memcpy(&m_framePixels[index], &rgb, m_colorsCount);
+	m_targetPixels[(size_t)y * m_targetWidth + x] = rgb;
+
+	// Every sample gets the color, otherwise resolve would bring the old one back
+	if (m_samplesCount > 1)
+	{
+		uint32_t* samples = &m_samples[((size_t)y * m_targetWidth + x) * m_samplesCount];
+		for (unsigned s(0); s < m_samplesCount; ++s)
+			samples[s] = rgb;
+	}
 }
 
 void Canvas::setArray(PUCHAR arr)
 {
-	if (!::SetDIBits(m_memContext, m_frameBitmap, 0, m_height, arr, &m_bitmapInfo, DIB_RGB_COLORS))
-		throw("Cant set the exact array");
+	m_isFullDamage = true;
+#ifdef _WIN32
+	if (m_windowHandler)
+	{
+		if (!::SetDIBits(m_memContext, m_frameBitmap, 0, m_height, arr, &m_bitmapInfo, DIB_RGB_COLORS))
+			throw("Cant set the exact array");
+		return;
+	}
+#endif
+	setArrayCopy(arr);
 }
 
 void Canvas::setArrayCopy(PUCHAR arr)
 {
 	memcpy(m_framePixels, arr, getPixelsSize());
+	m_isFullDamage = true;
+	if (m_colorsCount == 4)
+		return;
+
+	// The packed frame is what the next frame starts from
+	for (size_t pixel(0); pixel < (size_t)m_width * m_height; ++pixel, arr += 3)
+		m_packedFrame[pixel] = arr[0] | arr[1] << 8 | arr[2] << 16;
+}
+
+void Canvas::setCapture(FrameCapture* capture)
+{
+	if (capture && (capture->getWidth() != m_width || capture->getHeight() != m_height))
+		throw "Capture size has to be the canvas size";
+	m_capture = capture;
 }
 
 
@@ -135,13 +290,24 @@ const size_t Canvas::getPixelsSize() const
 	return (size_t)m_width * m_height * m_colorsCount;
 }
 
+unsigned Canvas::getRenderWidth() const
+{
+	return m_targetWidth;
+}
+
+unsigned Canvas::getRenderHeight() const
+{
+	return m_targetHeight;
+}
+
 COLORREF Canvas::getPixel(unsigned x, unsigned y) const
 {
-	if (x < 0 || y < 0 || x > m_width || y > m_height)
+	if (x < 0 || y < 0 || x >= m_targetWidth || y >= m_targetHeight)
 		return RGB(0, 0, 0);
+	if (m_isClearPending)
+		return m_clearColor;
 
-	int idx = y * m_width * m_colorsCount + x * m_colorsCount;
-	return _byteswap_ulong((COLORREF&)m_framePixels[idx] << 8);
+	return _byteswap_ulong(m_targetPixels[(size_t)y * m_targetWidth + x] << 8);
 }
 
 PUCHAR Canvas::getArray() const
@@ -160,19 +326,35 @@ PUCHAR Canvas::getArrayCopy() const
 
 void Canvas::fill(COLORREF rgb, float a)
 {
-	for (unsigned y(0); y < m_height; ++y)
-		for (unsigned x(0); x < m_width; ++x)
-		{
-			COLORREF prev = getPixel(x, y);
-			char R = GetRValue(prev) * (1.0f - a) + GetRValue(rgb) * a;
-			char G = GetGValue(prev) * (1.0f - a) + GetGValue(rgb) * a;
-			char B = GetBValue(prev) * (1.0f - a) + GetBValue(rgb) * a;
-			setPixel(x, y, RGB(R, G, B));
-		}
+	if (a >= 1.0f)
+	{
+		m_isClearPending = true;
+		m_clearColor = rgb;
+		return;
+	}
+
+	PROFILE_SCOPE("fill");
+	auto startTime = std::chrono::high_resolution_clock::now();
+	flushClear();
+	m_isFullDamage = true;
+
+	// Premultiplied over, same as blended figures. Samples are blended one by one, so edges stay antialiased
+	const uint32_t alpha = uint32_t(a <= 0.0f ? 0.0f : a * 255 + 0.5f);
+	const uint32_t color = scaleChannels(_byteswap_ulong(rgb) >> 8, alpha + (alpha >> 7));
+	const size_t rowSamples = (size_t)m_targetWidth * m_samplesCount;
+	forEachBand(m_targetHeight, [&](size_t firstRow, size_t lastRow) {
+		blendPixels(BlendMode::OVER, m_targetPixels + firstRow * m_targetWidth, (lastRow - firstRow) * m_targetWidth, color, alpha);
+		if (m_samplesCount > 1)
+			blendPixels(BlendMode::OVER, m_samples.data() + firstRow * rowSamples, (lastRow - firstRow) * rowSamples, color, alpha);
+	});
+
+	m_workTime += std::chrono::high_resolution_clock::now() - startTime;
 }
 
 void Canvas::addFigure(IFigure* newFig)
 {
+	PROFILE_SCOPE("clip");
+
 	// Checking where w < 0
 	Vecd<4>* vertices = newFig->getVertexArray();
 	unsigned badVertIds[3]{}, goodVertIds[3]{}, badOffset(0), goodOffset(0);
@@ -241,37 +423,437 @@ void Canvas::addFigure(IFigure* newFig)
 void Canvas::render()
 {
 	using namespace std::chrono;
-	CanvasData cd{ m_framePixels, m_width, m_height, m_colorsCount };
-
-	if (m_isShowMSPF) {
-		m_timePoint = high_resolution_clock::now();
-	}
+	m_timePoint = high_resolution_clock::now();
 
+	m_frameFigures.clear();
 	while (!figures.empty())
 	{
-		figures.front()->draw(cd);
+		m_frameFigures.push_back(std::move(figures.front()));
 		figures.pop();
 	}
 
-	// Stretching, never needed
-	/*if (!::StretchBlt(m_context, m_horizAlign, m_vertAlign, m_width, m_height,
-		m_memContext, 0, 0, m_width, m_height, SRCCOPY))
-		throw("Cant stretch and draw pixels");*/
+	// Setup decides the damage, every pass of the graph needs it
+	setupFigures();
+
+	// Clear, raster, resolve and upscale, whichever of them this canvas needs
+	m_graph.execute(m_jobs);
+	m_isClearPending = false;
+	m_frameFigures.clear();
+
+	if (m_capture)
+	{
+		// Only a copy, conversion and writing are on the capture thread
+		PROFILE_SCOPE("capture");
+		m_capture->submit(m_framePixels, m_colorsCount);
+	}
+
+	PROFILE_SCOPE("present");
+#ifdef _WIN32
+	if (m_windowHandler)
+	{
+		// Stretching, never needed
+		/*if (!::StretchBlt(m_context, m_horizAlign, m_vertAlign, m_width, m_height,
+			m_memContext, 0, 0, m_width, m_height, SRCCOPY))
+			throw("Cant stretch and draw pixels");*/
+
+		for (const PixelRect& rect : m_frameDamage)
+			if (!::BitBlt(m_context, m_horizAlign + rect.minX, m_vertAlign + rect.minY, rect.maxX - rect.minX + 1, rect.maxY - rect.minY + 1,
+				m_memContext, rect.minX, rect.minY, SRCCOPY))
+				throw("Cant stretch and draw pixels");
+
+		if (m_isShowMSPF)
+		{
+			std::wstringstream name;
+			name << duration_cast<milliseconds>(high_resolution_clock::now() - m_timePoint).count() << L"ms";
+			if (m_isDynamicResolution)
+				name << L" " << m_targetWidth << L"x" << m_targetHeight;
+			SetWindowText(m_windowHandler, name.str().c_str());
+		}
+	}
+#endif
+
+	// Resolution for the next frame, the current one is already presented
+	if (m_isDynamicResolution)
+		setRenderScale(m_scaler.update(m_workTime.count()));
+	m_workTime = {};
+}
+
+
+
+void Canvas::buildRenderGraph()
+{
+	using Access = RenderGraph::Access;
+	const bool isMultisampled = m_samplesCount > 1;
+	const size_t pixelsCount = (size_t)m_width * m_height;
+
+	const size_t packedSize = pixelsCount * sizeof(uint32_t);
+	m_frameBuffer = m_graph.importBuffer("frame", m_packedFrame, packedSize);
+	m_depthBuffer = m_graph.createTransient("depth", pixelsCount * m_samplesCount * sizeof(float));
+
+	// The target lives across frames (blending fill, getPixel, partial redraw) unless every frame resolves into it whole
+	// With partial redraw resolve and upscale overwrite only the damage, which is everything clear would have written
+	m_targetBuffer = m_frameBuffer;
+	if (m_isDynamicResolution && isMultisampled && !m_isPartialRedraw)
+		m_targetBuffer = m_graph.createTransient("target", packedSize);
+	else if (m_isDynamicResolution)
+	{
+		m_renderPixels.resize(pixelsCount);
+		m_targetBuffer = m_graph.importBuffer("target", m_renderPixels.data(), packedSize);
+	}
+
+	// Dropped with multisampling, resolve overwrites the target anyway
+	m_graph.addPass("clear target", { { m_targetBuffer, Access::OVERWRITE } }, [this]() { clearTarget(); });
+
+	if (isMultisampled)
+	{
+		m_samplesBuffer = m_graph.importBuffer("samples", m_samples.data(), m_samples.size() * sizeof(uint32_t));
+		m_graph.addPass("clear samples", { { m_samplesBuffer, Access::OVERWRITE } }, [this]() { clearSamples(); });
+	}
+
+	const RenderGraph::ResourceId colorBuffer = isMultisampled ? m_samplesBuffer : m_targetBuffer;
+	m_graph.addPass("raster", { { m_depthBuffer, Access::OVERWRITE }, { colorBuffer, Access::WRITE } }, [this]() { rasterize(); });
+	m_graph.addPass("transparent", { { m_depthBuffer, Access::READ }, { colorBuffer, Access::WRITE } }, [this]() { rasterizeBlended(); });
+
+	if (isMultisampled)
+		m_graph.addPass("resolve", { { m_samplesBuffer, Access::READ }, { m_targetBuffer, Access::OVERWRITE } }, [this]() { resolve(); });
+
+	if (m_isDynamicResolution)
+		m_graph.addPass("upscale", { { m_targetBuffer, Access::READ }, { m_frameBuffer, Access::OVERWRITE } }, [this]() {
+			// Everything up to here depends on the render resolution
+			m_workTime += std::chrono::high_resolution_clock::now() - m_timePoint;
+			upscale();
+		});
+
+	// Frame is converted once (the damage only with partial redraw), the last pass before present
+	if (m_colorsCount == 3)
+	{
+		m_presentBuffer = m_graph.importBuffer("present", m_framePixels, getPixelsSize());
+		m_graph.addPass("convert", { { m_frameBuffer, Access::READ }, { m_presentBuffer, Access::OVERWRITE } }, [this]() { convert(); });
+	}
+
+	m_graph.compile();
+}
+
+void Canvas::flushClear()
+{
+	if (!m_isClearPending)
+		return;
+
+	// Outside of render, so it is the whole target and the next frame is drawn whole
+	m_isFullDamage = true;
+	m_damage.assign(1, PixelRect{ 0, 0, (int)m_targetWidth - 1, (int)m_targetHeight - 1 });
+	clearTarget();
+	if (m_samplesCount > 1)
+		clearSamples();
+	m_isClearPending = false;
+}
+
+void Canvas::clearTarget()
+{
+	if (!m_isClearPending)
+		return;
+
+	PROFILE_SCOPE("clear");
+	const uint32_t packed = _byteswap_ulong(m_clearColor) >> 8;
+	forEachBand(m_targetHeight, [&](size_t firstRow, size_t lastRow) {
+		forEachSpan(m_damage, firstRow, lastRow, [&](size_t row, size_t first, size_t last) {
+			std::fill(m_targetPixels + row * m_targetWidth + first, m_targetPixels + row * m_targetWidth + last, packed);
+		});
+	});
+}
+
+void Canvas::clearSamples()
+{
+	if (!m_isClearPending)
+		return;
+
+	PROFILE_SCOPE("clear");
+	const uint32_t packed = _byteswap_ulong(m_clearColor) >> 8;
+	forEachBand(m_targetHeight, [&](size_t firstRow, size_t lastRow) {
+		forEachSpan(m_damage, firstRow, lastRow, [&](size_t row, size_t first, size_t last) {
+			const size_t rowPixel = row * m_targetWidth;
+			std::fill(m_samples.begin() + (rowPixel + first) * m_samplesCount, m_samples.begin() + (rowPixel + last) * m_samplesCount, packed);
+		});
+	});
+}
+
+CanvasData Canvas::getCanvasData()
+{
+	return CanvasData{ m_targetPixels, m_targetWidth, m_targetHeight, m_samplesCount,
+		getSamplePattern(m_samplesCount), m_graph.getBuffer<float>(m_depthBuffer),
+		m_samplesCount > 1 ? m_samples.data() : nullptr, m_cullMode };
+}
+
+void Canvas::setupFigures()
+{
+	CanvasData cd = getCanvasData();
+	{
+		// Figures that cant produce a fragment are dropped here, so no band walks their pixels
+		PROFILE_SCOPE("setup");
+		auto culled = std::remove_if(m_frameFigures.begin(), m_frameFigures.end(), [&cd](const std::unique_ptr<IFigure>& figure) {
+			return !figure->setup(cd);
+		});
+		m_culledCount = m_frameFigures.end() - culled;
+		m_frameFigures.erase(culled, m_frameFigures.end());
+
+		// Blended figures wait for the transparent pass, in the order they came
+		m_firstBlended = std::stable_partition(m_frameFigures.begin(), m_frameFigures.end(), [](const std::unique_ptr<IFigure>& figure) {
+			return figure->getBlendMode() == BlendMode::NONE;
+		}) - m_frameFigures.begin();
+	}
+
+	PROFILE_SCOPE("damage");
+	updateDamage();
+}
+
+void Canvas::updateDamage()
+{
+	const PixelRect whole{ 0, 0, (int)m_targetWidth - 1, (int)m_targetHeight - 1 };
+	m_damage.clear();
+	if (m_isPartialRedraw)
+	{
+		// Bounds in target rows, top down
+		m_figureKeys.clear();
+		for (const std::unique_ptr<IFigure>& figure : m_frameFigures)
+		{
+			const PixelRect bounds = figure->getBounds();
+			m_figureKeys.emplace_back(figure->getHash(), PixelRect{ bounds.minX, (int)m_targetHeight - 1 - bounds.maxY,
+				bounds.maxX, (int)m_targetHeight - 1 - bounds.minY });
+		}
+		std::sort(m_figureKeys.begin(), m_figureKeys.end(), [](const auto& first, const auto& second) {
+			return first.first < second.first;
+		});
+
+		// Another clear (or none) changes every pixel
+		if (m_isClearPending != m_wasClearPending || (m_isClearPending && m_clearColor != m_lastClearColor))
+			m_isFullDamage = true;
+		m_wasClearPending = m_isClearPending;
+		m_lastClearColor = m_clearColor;
+
+		// Figures only one of the frames has moved, appeared or disappeared, the ones matched dont change a pixel
+		// (their order is not compared, overlapping figures at the same depth keep whichever came first)
+		auto current = m_figureKeys.cbegin(), last = m_lastFigureKeys.cbegin();
+		while (!m_isFullDamage && (current != m_figureKeys.cend() || last != m_lastFigureKeys.cend()))
+		{
+			if (last == m_lastFigureKeys.cend() || (current != m_figureKeys.cend() && current->first < last->first))
+				addDamage(m_damage, (current++)->second, maxDamageRects);
+			else if (current == m_figureKeys.cend() || last->first < current->first)
+				addDamage(m_damage, (last++)->second, maxDamageRects);
+			else
+			{
+				++current;
+				++last;
+			}
+		}
+		std::swap(m_figureKeys, m_lastFigureKeys);
+	}
+	if (!m_isPartialRedraw || m_isFullDamage)
+		m_damage.assign(1, whole);
+	m_isFullDamage = false;
+
+	// Upscaled pixels read the target pixel on either side, so the frame damage is grown by one target pixel
+	if (m_targetWidth == m_width && m_targetHeight == m_height)
+	{
+		m_frameDamage = m_damage;
+		return;
+	}
+
+	auto toFrame = [](int first, int last, unsigned srcSize, unsigned dstSize) {
+		const double scale = (double)dstSize / srcSize;
+		return std::make_pair(std::max((int)std::floor((first - 0.5) * scale - 0.5), 0),
+			std::min((int)std::ceil((last + 1.5) * scale - 0.5), (int)dstSize - 1));
+	};
+	m_frameDamage.clear();
+	for (const PixelRect& rect : m_damage)
+	{
+		const auto columns = toFrame(rect.minX, rect.maxX, m_targetWidth, m_width);
+		const auto rows = toFrame(rect.minY, rect.maxY, m_targetHeight, m_height);
+		m_frameDamage.push_back(PixelRect{ columns.first, rows.first, columns.second, rows.second });
+	}
+}
+
+void Canvas::rasterize()
+{
+	// Shading is interleaved with rasterization per pixel, so they are timed together
+	PROFILE_SCOPE("raster+shade");
+	rasterizeBands(getCanvasData(), 0, m_firstBlended, true);
+}
+
+void Canvas::rasterizeBlended()
+{
+	if (m_firstBlended == m_frameFigures.size())
+		return;
+
+	// Opaque depth rejects hidden fragments before they are shaded, nothing here writes it
+	PROFILE_SCOPE("transparent");
+	rasterizeBands(getCanvasData(), m_firstBlended, m_frameFigures.size(), false);
+}
+
+void Canvas::rasterizeBands(const CanvasData& cd, size_t firstFigure, size_t lastFigure, bool isDepthCleared)
+{
+	// Depth is transient, the first pass using it clears it band by band (the damage only, nothing else is drawn)
+	forEachBand(m_targetHeight, [&](size_t firstRow, size_t lastRow) {
+		CanvasData bandData = cd;
+		for (const PixelRect& rect : m_damage)
+		{
+			const int top = std::max(rect.minY, (int)firstRow);
+			const int bottom = std::min(rect.maxY, (int)lastRow - 1);
+			if (top > bottom)
+				continue;
+
+			if (isDepthCleared)
+				for (size_t row = top; row <= (size_t)bottom; ++row)
+					std::fill(cd.depth + (row * m_targetWidth + rect.minX) * m_samplesCount,
+						cd.depth + (row * m_targetWidth + rect.maxX + 1) * m_samplesCount, 0.0f);
+
+			// Window rows go bottom up, damage rows top down
+			const PixelRect area{ rect.minX, (int)m_targetHeight - 1 - bottom, rect.maxX, (int)m_targetHeight - 1 - top };
+			for (size_t figure(firstFigure); figure < lastFigure; ++figure)
+			{
+				const PixelRect bounds = m_frameFigures[figure]->getBounds();
+				if (bounds.minX <= area.maxX && bounds.maxX >= area.minX && bounds.minY <= area.maxY && bounds.maxY >= area.minY)
+					m_frameFigures[figure]->rasterize(bandData, area);
+			}
+		}
+	});
+}
+
+
+void Canvas::resolve()
+{
+	PROFILE_SCOPE("resolve");
+
+	// Power of two samples, so averaging is a shift
+	unsigned shift(0);
+	while ((1u << shift) < m_samplesCount)
+		shift++;
+
+	forEachBand(m_targetHeight, [&](size_t firstRow, size_t lastRow) {
+		forEachSpan(m_damage, firstRow, lastRow, [&](size_t row, size_t first, size_t last) {
+			const size_t lastPixel = row * m_targetWidth + last;
+			const uint32_t* samples = m_samples.data() + (row * m_targetWidth + first) * m_samplesCount;
+			for (size_t pixel(row * m_targetWidth + first); pixel < lastPixel; ++pixel, samples += m_samplesCount)
+			{
+				// Two channels per 32 bits with 16 bits each, up to 8 samples dont overflow
+				uint32_t evenSum(0), oddSum(0);
+				for (unsigned s(0); s < m_samplesCount; ++s)
+				{
+					evenSum += samples[s] & 0x00ff00ff;
+					oddSum += (samples[s] >> 8) & 0x00ff00ff;
+				}
+
+				m_targetPixels[pixel] = ((evenSum >> shift) & 0x00ff00ff) | (((oddSum >> shift) & 0x00ff00ff) << 8);
+			}
+		});
+	});
+}
+
+void Canvas::upscale()
+{
+	if (m_targetWidth == m_width && m_targetHeight == m_height)
+	{
+		forEachSpan(m_frameDamage, 0, m_height, [&](size_t row, size_t first, size_t last) {
+			memcpy(m_packedFrame + row * m_width + first, m_targetPixels + row * m_width + first, (last - first) * sizeof(uint32_t));
+		});
+		return;
+	}
+
+	// Bilinear, pixel centers are matched, weights are 8 bit fixed point
+	auto getTap = [](unsigned dst, unsigned dstSize, unsigned srcSize)
+	{
+		double src = (dst + 0.5) * srcSize / dstSize - 0.5;
+		src = src < 0.0 ? 0.0 : (src > srcSize - 1.0 ? srcSize - 1.0 : src);
+		unsigned first = (unsigned)src;
+		unsigned second = first + 1 < srcSize ? first + 1 : first;
+		return UpscaleTap{ first, second, (unsigned)((src - first) * 256) };
+	};
+
+	// Same for every row
+	m_upscaleColumns.resize(m_width);
+	for (unsigned x(0); x < m_width; ++x)
+		m_upscaleColumns[x] = getTap(x, m_width, m_targetWidth);
+
+	// Frame damage may overlap, pixels in both are just written twice with the same value
+	const size_t srcStride = (size_t)m_targetWidth * sizeof(uint32_t);
+	forEachBand(m_height, [&](size_t firstRow, size_t lastRow) {
+		forEachSpan(m_frameDamage, firstRow, lastRow, [&](size_t y, size_t first, size_t last) {
+			UpscaleTap rowTap = getTap(unsigned(y), m_height, m_targetHeight);
+			const PUCHAR topRow = (PUCHAR)m_targetPixels + rowTap.first * srcStride;
+			const PUCHAR bottomRow = (PUCHAR)m_targetPixels + rowTap.second * srcStride;
+			PUCHAR dst = (PUCHAR)(m_packedFrame + y * m_width + first);
+
+			for (size_t x(first); x < last; ++x)
+			{
+				const UpscaleTap& col = m_upscaleColumns[x];
+				size_t left = (size_t)col.first * sizeof(uint32_t);
+				size_t right = (size_t)col.second * sizeof(uint32_t);
+				for (unsigned c(0); c < sizeof(uint32_t); ++c)
+				{
+					unsigned top = topRow[left + c] * (256 - col.weight) + topRow[right + c] * col.weight;
+					unsigned bottom = bottomRow[left + c] * (256 - col.weight) + bottomRow[right + c] * col.weight;
+					*dst++ = UCHAR((top * (256 - rowTap.weight) + bottom * rowTap.weight + 32768) >> 16);
+				}
+			}
+		});
+	});
+}
 
-	if (!::BitBlt(m_context, m_horizAlign, m_vertAlign, m_width, m_height,
-		m_memContext, 0, 0, SRCCOPY))
-		throw("Cant stretch and draw pixels");
+void Canvas::convert()
+{
+	PROFILE_SCOPE("convert");
+	forEachBand(m_height, [&](size_t firstRow, size_t lastRow) {
+		forEachSpan(m_frameDamage, firstRow, lastRow, [&](size_t row, size_t first, size_t last) {
+			convertPixels(row * m_width + first, row * m_width + last);
+		});
+	});
+}
 
-	if (m_isShowMSPF)
+void Canvas::convertPixels(size_t firstPixel, size_t lastPixel)
+{
+	// 4 packed pixels make 3 words of B, G, R bytes (little endian), quads start at multiples of 4 pixels
+	// so the words stay aligned, pixels around them are copied one by one
+	size_t pixel(firstPixel);
+	for (; pixel < lastPixel && pixel % 4; ++pixel)
+		memcpy(m_framePixels + pixel * 3, m_packedFrame + pixel, 3);
+
+	uint32_t* present = (uint32_t*)m_framePixels;
+	for (; pixel + 4 <= lastPixel; pixel += 4)
 	{
-		std::wstringstream name;
-		name << duration_cast<milliseconds>(high_resolution_clock::now() - m_timePoint).count() << L"ms";
-		SetWindowText(m_windowHandler, name.str().c_str());
+		const uint32_t* src = m_packedFrame + pixel;
+		uint32_t* dst = present + pixel / 4 * 3;
+		dst[0] = (src[0] & 0x00ffffff) | src[1] << 24;
+		dst[1] = (src[1] & 0x00ffffff) >> 8 | src[2] << 16;
+		dst[2] = (src[2] & 0x00ffffff) >> 16 | src[3] << 8;
 	}
+
+	for (; pixel < lastPixel; ++pixel)
+		memcpy(m_framePixels + pixel * 3, m_packedFrame + pixel, 3);
+}
+
+void Canvas::forEachBand(size_t rows, const std::function<void(size_t, size_t)>& func)
+{
+	if (m_jobs)
+		m_jobs->parallelFor(rows, bandRows, func);
+	else
+		func(0, rows);
+}
+
+void Canvas::setRenderScale(double scale)
+{
+	long width = lrint(m_width * scale);
+	long height = lrint(m_height * scale);
+	const unsigned oldWidth = m_targetWidth, oldHeight = m_targetHeight;
+	m_targetWidth = width < 1 ? 1 : (width > (long)m_width ? m_width : width);
+	m_targetHeight = height < 1 ? 1 : (height > (long)m_height ? m_height : height);
+
+	// Nothing of the old resolution is valid in the new one
+	if (m_targetWidth != oldWidth || m_targetHeight != oldHeight)
+		m_isFullDamage = true;
 }
 
 
 
+#ifdef _WIN32
 void Canvas::showCursor(bool show) const
 {
 	// Hide cursor
@@ -284,11 +866,6 @@ void Canvas::showCursor(bool show) const
 	SetConsoleCursorInfo(handle, &sci);
 }
 
-void Canvas::dontCloseWindow(bool wait)
-{
-	m_isDontCloseWindow = wait;
-}
-
 double Canvas::getScreenScaleFactor() const
 {
 	// Getting false screen dimensions
@@ -308,4 +885,10 @@ double Canvas::getScreenScaleFactor() const
 	RegCloseKey(hKey);
 
 	return (double)szBuffer[0] / scaled;
-}
\ No newline at end of file
+}
+#endif
+
+void Canvas::dontCloseWindow(bool wait)
+{
+	m_isDontCloseWindow = wait;
+}
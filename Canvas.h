@@ -1,29 +1,88 @@
 #pragma once
 
-#include <Windows.h>
+#include <functional>
 #include <queue>
 #include <sstream>
 #include <memory>
 #include <chrono>
+#include <vector>
+#include <algorithm>
 
+#include "Platform.h"
 #include "Figure.h"
+#include "FrameCapture.h"
+#include "JobSystem.h"
+#include "RenderGraph.h"
+#include "ResolutionScaler.h"
+#include "Profiler.h"
 
 
 class Canvas
 {
 private:
-	const HWND m_windowHandler;
-	const HDC m_context;
+	const HWND m_windowHandler; // nullptr for headless canvas
 	const unsigned m_width;
 	const unsigned m_height;
-	const unsigned m_colorsCount;
+	const unsigned m_colorsCount; // Presented, rendering always works with packed 32 bit pixels
+	const unsigned m_samplesCount;
 	const double badW = 0.1;
 
-	HDC m_memContext;
-	HBITMAP m_frameBitmap;
+#ifdef _WIN32
+	HDC m_context{ nullptr };
+	HDC m_memContext{ nullptr };
+	HBITMAP m_frameBitmap{ nullptr };
 	BITMAPINFO m_bitmapInfo;
 	PUCHAR* m_ptrFramePixels;
+#endif
 	PUCHAR m_framePixels;
+	std::vector<UCHAR> m_headlessPixels;
+
+	// Full resolution frame, B, G, R and an unused byte per pixel. With 4 colors it is the presented frame itself,
+	// with 3 it is a buffer of its own converted once per frame (m_packedFramePixels)
+	uint32_t* m_packedFrame;
+	std::vector<uint32_t> m_packedFramePixels;
+
+	// Render target, the packed frame itself or a smaller buffer with dynamic resolution
+	uint32_t* m_targetPixels;
+	unsigned m_targetWidth;
+	unsigned m_targetHeight;
+
+	// Dynamic resolution
+	struct UpscaleTap
+	{
+		unsigned first, second;	// Source pixels
+		unsigned weight;		// Of the second one, 0..256
+	};
+
+	const bool m_isDynamicResolution;
+	ResolutionScaler m_scaler;
+	std::vector<uint32_t> m_renderPixels;
+	std::vector<UpscaleTap> m_upscaleColumns;
+	std::chrono::duration<double, std::milli> m_workTime{};
+
+	// Multisampling (depth is kept even without it, in the render graph)
+	std::vector<uint32_t> m_samples;
+
+	// Frame passes, built once by init, buffers are big enough for the full resolution
+	// Depth is transient, so is the render target when it is resolved from samples and redrawn whole (it shares memory with depth then)
+	RenderGraph m_graph;
+	RenderGraph::ResourceId m_depthBuffer{}, m_samplesBuffer{}, m_targetBuffer{}, m_frameBuffer{}, m_presentBuffer{};
+
+	// Opaque fill is only recorded, the graph clears what the frame doesnt overwrite anyway
+	bool m_isClearPending{ false };
+	COLORREF m_clearColor{};
+
+	// Partial redraw, every pass works only on the damage: target pixels the figures changed since the last frame
+	// (rows top down, rects never overlap) and the frame pixels they upscale to (may overlap)
+	// Figures are matched between frames by hash and the damage is their bounds in either frame
+	const bool m_isPartialRedraw;
+	bool m_isFullDamage{ true };
+	bool m_wasClearPending{ false };
+	COLORREF m_lastClearColor{};
+	std::vector<PixelRect> m_damage;
+	std::vector<PixelRect> m_frameDamage;
+	std::vector<std::pair<uint64_t, PixelRect>> m_figureKeys, m_lastFigureKeys; // Sorted by hash
+	static constexpr size_t maxDamageRects = 16; // More are merged into one
 
 	// Aligning
 	int m_horizAlign{ 0 };
@@ -37,14 +96,35 @@ private:
 
 	// Figures to draw on canvas
 	std::queue<std::unique_ptr<IFigure>> figures;
+	std::vector<std::unique_ptr<IFigure>> m_frameFigures; // Taken from the queue by render, survivors of setup kept for every band
+	size_t m_firstBlended{ 0 }; // Opaque figures come first, blended ones from here in the order they were added
+	CullMode m_cullMode{ CullMode::NONE };
+	size_t m_culledCount{ 0 };
+
+	// Every presented frame is handed to it
+	FrameCapture* m_capture{ nullptr };
+
+	// Rows are split into bands, one job each
+	JobSystem* m_jobs{ nullptr };
+	static constexpr unsigned bandRows = 16;
 
 public:
 	struct Params
 	{
-		unsigned colorsCount = 3;
+		unsigned colorsCount = 3; // Of the presented frame, 3 or 4 (no conversion)
+		unsigned samplesCount = 1; // MSAA, 1, 2, 4 or 8
+		CullMode cullMode = CullMode::NONE;
 		bool dontCloseWindow = false;
 		bool dontShowCursor = true;
 		bool showMSPF = false;
+
+		// Render resolution follows the frame time budget, result is upscaled into the window
+		bool dynamicResolution = false;
+		ResolutionScaler::Params resolution{};
+
+		// Clears, draws, converts and presents only where figures changed since the last frame
+		// Shaders may depend only on what the figures hold, call invalidate when they read anything else that changed
+		bool partialRedraw = false;
 	};
 
 	enum Align
@@ -55,33 +135,78 @@ public:
 	};
 
 	// Construntors / destructors
+#ifdef _WIN32
 	Canvas(HWND windowHandler, unsigned width, unsigned height, const Params& params);
+#endif
+	/// @brief Headless canvas, frames stay in memory (benchmarks, replays)
+	Canvas(unsigned width, unsigned height, const Params& params);
 	~Canvas();
 
 	// Getters
 	const size_t getPixelsSize() const;
+	unsigned getRenderWidth() const;
+	unsigned getRenderHeight() const;
+	double getNearW() const { return badW; } // Triangles are clipped where w drops below it
+	size_t getCulledCount() const { return m_culledCount; } // Figures setup dropped in the last frame
+	/// @brief Window pixels the last render wrote and presented (rows top down), the whole frame without partial redraw
+	const std::vector<PixelRect>& getDamage() const { return m_frameDamage; }
 	COLORREF getPixel(unsigned x, unsigned y) const;
 	PUCHAR getArray() const;
 	PUCHAR getArrayCopy() const;
 
-	// Setters
+	// Setters (setPixel, getPixel and fill work in the render resolution)
+#ifdef _WIN32
 	void setAlignment(int horizAlign, int vertAlign);
 	void setAlignment(Align align, int horizAlign, int vertAlign);
+#endif
 	void setPixel(unsigned x, unsigned y, COLORREF rgb);
 	void setArray(PUCHAR arr);
 	void setArrayCopy(PUCHAR arr);
+	/// @brief Fill, rasterization, shading, resolve and upscale run in bands of rows on it, nullptr - on the calling thread
+	/// Every pixel is written by the same figures in the same order, so frames are the same with any number of threads
+	void setJobSystem(JobSystem* jobs) { m_jobs = jobs; }
+	void setCullMode(CullMode mode) { m_cullMode = mode; }
+	/// @brief Frames are submitted after they are rendered (window size, after upscale), nullptr - no capture
+	void setCapture(FrameCapture* capture);
 
 	// Renderers
+	/// @brief With a = 1.0 the canvas is cleared by the next render, as late as possible and only where needed
+	/// Otherwise the color is blended over every pixel (and sample) right away
 	void fill(COLORREF rgb, float a = 1.0f);
 
 	/// @brief Adds a new figure with relative coords (top left corner is [-1, -1])
+	/// Blended figures are drawn after the opaque ones in the order they were added, so add them back to front
 	/// @param newFig Any figure with bounding box
 	void addFigure(IFigure* newFig);
 	void render();
+	/// @brief The next frame is drawn whole (partial redraw only)
+	void invalidate() { m_isFullDamage = true; }
+	const RenderGraph& getRenderGraph() const { return m_graph; }
 
 	// Utils
+#ifdef _WIN32
 	void showCursor(bool show) const;
-	void dontCloseWindow(bool wait);
 	double getScreenScaleFactor() const;
+#endif
+	void dontCloseWindow(bool wait);
+
+private:
+	void init(const Params& params);
+	void forEachBand(size_t rows, const std::function<void(size_t, size_t)>& func);
+	void buildRenderGraph();
+	void setupFigures();
+	void updateDamage();
+	void flushClear();
+	void clearTarget();
+	void clearSamples();
+	void rasterize();
+	void rasterizeBlended();
+	void rasterizeBands(const CanvasData& cd, size_t firstFigure, size_t lastFigure, bool isDepthCleared);
+	CanvasData getCanvasData();
+	void resolve();
+	void upscale();
+	void convert();
+	void convertPixels(size_t firstPixel, size_t lastPixel);
+	void setRenderScale(double scale);
 };
 
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ContactSolver.h"
+#include "Physics.h"
+
+
+ContactSolver::ContactSolver(BodyVelocity& body, const Coefficients& coefs) :
+	body(body), coefs(coefs)
+{}
+
+
+void ContactSolver::tangentBasis(const Vecd<3>& normal, Vecd<3>& tangent1, Vecd<3>& tangent2)
+{
+	// Any axis not too close to the normal
+	Vecd<3> axis = std::fabs(normal.x()) < 0.57 ? Vecd<3>{ 1.0, 0.0, 0.0 } : Vecd<3>{ 0.0, 1.0, 0.0 };
+	tangent1 = normalize(cross(normal, axis));
+	tangent2 = cross(normal, tangent1);
+}
+
+
+int ContactSolver::addContact(const Vecd<3>& arm, const Vecd<3>& normal, const ContactImpulse& warmStart)
+{
+	if (contactsCount >= maxContacts)
+		return -1;
+
+	Contact& contact = contacts[contactsCount];
+	contact.dir[0] = normal;
+	tangentBasis(normal, contact.dir[1], contact.dir[2]);
+
+	for (int dirId(0); dirId < 3; ++dirId)
+	{
+		contact.armCross[dirId] = cross(arm, contact.dir[dirId]);
+		contact.angularResponse[dirId] = body.Iinv * contact.armCross[dirId];
+		contact.mass[dirId] = 1.0 / (body.invMass + dot(contact.angularResponse[dirId], contact.armCross[dirId]));
+	}
+
+	// Bounce only when hitting hard enough, resting contacts would jitter otherwise
+	double approachVel = velocityAlong(contact, 0);
+	contact.bias = approachVel < -coefs.restingVel ? -coefs.restitutionCoef * approachVel : 0.0;
+
+	// Warm starting, last step result is most likely close to this one
+	contact.impulse.normal = warmStart.normal * coefs.warmStarting;
+	contact.impulse.tangent[0] = warmStart.tangent[0] * coefs.warmStarting;
+	contact.impulse.tangent[1] = warmStart.tangent[1] * coefs.warmStarting;
+	applyImpulse(contact, 0, contact.impulse.normal);
+	applyImpulse(contact, 1, contact.impulse.tangent[0]);
+	applyImpulse(contact, 2, contact.impulse.tangent[1]);
+
+	return contactsCount++;
+}
+
+
+int ContactSolver::solve()
+{
+	int iteration(0);
+	while (iteration < coefs.solverIterations)
+	{
+		iteration++;
+		double maxChange(0.0);
+
+		for (int cId(0); cId < contactsCount; ++cId)
+		{
+			Contact& contact = contacts[cId];
+			ContactImpulse& acc = contact.impulse;
+
+			// Friction, limited by the normal impulse (static cone, dynamic one once it slides)
+			double staticLimit = coefs.sFric * acc.normal;
+			double dynamicLimit = coefs.dFric * acc.normal;
+			for (int tId(0); tId < 2; ++tId)
+			{
+				double delta = -velocityAlong(contact, tId + 1) * contact.mass[tId + 1];
+				double newImpulse = acc.tangent[tId] + delta;
+				if (std::fabs(newImpulse) > staticLimit)
+					newImpulse = std::clamp(newImpulse, -dynamicLimit, dynamicLimit);
+
+				delta = newImpulse - acc.tangent[tId];
+				acc.tangent[tId] = newImpulse;
+				applyImpulse(contact, tId + 1, delta);
+				maxChange = std::max(maxChange, std::fabs(delta));
+			}
+
+			// Normal, can only push
+			double delta = (contact.bias - velocityAlong(contact, 0)) * contact.mass[0];
+			double newImpulse = std::max(acc.normal + delta, 0.0);
+			delta = newImpulse - acc.normal;
+			acc.normal = newImpulse;
+			applyImpulse(contact, 0, delta);
+			maxChange = std::max(maxChange, std::fabs(delta));
+		}
+
+		if (maxChange < coefs.solverTolerance)
+			break;
+	}
+
+	return iteration;
+}
+
+
+double ContactSolver::velocityAlong(const Contact& contact, int dirId) const
+{
+	return dot(body.linearVel, contact.dir[dirId]) + dot(body.angularVel, contact.armCross[dirId]);
+}
+
+void ContactSolver::applyImpulse(const Contact& contact, int dirId, double impulse)
+{
+	body.linearVel = body.linearVel + (body.invMass * impulse) * contact.dir[dirId];
+	body.angularMomentum = body.angularMomentum + impulse * contact.armCross[dirId];
+	body.angularVel = body.angularVel + impulse * contact.angularResponse[dirId];
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Vecd.h"
+#include "Matd.h"
+
+
+struct Coefficients;
+
+// Velocity state of one body, the solver changes it in place
+struct BodyVelocity
+{
+	double invMass;
+	Matd<3, 3> Iinv;			// World space
+	Vecd<3> linearVel;
+	Vecd<3> angularMomentum;
+	Vecd<3> angularVel;
+};
+
+// Accumulated impulse of one contact
+struct ContactImpulse
+{
+	double normal = 0.0;
+	double tangent[2]{};	// Along the basis from ContactSolver::tangentBasis(normal), so it is stable between frames
+};
+
+// Projected Gauss-Seidel over all contacts of one body against static geometry
+// Every contact gets a normal and two friction impulses, accumulated over iterations and clamped
+class ContactSolver
+{
+public:
+	static constexpr int maxContacts = 8;
+
+	ContactSolver(BodyVelocity& body, const Coefficients& coefs);
+
+	/// @brief Adds a touching point
+	/// @param arm From the center of mass to the contact point
+	/// @param normal Unit, pointing away from the static geometry
+	/// @param warmStart Impulse this contact got last step, applied right away
+	/// @return Contact index for getImpulse, -1 if the manifold is full
+	int addContact(const Vecd<3>& arm, const Vecd<3>& normal, const ContactImpulse& warmStart = {});
+
+	/// @brief Iterates until impulses settle or solverIterations is reached
+	/// @return Iterations done, the result is usable either way
+	int solve();
+
+	const ContactImpulse& getImpulse(int contactId) const { return contacts[contactId].impulse; }
+	int getContactsCount() const { return contactsCount; }
+
+	static void tangentBasis(const Vecd<3>& normal, Vecd<3>& tangent1, Vecd<3>& tangent2);
+
+private:
+	struct Contact
+	{
+		Vecd<3> dir[3];				// Normal, tangent, tangent
+		Vecd<3> armCross[3];		// arm x dir, point velocity along dir is v.dir + w.armCross
+		Vecd<3> angularResponse[3];	// Iinv * armCross, angular velocity change per unit impulse
+		double mass[3];				// Effective mass along every direction
+		double bias;				// Restitution target speed
+		ContactImpulse impulse;
+	};
+
+	BodyVelocity& body;
+	const Coefficients& coefs;
+	Contact contacts[maxContacts];
+	int contactsCount = 0;
+
+	double velocityAlong(const Contact& contact, int dirId) const;
+	void applyImpulse(const Contact& contact, int dirId, double impulse);
+};
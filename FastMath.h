@@ -0,0 +1,204 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FASTMATH_SSE2
+#endif
+
+
+// Accuracy tiers
+// Fast  - polynomial approximation, only where it beats libm (sincos, see its bound)
+// Exact - libm quality, used by physics and shaders
+enum class Precision
+{
+	Fast,
+	Exact
+};
+
+
+// Named fmath, so nothing here is mixed up with libm overloads of the same names
+namespace fmath
+{
+
+
+//// HELPERS ////
+
+
+namespace detail
+{
+	constexpr double twoOverPi = 0.6366197723675814;
+	// pi/2 split in two parts (Cody-Waite), so r = x - k * pi/2 stays exact for moderate k
+	constexpr double halfPiHi = 1.5707963267341256;
+	constexpr double halfPiLo = 6.0771005065061922e-11;
+	// Above that k * pi/2 isnt exact anymore, Fast sincos hands these to libm
+	constexpr double fastSincosLimit = 1e5;
+	// Adding and subtracting it rounds to the nearest integer (for |x| < 2^51)
+	constexpr double roundMagic = 6755399441055744.0;
+
+	/// @brief Fast sincos for |val| < fastSincosLimit, branchless, so batched loops vectorize
+	inline void fastSincos(double val, double& sinVal, double& cosVal)
+	{
+		// Range reduction to r in [-pi/4, pi/4]
+		double k = (val * twoOverPi + roundMagic) - roundMagic;
+		double r = (val - k * halfPiHi) - k * halfPiLo;
+		double r2 = r * r;
+
+		// Taylor polynomials (remainders 2.5e-9 and 2.5e-8 at |r| = pi/4)
+		double s = r * (1.0 - r2 * (1.0 / 6 - r2 * (1.0 / 120 - r2 * (1.0 / 5040 - r2 * (1.0 / 362880)))));
+		double c = 1.0 - r2 * (1.0 / 2 - r2 * (1.0 / 24 - r2 * (1.0 / 720 - r2 * (1.0 / 40320))));
+
+		// Quadrant swaps the two and flips their signs
+		int32_t quadrant = int32_t(k) & 3;
+		double sinSign = (quadrant & 2) ? -1.0 : 1.0;
+		double cosSign = ((quadrant + 1) & 2) ? -1.0 : 1.0;
+		sinVal = sinSign * ((quadrant & 1) ? c : s);
+		cosVal = cosSign * ((quadrant & 1) ? s : c);
+	}
+}
+
+
+//// INVERSE SQUARE ROOT ////
+
+
+// Squared lengths outside of that range lose precision (denormal) or all of it (0, infinity)
+constexpr double minNormal = 2.2250738585072014e-308;
+constexpr double maxFinite = 1.7976931348623157e308;
+
+inline double rsqrt(double val)
+{
+	return 1.0 / std::sqrt(val);
+}
+
+namespace detail
+{
+	/// @brief Normalizes a vector whose squared length is outside of [minNormal, maxFinite] (same as Vecd normalize)
+	/// It is divided by its largest component first, infinite components give NaN, zero stays zero
+	inline void normalizeScaled(double& x, double& y, double& z, double squaredLen)
+	{
+		double largest = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+		if (largest == 0.0)
+			return;
+
+		if (largest <= maxFinite)
+		{
+			x /= largest; y /= largest; z /= largest;
+			squaredLen = x * x + y * y + z * z;
+		}
+
+		double invRoot = rsqrt(squaredLen);
+		x *= invRoot; y *= invRoot; z *= invRoot;
+	}
+}
+
+
+//// POWER ////
+
+
+/// @brief base^exponent by squaring, exact up to rounding (specular highlights like pow(x, 64))
+inline double powi(double base, unsigned exponent)
+{
+	double toRet(1.0);
+	while (exponent)
+	{
+		if (exponent & 1)
+			toRet *= base;
+		base *= base;
+		exponent >>= 1;
+	}
+	return toRet;
+}
+
+
+//// TRIGONOMETRY ////
+
+
+/// @brief Sine and cosine at once
+/// Fast is accurate to ~3e-8 absolute for |x| < 1e5, larger, infinite and NaN inputs go to Exact
+template <Precision P = Precision::Exact>
+inline void sincos(double val, double& sinVal, double& cosVal)
+{
+	if (P == Precision::Exact || !(std::abs(val) < detail::fastSincosLimit))
+	{
+		sinVal = std::sin(val);
+		cosVal = std::cos(val);
+		return;
+	}
+
+	detail::fastSincos(val, sinVal, cosVal);
+}
+
+
+//// BATCHED VERSIONS ////
+
+
+/// @brief Same bits as the scalar rsqrt, two at a time with SSE2
+inline void rsqrt(const double* in, double* out, size_t count)
+{
+	size_t i(0);
+#ifdef FASTMATH_SSE2
+	const __m128d one = _mm_set1_pd(1.0);
+	for (; i + 2 <= count; i += 2)
+		_mm_storeu_pd(out + i, _mm_div_pd(one, _mm_sqrt_pd(_mm_loadu_pd(in + i))));
+#endif
+	for (; i < count; ++i)
+		out[i] = rsqrt(in[i]);
+}
+
+/// @brief Normalizes count 3D vectors stored as separate x, y, z arrays, same bits as Vecd normalize (zero vectors stay zero)
+inline void normalize3(double* x, double* y, double* z, size_t count)
+{
+	constexpr size_t chunk = 64;
+	double sqLen[chunk], invLen[chunk];
+
+	for (size_t begin(0); begin < count; begin += chunk)
+	{
+		size_t len = count - begin < chunk ? count - begin : chunk;
+		for (size_t i(0); i < len; ++i)
+			sqLen[i] = x[begin + i] * x[begin + i] + y[begin + i] * y[begin + i] + z[begin + i] * z[begin + i];
+
+		rsqrt(sqLen, invLen, len);
+
+		// Done here, so the loop below leaves them as they are
+		for (size_t i(0); i < len; ++i)
+			if (sqLen[i] < minNormal || sqLen[i] > maxFinite)
+			{
+				detail::normalizeScaled(x[begin + i], y[begin + i], z[begin + i], sqLen[i]);
+				invLen[i] = 1.0;
+			}
+
+		for (size_t i(0); i < len; ++i)
+		{
+			x[begin + i] *= invLen[i];
+			y[begin + i] *= invLen[i];
+			z[begin + i] *= invLen[i];
+		}
+	}
+}
+
+/// @brief Same results as the scalar sincos, Fast runs one branchless loop and hands out of range inputs to libm after it
+template <Precision P = Precision::Exact>
+inline void sincos(const double* in, double* sinOut, double* cosOut, size_t count)
+{
+	if (P == Precision::Exact)
+	{
+		for (size_t i(0); i < count; ++i)
+			sincos<P>(in[i], sinOut[i], cosOut[i]);
+		return;
+	}
+
+	// Out of range inputs are replaced by 0 here, so the integer conversion stays defined
+	for (size_t i(0); i < count; ++i)
+	{
+		double val = std::abs(in[i]) < detail::fastSincosLimit ? in[i] : 0.0;
+		detail::fastSincos(val, sinOut[i], cosOut[i]);
+	}
+
+	for (size_t i(0); i < count; ++i)
+		if (!(std::abs(in[i]) < detail::fastSincosLimit))
+			sincos<Precision::Exact>(in[i], sinOut[i], cosOut[i]);
+}
+
+}
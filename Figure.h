@@ -1,29 +1,149 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
 
+#include "Platform.h"
 #include "Vecd.h"
 
 
+// Which side of triangles is dropped by setup, front is counter clockwise in window space
+enum class CullMode
+{
+	NONE,
+	BACK,
+	FRONT
+};
+
+// How a fragment is combined with the color under it
+enum class BlendMode
+{
+	NONE,	// Overwrites, the only mode writing depth
+	OVER,	// Premultiplied alpha, color + under * (1 - alpha) (glass)
+	ADD		// color + under (particles, glow)
+};
+
+// Packed pixels are blended two channels per 32 bits with 16 bits each, like resolve in Canvas,
+// so every channel takes one multiply for two and plain loops over pixels vectorize
+
+/// @brief Every channel times weight / 256 (rounded), weight is 0..256
+inline uint32_t scaleChannels(uint32_t pixel, uint32_t weight)
+{
+	return ((((pixel & 0x00ff00ff) * weight + 0x00800080) >> 8) & 0x00ff00ff) |
+		((((pixel >> 8) & 0x00ff00ff) * weight + 0x00800080) & 0xff00ff00);
+}
+
+/// @brief Per channel sum, saturated at 255
+inline uint32_t addChannels(uint32_t first, uint32_t second)
+{
+	uint32_t even = (first & 0x00ff00ff) + (second & 0x00ff00ff);
+	uint32_t odd = ((first >> 8) & 0x00ff00ff) + ((second >> 8) & 0x00ff00ff);
+	even |= ((even >> 8) & 0x00010001) * 0xff;
+	odd |= ((odd >> 8) & 0x00010001) * 0xff;
+	return (even & 0x00ff00ff) | (odd & 0x00ff00ff) << 8;
+}
+
+/// @param alpha Of the (premultiplied) color, 0..255
+inline uint32_t blendPixel(BlendMode mode, uint32_t under, uint32_t color, uint32_t alpha)
+{
+	switch (mode)
+	{
+	case BlendMode::OVER: return addChannels(color, scaleChannels(under, 256 - (alpha + (alpha >> 7))));
+	case BlendMode::ADD: return addChannels(under, color);
+	default: return color;
+	}
+}
+
+/// @brief Same color blended over count packed values, 4 at once with SSE2 (same results as blendPixel)
+inline void blendPixels(BlendMode mode, uint32_t* values, size_t count, uint32_t color, uint32_t alpha)
+{
+	size_t i(0);
+#ifdef FASTMATH_SSE2
+	// Channels widened to 16 bits, weight * 255 + 128 still fits
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i weight = _mm_set1_epi16(short(256 - (alpha + (alpha >> 7))));
+	const __m128i colors = _mm_set1_epi32(int(color));
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i under = _mm_loadu_si128((const __m128i*)(values + i));
+		if (mode == BlendMode::OVER)
+		{
+			__m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(under, zero), weight), round), 8);
+			__m128i high = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(under, zero), weight), round), 8);
+			under = _mm_packus_epi16(low, high);
+		}
+		_mm_storeu_si128((__m128i*)(values + i), mode == BlendMode::NONE ? colors : _mm_adds_epu8(under, colors));
+	}
+#endif
+	for (; i < count; ++i)
+		values[i] = blendPixel(mode, values[i], color, alpha);
+}
+
+// Inclusive pixel bounds
+struct PixelRect
+{
+	int minX, minY, maxX, maxY;
+};
+
 struct CanvasData
 {
-	PUCHAR pixels;
+	uint32_t* pixels;				// Packed B, G, R and an unused byte, top row first
 	const unsigned width;
 	const unsigned height;
-	const unsigned colorsCount;
+
+	// Multisampling, every buffer below holds samplesCount values per pixel (rows as in pixels)
+	const unsigned samplesCount;
+	const Vecd<2>* sampleOffsets;	// Sample positions inside a pixel, [0, 1)
+	float* depth;					// Interpolated 1/w, bigger is closer, 0 is cleared
+	uint32_t* samples;				// Packed sample colors, nullptr when samplesCount is 1
+	CullMode cullMode = CullMode::NONE;
 };
 
-struct BoundingBox
+// Everything the raster stage reads of a triangle that survived setup
+struct TriangleSetup
 {
-	Vecd<2> upperLeft{};
-	Vecd<2> lowerRight{};
+	PixelRect bounds;			// Pixels with a sample inside the vertex bounds, inside the target
+	Vecd<3> barycentricPx;		// Barycentric coords at (x, y) are x * Px + y * Py + Free
+	Vecd<3> barycentricPy;
+	Vecd<3> barycentricFree;
+	Vecd<3> inverseW;			// 1/w of the vertices, linear in window space
+	Vecd<3> depth;				// z/w of the vertices
 };
 
 
-__interface IFigure
+// Plain abstract class instead of __interface, so figures build outside MSVC
+// and are destroyed properly through std::unique_ptr<IFigure>
+class IFigure
 {
-	void draw(CanvasData& cd);
-	void adaptBounds(BoundingBox& bbox, unsigned maxWidth, unsigned maxHeight, Vecd<2> newPoint);
-	void storePixel(CanvasData& cd, size_t x, size_t y, Vecd<4>& color);
-	Vecd<4>* getVertexArray();
+public:
+	virtual ~IFigure() = default;
+
+	/// @brief Projects the figure to window space, once per frame before any rasterize call
+	/// @return false if it cant produce a single fragment (culled), rasterize must not be called then
+	virtual bool setup(CanvasData& cd) = 0;
+	/// @brief Draws the window pixels inside area only (0 is the bottom row), so disjoint areas can be drawn in parallel
+	virtual void rasterize(CanvasData& cd, const PixelRect& area) = 0;
+
+	void draw(CanvasData& cd)
+	{
+		if (setup(cd))
+			rasterize(cd, PixelRect{ 0, 0, (int)cd.width - 1, (int)cd.height - 1 });
+	}
+
+	/// @brief Window pixels rasterize may write, valid after setup
+	virtual PixelRect getBounds() const = 0;
+	/// @brief Of everything the pixels depend on (window space vertices, per vertex info, shader, blend mode), valid after setup
+	/// Canvas compares it between frames to find the figures that changed
+	virtual uint64_t getHash() const = 0;
+
+	/// @param pixel Index in cd.pixels (rows top down, so window rows are already flipped)
+	virtual void storePixel(CanvasData& cd, size_t pixel, unsigned coverage, const Vecd<4>& color) = 0;
+	virtual Vecd<4>* getVertexArray() = 0;
+	/// @brief Canvas draws blended figures after the opaque ones, testing depth without writing it
+	virtual BlendMode getBlendMode() const = 0;
 };
 
 
@@ -41,12 +161,13 @@ public:
 		memcpy(m_vertices, triag.m_vertices, std::size(m_vertices) * sizeof(Vecd<N>));
 		memcpy(m_perVertex, triag.m_perVertex, std::size(m_perVertex) * std::size(m_perVertex[0]) * sizeof(Vecd<N>));
 		fragmentShader = triag.fragmentShader;
+		m_blendMode = triag.m_blendMode;
 	}
 
 
-	void draw(CanvasData& cd) override
+	bool setup(CanvasData& cd) override
 	{
-		BoundingBox bbox{ Vecd<2>{0.0, 0.0}, Vecd<2>{(double)cd.width, (double)cd.height} };
+		TriangleSetup& setup = m_setup;
 
 		// Iterate through every vertex
 		for (int i(0); i < 3; ++i)
@@ -62,62 +183,138 @@ public:
 			// Convert to window space coords
 			auto& pos2 = (Vecd<2>&)m_vertices[i];
 			auto factor = 0.5f * (pos2 + Vecd<2>{1, 1});
-			pos2.x() = mix(bbox.upperLeft.x(), bbox.lowerRight.x(), factor.x());
-			pos2.y() = mix(bbox.upperLeft.y(), bbox.lowerRight.y(), factor.y());
-			adaptBounds(bbox, cd.width, cd.height, (const Vecd<2>&)m_vertices[i]); // reducing triangle bounding box
+			pos2.x() = mix(0.0, (double)cd.width, factor.x());
+			pos2.y() = mix(0.0, (double)cd.height, factor.y());
+		}
+
+		// Twice the signed area, positive for counter clockwise. Zero (or NaN) is a line or a point
+		const double area = (m_vertices[0][0] - m_vertices[2][0]) * (m_vertices[1][1] - m_vertices[0][1]) -
+							(m_vertices[0][0] - m_vertices[1][0]) * (m_vertices[2][1] - m_vertices[0][1]);
+		if (!(std::abs(area) > 0.0))
+			return false;
+		if ((cd.cullMode == CullMode::BACK && area < 0.0) || (cd.cullMode == CullMode::FRONT && area > 0.0))
+			return false;
+
+		// Pixels where some sample lands inside the vertex bounds, none for sub pixel triangles between samples
+		const double boundsMin[2]{
+			std::min({ m_vertices[0][0], m_vertices[1][0], m_vertices[2][0] }),
+			std::min({ m_vertices[0][1], m_vertices[1][1], m_vertices[2][1] }) };
+		const double boundsMax[2]{
+			std::max({ m_vertices[0][0], m_vertices[1][0], m_vertices[2][0] }),
+			std::max({ m_vertices[0][1], m_vertices[1][1], m_vertices[2][1] }) };
+		const double limits[2]{ (double)cd.width - 1, (double)cd.height - 1 };
+
+		double first[2]{ limits[0] + 1, limits[1] + 1 }, last[2]{ -1.0, -1.0 };
+		for (unsigned s(0); s < cd.samplesCount; ++s)
+		{
+			double sampleFirst[2], sampleLast[2];
+			for (int axis(0); axis < 2; ++axis)
+			{
+				sampleFirst[axis] = std::max(std::ceil(boundsMin[axis] - cd.sampleOffsets[s][axis]), 0.0);
+				sampleLast[axis] = std::min(std::floor(boundsMax[axis] - cd.sampleOffsets[s][axis]), limits[axis]);
+			}
+			if (sampleFirst[0] > sampleLast[0] || sampleFirst[1] > sampleLast[1])
+				continue;
+
+			for (int axis(0); axis < 2; ++axis)
+			{
+				first[axis] = std::min(first[axis], sampleFirst[axis]);
+				last[axis] = std::max(last[axis], sampleLast[axis]);
+			}
 		}
+		if (first[0] > last[0])
+			return false;
+
+		setup.bounds = PixelRect{ (int)first[0], (int)first[1], (int)last[0], (int)last[1] };
 
 		// Precomps for barycentric coords
 		// (1 / (entire triangle area))
-		const double denomSquare = 1 / ((m_vertices[0][0] - m_vertices[2][0]) * (m_vertices[1][1] - m_vertices[0][1]) -
-										(m_vertices[0][0] - m_vertices[1][0]) * (m_vertices[2][1] - m_vertices[0][1]));
+		const double denomSquare = 1 / area;
 		// Optimisation for P.x coord
-		const Vecd<3> barycentric_Px = denomSquare *
+		setup.barycentricPx = denomSquare *
 			Vecd<3>{m_vertices[1][1] - m_vertices[2][1],
 					m_vertices[2][1] - m_vertices[0][1],
 					m_vertices[0][1] - m_vertices[1][1]};
 		// Optimisation for P.y coord
-		const Vecd<3> barycentric_Py = denomSquare *
+		setup.barycentricPy = denomSquare *
 			Vecd<3>{m_vertices[2][0] - m_vertices[1][0],
 					m_vertices[0][0] - m_vertices[2][0],
 					m_vertices[1][0] - m_vertices[0][0]};
 		// Optimisation for free member
-		const Vecd<3> barycentric_free = denomSquare *
+		setup.barycentricFree = denomSquare *
 			Vecd<3>{m_vertices[1][0] * m_vertices[2][1] - m_vertices[2][0] * m_vertices[1][1],
 					m_vertices[2][0] * m_vertices[0][1] - m_vertices[0][0] * m_vertices[2][1],
 					m_vertices[0][0] * m_vertices[1][1] - m_vertices[1][0] * m_vertices[0][1]};
 
-		bbox.upperLeft.x() = lrint(bbox.upperLeft.x());
-		bbox.upperLeft.y() = lrint(bbox.upperLeft.y());
-		bbox.lowerRight.x() = lrint(bbox.lowerRight.x());
-		bbox.lowerRight.y() = lrint(bbox.lowerRight.y());
+		setup.inverseW = Vecd<3>{ m_vertices[0][3], m_vertices[1][3], m_vertices[2][3] };
+		setup.depth = Vecd<3>{ m_vertices[0][2], m_vertices[1][2], m_vertices[2][2] };
+		return true;
+	}
 
-		// Looping through every pixel in bounding box
-		for (double y = (int)bbox.upperLeft.y(); y < bbox.lowerRight.y(); ++y)
+	void rasterize(CanvasData& cd, const PixelRect& area) override
+	{
+		const TriangleSetup& setup = m_setup;
+		const Vecd<3>& barycentric_Px = setup.barycentricPx;
+		const Vecd<3>& barycentric_Py = setup.barycentricPy;
+		const Vecd<3>& barycentric_free = setup.barycentricFree;
+		const Vecd<3>& inverseW = setup.inverseW;
+		const bool isDepthWritten = m_blendMode == BlendMode::NONE;
+
+		// Looping through every pixel in bounding box, within the area
+		const double firstX = std::max(setup.bounds.minX, area.minX), lastX = std::min(setup.bounds.maxX, area.maxX);
+		const double firstY = std::max(setup.bounds.minY, area.minY), lastY = std::min(setup.bounds.maxY, area.maxY);
+		for (double y = firstY; y <= lastY; ++y)
 		{
-			for (double x = (int)bbox.upperLeft.x(); x < bbox.lowerRight.x(); ++x)
+			size_t row = (cd.height - (size_t)y - 1) * cd.width;
+			for (double x = firstX; x <= lastX; ++x)
 			{
-				Vecd<4> fragCoord{ x, y };
 				// Computing sub-triangle area divided by entire triangle area (barycentric coords)
-				const Vecd<3> barycentric = fragCoord[0] * barycentric_Px +
-					fragCoord[1] * barycentric_Py +
-					barycentric_free;
-
-				// Discard fragment outside the triangle
-				if (barycentric[0] < 0 || barycentric[1] < 0 || barycentric[2] < 0)
+				const Vecd<3> barycentric = x * barycentric_Px + y * barycentric_Py + barycentric_free;
+
+				// Coverage and depth test at every sample position
+				float* depth = cd.depth + (row + (size_t)x) * cd.samplesCount;
+				unsigned coverage(0);
+				int shadingSample(-1);
+				for (unsigned s(0); s < cd.samplesCount; ++s)
+				{
+					const Vecd<3> sampleBarycentric = barycentric +
+						cd.sampleOffsets[s].x() * barycentric_Px + cd.sampleOffsets[s].y() * barycentric_Py;
+
+					// Discard samples outside the triangle
+					if (sampleBarycentric[0] < 0 || sampleBarycentric[1] < 0 || sampleBarycentric[2] < 0)
+						continue;
+
+					// 1/w is linear in window space, so it is exact at every sample
+					float sampleDepth = (float)dot(sampleBarycentric, inverseW);
+					if (sampleDepth <= depth[s])
+						continue;
+
+					if (isDepthWritten)
+						depth[s] = sampleDepth;
+					coverage |= 1u << s;
+					if (shadingSample < 0)
+						shadingSample = s;
+				}
+
+				if (!coverage)
 					continue;
 
-				// interpolate inverse depth linearly (Z=Z0+w1*Z1+w2*Z2 and with W, where w is barycentric)
-				fragCoord[2] = dot(barycentric, Vecd<3>{m_vertices[0][2], m_vertices[1][2], m_vertices[2][2]}); // Z only
-				fragCoord[3] = dot(barycentric, Vecd<3>{m_vertices[0][3], m_vertices[1][3], m_vertices[2][3]}); // W only
+				// Shading once per pixel, at the center if it is inside the triangle (else at the first covered sample)
+				Vecd<4> fragCoord{ x + 0.5, y + 0.5 };
+				Vecd<3> shadingBarycentric = barycentric + 0.5 * barycentric_Px + 0.5 * barycentric_Py;
+				if (shadingBarycentric[0] < 0 || shadingBarycentric[1] < 0 || shadingBarycentric[2] < 0)
+				{
+					const Vecd<2>& offset = cd.sampleOffsets[shadingSample];
+					fragCoord = Vecd<4>{ x + offset.x(), y + offset.y() };
+					shadingBarycentric = barycentric + offset.x() * barycentric_Px + offset.y() * barycentric_Py;
+				}
 
-				// Clip fragments to the near/far planes (as if by GL_ZERO_TO_ONE)
-				//if (fragCoord[2] < 0 || fragCoord[2] > 1)
-				//	continue;
+				// interpolate inverse depth linearly (Z=Z0+w1*Z1+w2*Z2 and with W, where w is barycentric)
+				fragCoord[2] = dot(shadingBarycentric, setup.depth); // Z only
+				fragCoord[3] = dot(shadingBarycentric, inverseW); // W only
 
 				// Perspective correct barycentric
-				const Vecd<3> perspective = 1 / fragCoord[3] * barycentric *
-					Vecd<3>{m_vertices[0][3], m_vertices[1][3], m_vertices[2][3]};
+				const Vecd<3> perspective = 1 / fragCoord[3] * shadingBarycentric * inverseW;
 
 				// interpolate the attributes using the perspective correct barycentric
 				Vecd<4> varying[3];
@@ -132,14 +329,14 @@ public:
 				// Using fragment shader to do some colors
 				Vecd<4> finalColor;
 				fragmentShader(varying[0], varying[1], finalColor);
-				storePixel(cd, (size_t)x, (size_t)y, finalColor);
+				storePixel(cd, row + (size_t)x, coverage, finalColor);
 			}
 		}
 	}
 
 	static void defaultFragmentShader(const Vecd<N>& fragPosition, const Vecd<N>& texture, Vecd<4>& color)
 	{
-		color.r() = color.g() = color.b() = 1.0;
+		color.r() = color.g() = color.b() = color.a() = 1.0;
 	}
 
 	void setFragmentShader(void (*newFragmentShader)(const Vecd<N>& fragPosition, const Vecd<N>& texture, Vecd<4>& color))
@@ -161,27 +358,61 @@ public:
 	}
 
 
-	Vecd<4>* getVertexArray()
+	/// @brief Blended triangles are depth tested but dont write depth, the shader gives premultiplied color and alpha
+	void setBlendMode(BlendMode mode)
 	{
-		return m_vertices;
+		m_blendMode = mode;
+	}
+
+	BlendMode getBlendMode() const override
+	{
+		return m_blendMode;
+	}
+
+	PixelRect getBounds() const override
+	{
+		return m_setup.bounds;
 	}
 
-	~Triangle()
+	uint64_t getHash() const override
 	{
-		delete[] m_perVertex;
+		// FNV-1a over 64 bit words, every value in both arrays is a double
+		uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash](uint64_t word) { hash = (hash ^ word) * 1099511628211ull; };
+		auto addValues = [&add](const void* values, size_t size) {
+			for (size_t offset(0); offset < size; offset += sizeof(uint64_t))
+			{
+				uint64_t word;
+				memcpy(&word, (const char*)values + offset, sizeof(word));
+				add(word);
+			}
+		};
+
+		addValues(m_vertices, sizeof(m_vertices));
+		addValues(m_perVertex, sizeof(m_perVertex));
+		add((uint64_t)(uintptr_t)fragmentShader);
+		add((uint64_t)m_blendMode);
+		return hash;
+	}
+
+	Vecd<4>* getVertexArray() override
+	{
+		return m_vertices;
 	}
 
 private:
 	Vecd<N> m_vertices[3]{};
 	Vecd<N> m_perVertex[3][3]{};
 	void (*fragmentShader)(const Vecd<N>& fragPosition, const Vecd<N>& texture, Vecd<4>& color) = nullptr;
+	BlendMode m_blendMode{ BlendMode::NONE };
 
-	void adaptBounds(BoundingBox& bbox, unsigned maxWidth, unsigned maxHeight, Vecd<2> newPoint) override
+	// Written by setup, only read while rasterizing
+	TriangleSetup m_setup{};
+
+	static uint32_t toChannel(double value)
 	{
-		bbox.upperLeft.x() = (newPoint.x() >= 0 && newPoint.x() < bbox.upperLeft.x()) ? newPoint.x() : bbox.upperLeft.x();
-		bbox.upperLeft.y() = (newPoint.y() >= 0 && newPoint.y() < bbox.upperLeft.y()) ? newPoint.y() : bbox.upperLeft.y();
-		bbox.lowerRight.x() = (newPoint.x() <= maxWidth && newPoint.x() > bbox.lowerRight.x()) ? newPoint.x() : bbox.lowerRight.x();
-		bbox.lowerRight.y() = (newPoint.y() <= maxHeight && newPoint.y() > bbox.lowerRight.y()) ? newPoint.y() : bbox.lowerRight.y();
+		value *= 255;
+		return uint32_t(value < 0 ? 0 : (value < 255 ? value : 255));
 	}
 
 	double mix(double x, double y, double prop) const
@@ -189,12 +420,37 @@ private:
 		return x * (1 - prop) + y * prop;
 	}
 
-	void storePixel(CanvasData& cd, size_t x, size_t y, Vecd<4>& color) override
+	void storePixel(CanvasData& cd, size_t pixel, unsigned coverage, const Vecd<4>& color) override
 	{
-		// Here we can rotate image ((cd.height - y - 1) * cd.width * cd.colorsCount)
-		uint8_t* pixPos = cd.pixels + ((cd.height - y - 1) * cd.width * cd.colorsCount) + x * cd.colorsCount;
-		pixPos[0] = uint8_t(min(255 * color[0], 255));
-		pixPos[1] = uint8_t(min(255 * color[1], 255));
-		pixPos[2] = uint8_t(min(255 * color[2], 255));
+		// One aligned store, conversion to the presented format is done by Canvas once per frame
+		const uint32_t packed = toChannel(color[0]) | toChannel(color[1]) << 8 | toChannel(color[2]) << 16;
+		if (m_blendMode == BlendMode::NONE)
+		{
+			if (!cd.samples)
+			{
+				cd.pixels[pixel] = packed;
+				return;
+			}
+
+			// Multisampled, only covered samples get the color, Canvas resolves them later
+			uint32_t* samples = cd.samples + pixel * cd.samplesCount;
+			for (unsigned s(0); s < cd.samplesCount; ++s)
+				if (coverage & (1u << s))
+					samples[s] = packed;
+			return;
+		}
+
+		// Blended over every covered sample, alpha is read only here (opaque shaders may leave it unset)
+		const uint32_t alpha = toChannel(color[3]);
+		if (!cd.samples)
+		{
+			cd.pixels[pixel] = blendPixel(m_blendMode, cd.pixels[pixel], packed, alpha);
+			return;
+		}
+
+		uint32_t* samples = cd.samples + pixel * cd.samplesCount;
+		for (unsigned s(0); s < cd.samplesCount; ++s)
+			if (coverage & (1u << s))
+				samples[s] = blendPixel(m_blendMode, samples[s], packed, alpha);
 	}
 };
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ForceGenerators.h"
+
+
+template <class T>
+void ForceGenerators::insertByBody(std::vector<Id>& order, const std::vector<T>& generators, Id id)
+{
+	// After every generator of the same body, so each body sums its generators in the order they were added
+	auto pos = std::upper_bound(order.begin(), order.end(), generators[id].body, [&](uint32_t body, Id other) {
+		return body < generators[other].body;
+	});
+	order.insert(pos, id);
+}
+
+template <class T>
+size_t ForceGenerators::firstInRange(const std::vector<Id>& order, const std::vector<T>& generators, size_t body)
+{
+	return std::lower_bound(order.begin(), order.end(), body, [&](Id other, size_t value) {
+		return generators[other].body < value;
+	}) - order.begin();
+}
+
+
+ForceGenerators::Id ForceGenerators::addSpring(const Spring& spring)
+{
+	if (spring.stiffness < 0.0 || spring.damping < 0.0)
+		throw "Spring stiffness and damping can be only >= 0.0";
+
+	springs.push_back(spring);
+	insertByBody(springsByBody, springs, Id(springs.size() - 1));
+	touched.push_back(spring.body);
+	return Id(springs.size() - 1);
+}
+
+ForceGenerators::Id ForceGenerators::addDamper(const Damper& damper)
+{
+	dampers.push_back(damper);
+	insertByBody(dampersByBody, dampers, Id(dampers.size() - 1));
+	touched.push_back(damper.body);
+	return Id(dampers.size() - 1);
+}
+
+ForceGenerators::Id ForceGenerators::addGravityWell(const GravityWell& well)
+{
+	if (well.minDistance <= 0.0)
+		throw "Gravity well min distance can be only > 0.0";
+
+	wells.push_back(well);
+	allTouched = true;
+	return Id(wells.size() - 1);
+}
+
+ForceGenerators::Id ForceGenerators::addDrag(const Drag& drag)
+{
+	drags.push_back(drag);
+	allTouched = true;
+	return Id(drags.size() - 1);
+}
+
+
+void ForceGenerators::setSpringAnchor(Id id, const Vecd<3>& anchor)
+{
+	springs[id].anchor = anchor;
+	if (springs[id].active)
+		touched.push_back(springs[id].body);
+}
+
+void ForceGenerators::setSpringActive(Id id, bool active)
+{
+	if (springs[id].active != active)
+		touched.push_back(springs[id].body);
+	springs[id].active = active;
+}
+
+
+void ForceGenerators::evaluate(const BodyStateView& bodies, size_t first, size_t last, const BodyForceView& out) const
+{
+	const double* px = bodies.pos[0]; const double* py = bodies.pos[1]; const double* pz = bodies.pos[2];
+	const double* vx = bodies.linearVel[0]; const double* vy = bodies.linearVel[1]; const double* vz = bodies.linearVel[2];
+	const double* wx = bodies.angularVel[0]; const double* wy = bodies.angularVel[1]; const double* wz = bodies.angularVel[2];
+	double* fx = out.force[0]; double* fy = out.force[1]; double* fz = out.force[2];
+	double* tx = out.torque[0]; double* ty = out.torque[1]; double* tz = out.torque[2];
+
+	// Only the generators of bodies in the range, so splitting bodies into many ranges costs nothing extra
+	for (size_t order = firstInRange(springsByBody, springs, first); order < springsByBody.size(); ++order)
+	{
+		const Spring& spring = springs[springsByBody[order]];
+		const size_t i = spring.body;
+		if (i >= last)
+			break;
+		if (!spring.active)
+			continue;
+
+		// Attachment point and its velocity
+		Vecd<3> arm;
+		for (int row(0); row < 3; ++row)
+			arm[row] = bodies.orient[row][0][i] * spring.localPoint[0] +
+				bodies.orient[row][1][i] * spring.localPoint[1] +
+				bodies.orient[row][2][i] * spring.localPoint[2];
+		Vecd<3> pointVel = Vecd<3>{ vx[i], vy[i], vz[i] } + cross(Vecd<3>{ wx[i], wy[i], wz[i] }, arm);
+		Vecd<3> stretch = Vecd<3>{ px[i], py[i], pz[i] } + arm - spring.anchor;
+
+		double length = std::sqrt(stretch.sqLength());
+		if (length <= 0.0)
+			continue;
+
+		Vecd<3> dir = stretch / length;
+		Vecd<3> force = -(spring.stiffness * (length - spring.restLength) + spring.damping * dot(pointVel, dir)) * dir;
+		Vecd<3> torque = cross(arm, force);
+
+		fx[i] += force.x(); fy[i] += force.y(); fz[i] += force.z();
+		tx[i] += torque.x(); ty[i] += torque.y(); tz[i] += torque.z();
+	}
+
+	for (size_t order = firstInRange(dampersByBody, dampers, first); order < dampersByBody.size(); ++order)
+	{
+		const Damper& damper = dampers[dampersByBody[order]];
+		const size_t i = damper.body;
+		if (i >= last)
+			break;
+
+		fx[i] -= damper.linear * vx[i]; fy[i] -= damper.linear * vy[i]; fz[i] -= damper.linear * vz[i];
+		tx[i] -= damper.angular * wx[i]; ty[i] -= damper.angular * wy[i]; tz[i] -= damper.angular * wz[i];
+	}
+
+	// Global ones, plain loops over the range
+	for (const auto& well : wells)
+	{
+		const double minSqDist = well.minDistance * well.minDistance;
+		for (size_t i(first); i < last; ++i)
+		{
+			double dx = well.center.x() - px[i];
+			double dy = well.center.y() - py[i];
+			double dz = well.center.z() - pz[i];
+			double sqDist = dx * dx + dy * dy + dz * dz;
+
+			// strength * mass / max(dist, minDistance)^2 along the unit direction (none right at the center)
+			double invDist = sqDist > 0.0 ? 1.0 / std::sqrt(sqDist) : 0.0;
+			double scale = well.strength * invDist / (bodies.invMass[i] * std::max(sqDist, minSqDist));
+			fx[i] += dx * scale;
+			fy[i] += dy * scale;
+			fz[i] += dz * scale;
+		}
+	}
+
+	for (const auto& drag : drags)
+	{
+		for (size_t i(first); i < last; ++i)
+		{
+			double speed = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+			double scale = drag.linear + drag.quadratic * speed;
+			fx[i] -= vx[i] * scale;
+			fy[i] -= vy[i] * scale;
+			fz[i] -= vz[i] * scale;
+		}
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Vecd.h"
+
+
+// Body state the generators read, structure of arrays indexed by body
+// Simulator points these at its single state (body 0), World at its arrays
+struct BodyStateView
+{
+	const double* pos[3];
+	const double* orient[3][3];	// Row, column
+	const double* linearVel[3];
+	const double* angularVel[3];
+	const double* invMass;
+};
+
+// Where the generators add their forces and torques
+struct BodyForceView
+{
+	double* force[3];
+	double* torque[3];
+};
+
+
+// Forces computed from the current state on every step, so springs and dampers stay stable however long the frame is
+// (applied forces are computed once per frame and last for all of its steps)
+// Every kind is kept in its own flat array and evaluated in one loop, nothing is allocated while evaluating
+class ForceGenerators
+{
+public:
+	using Id = uint32_t; // Index within its kind, stays valid
+
+	// Between a point on a body and a point in the world
+	struct Spring
+	{
+		uint32_t body = 0;
+		Vecd<3> localPoint{};	// Body space
+		Vecd<3> anchor{};
+		double stiffness = 10.0;
+		double damping = 10.0;	// Along the spring only
+		double restLength = 0.0;
+		bool active = true;
+	};
+
+	// Slows one body down
+	struct Damper
+	{
+		uint32_t body = 0;
+		double linear = 1.0;
+		double angular = 1.0;
+	};
+
+	// Pulls every body to a point, strength / distance^2 acceleration
+	struct GravityWell
+	{
+		Vecd<3> center{};
+		double strength = 10.0;
+		double minDistance = 1.0;	// Closer bodies are pulled as if they were that far, has to be > 0.0
+	};
+
+	// Air resistance for every body, (linear + quadratic * speed) * velocity
+	struct Drag
+	{
+		double linear = 0.0;
+		double quadratic = 0.1;
+	};
+
+	Id addSpring(const Spring& spring);
+	Id addDamper(const Damper& damper);
+	Id addGravityWell(const GravityWell& well);
+	Id addDrag(const Drag& drag);
+
+	void setSpringAnchor(Id id, const Vecd<3>& anchor);
+	void setSpringActive(Id id, bool active);
+
+	const Spring& getSpring(Id id) const { return springs[id]; }
+	size_t getGeneratorsCount() const { return springs.size() + dampers.size() + wells.size() + drags.size(); }
+
+	/// @brief Adds forces and torques of every generator acting on bodies first..last-1
+	void evaluate(const BodyStateView& bodies, size_t first, size_t last, const BodyForceView& out) const;
+
+	/// @brief Bodies whose generators changed since clearTouched, the owner wakes them up
+	const std::vector<uint32_t>& getTouched() const { return touched; }
+	bool isAllTouched() const { return allTouched; } // Global one was added
+	void clearTouched()
+	{
+		touched.clear();
+		allTouched = false;
+	}
+
+private:
+	std::vector<Spring> springs;
+	std::vector<Damper> dampers;
+	std::vector<Id> springsByBody;	// Sorted by body then id, a body range is one run of it
+	std::vector<Id> dampersByBody;
+	std::vector<GravityWell> wells;
+	std::vector<Drag> drags;
+
+	std::vector<uint32_t> touched;
+	bool allTouched = false;
+
+	template <class T>
+	static void insertByBody(std::vector<Id>& order, const std::vector<T>& generators, Id id);
+	template <class T>
+	static size_t firstInRange(const std::vector<Id>& order, const std::vector<T>& generators, size_t body);
+};
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "FrameCapture.h"
+
+// Pipes are text mode on Windows unless asked otherwise, POSIX popen accepts only "r" or "w"
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+static const char* pipeMode = "wb";
+#else
+static const char* pipeMode = "w";
+#endif
+
+
+FrameCapture::FrameCapture(const char* path, unsigned width, unsigned height, const Params& params) :
+	width(width), height(height), params(params)
+{
+	if (!width || !height)
+		throw "Capture size can be only > 0";
+	if (params.buffers < 1)
+		throw "Capture needs at least one buffer";
+	if (!params.fpsNumerator || !params.fpsDenominator)
+		throw "Capture frame rate can be only > 0";
+
+	// Every buffer fits a 4 channel frame, conversion output is sized for the bigger format
+	const size_t pixelsCount = (size_t)width * height;
+	frames.resize(params.buffers);
+	for (Frame& frame : frames)
+	{
+		frame.pixels.resize(pixelsCount * 4);
+		freeFrames.push_back(&frame);
+	}
+	converted.resize(params.format == Format::Y4M ?
+		pixelsCount + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2) : pixelsCount * 3);
+
+	isPipe = path[0] == '|';
+	file = isPipe ? popen(path + 1, pipeMode) : fopen(path, "wb");
+	if (!file)
+		throw "Cant open capture output";
+
+	if (params.format == Format::Y4M)
+	{
+		std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) +
+			" F" + std::to_string(params.fpsNumerator) + ":" + std::to_string(params.fpsDenominator) + " Ip A1:1 C420jpeg\n";
+		if (fwrite(header.data(), 1, header.size(), file) != header.size())
+		{
+			close();
+			throw "Cant write capture header";
+		}
+	}
+
+	writer = std::thread(&FrameCapture::writerLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	writer.join();
+	close();
+}
+
+void FrameCapture::close()
+{
+	if (file)
+		isPipe ? pclose(file) : fclose(file);
+	file = nullptr;
+}
+
+
+bool FrameCapture::submit(const UCHAR* pixels, unsigned colorsCount)
+{
+	if (colorsCount != 3 && colorsCount != 4)
+		throw "Captured frames can be only 3 or 4 bytes per pixel";
+
+	Frame* frame;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (params.blockWhenFull)
+			changed.wait(lock, [this]() { return !freeFrames.empty() || failed; });
+		if (failed)
+			throw "Cant write captured frame";
+		if (freeFrames.empty())
+		{
+			dropped++;
+			return false;
+		}
+
+		frame = freeFrames.back();
+		freeFrames.pop_back();
+	}
+
+	// The only work done on the rendering thread
+	memcpy(frame->pixels.data(), pixels, (size_t)width * height * colorsCount);
+	frame->colorsCount = colorsCount;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		filledFrames.push_back(frame);
+	}
+	changed.notify_all();
+	return true;
+}
+
+uint64_t FrameCapture::getWrittenCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return written;
+}
+
+uint64_t FrameCapture::getDroppedCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return dropped;
+}
+
+
+void FrameCapture::writerLoop()
+{
+	while (true)
+	{
+		Frame* frame;
+		{
+			// Frames submitted before stopping are still written
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this]() { return !filledFrames.empty() || stopping; });
+			if (filledFrames.empty())
+				return;
+
+			frame = filledFrames.front();
+			filledFrames.pop_front();
+		}
+
+		bool isWritten = false;
+		if (!failed)
+		{
+			convert(*frame);
+			static const char frameHeader[] = "FRAME\n";
+			isWritten = (params.format != Format::Y4M || fwrite(frameHeader, 1, sizeof(frameHeader) - 1, file) == sizeof(frameHeader) - 1) &&
+				fwrite(converted.data(), 1, converted.size(), file) == converted.size();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			freeFrames.push_back(frame);
+			written += isWritten;
+			failed |= !isWritten;
+		}
+		changed.notify_all();
+	}
+}
+
+void FrameCapture::convert(const Frame& frame)
+{
+	const UCHAR* pixels = frame.pixels.data();
+	const unsigned step = frame.colorsCount;
+
+	if (params.format == Format::RAW_RGB)
+	{
+		UCHAR* out = converted.data();
+		for (size_t pixel(0); pixel < (size_t)width * height; ++pixel, out += 3)
+		{
+			out[0] = pixels[pixel * step + 2];
+			out[1] = pixels[pixel * step + 1];
+			out[2] = pixels[pixel * step];
+		}
+		return;
+	}
+
+	// Integer BT.601, luma per pixel, chroma from the average of each 2x2 block (edge blocks repeat the last row or column)
+	UCHAR* lumaPlane = converted.data();
+	for (size_t pixel(0); pixel < (size_t)width * height; ++pixel)
+	{
+		const UCHAR* bgr = pixels + pixel * step;
+		lumaPlane[pixel] = UCHAR(((66 * bgr[2] + 129 * bgr[1] + 25 * bgr[0] + 128) >> 8) + 16);
+	}
+
+	const unsigned chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+	UCHAR* uPlane = lumaPlane + (size_t)width * height;
+	UCHAR* vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+	for (unsigned cy(0); cy < chromaHeight; ++cy)
+	{
+		const UCHAR* rows[2]{
+			pixels + (size_t)(2 * cy) * width * step,
+			pixels + (size_t)std::min(2 * cy + 1, height - 1) * width * step
+		};
+		for (unsigned cx(0); cx < chromaWidth; ++cx)
+		{
+			const size_t columns[2]{ (size_t)(2 * cx) * step, (size_t)std::min(2 * cx + 1, width - 1) * step };
+			int b(0), g(0), r(0);
+			for (const UCHAR* row : rows)
+				for (size_t column : columns)
+				{
+					b += row[column];
+					g += row[column + 1];
+					r += row[column + 2];
+				}
+			b = (b + 2) >> 2; g = (g + 2) >> 2; r = (r + 2) >> 2;
+
+			// Offset added before the shift, so it never shifts a negative value
+			uPlane[(size_t)cy * chromaWidth + cx] = UCHAR((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+			vPlane[(size_t)cy * chromaWidth + cx] = UCHAR((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+		}
+	}
+}
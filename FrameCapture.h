@@ -0,0 +1,78 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Platform.h"
+
+
+// Streams rendered frames to a Y4M or raw RGB file, or to a pipe, from a writer thread of its own
+// (it only blocks on I/O, compute stays on the job system). Frames are copied into a fixed set of buffers,
+// converted and written by the writer, and the buffers go back to be filled again, so nothing is allocated per frame
+class FrameCapture
+{
+public:
+	enum class Format
+	{
+		Y4M,	// YUV 4:2:0, BT.601 limited range, chroma averaged over 2x2 pixels
+		RAW_RGB	// Frames of width * height * 3 bytes, top row first
+	};
+
+	struct Params
+	{
+		Format format = Format::Y4M;
+		unsigned buffers = 4;		// Frames waiting for the writer at most
+		bool blockWhenFull = false;	// Waits for a free buffer, else the frame is dropped (and counted)
+		unsigned fpsNumerator = 60;	// Written to the Y4M header
+		unsigned fpsDenominator = 1;
+	};
+
+	/// @param path File, or a command the frames are piped to when it starts with '|' ("|ffmpeg -i - out.mp4")
+	FrameCapture(const char* path, unsigned width, unsigned height, const Params& params);
+	/// @brief Writes every submitted frame before it returns
+	~FrameCapture();
+
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	/// @brief Copies a frame (width * height pixels of colorsCount bytes, B, G, R first, top row first)
+	/// @return false if it was dropped, throws once the writer failed
+	bool submit(const UCHAR* pixels, unsigned colorsCount);
+
+	unsigned getWidth() const		{ return width; }
+	unsigned getHeight() const		{ return height; }
+	uint64_t getWrittenCount() const;
+	uint64_t getDroppedCount() const;
+
+private:
+	struct Frame
+	{
+		std::vector<UCHAR> pixels;
+		unsigned colorsCount;
+	};
+
+	const unsigned width, height;
+	const Params params;
+	FILE* file = nullptr;
+	bool isPipe = false;
+
+	std::vector<Frame> frames;
+	std::vector<Frame*> freeFrames;
+	std::deque<Frame*> filledFrames;	// Oldest first
+	mutable std::mutex mutex;			// Guards the lists, the counters and the flags
+	std::condition_variable changed;
+	bool stopping = false;
+	bool failed = false;
+	uint64_t written = 0, dropped = 0;
+
+	std::vector<UCHAR> converted;		// Writer only
+	std::thread writer;
+
+	void writerLoop();
+	void convert(const Frame& frame);
+	void close();
+};
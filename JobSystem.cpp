@@ -0,0 +1,263 @@
+#include "JobSystem.h"
+#include "Platform.h"
+
+#if !defined(_WIN32) && defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace
+{
+	// Index of the queue owned by this thread, workers set it once
+	thread_local unsigned localQueue = 0;
+	thread_local const JobSystem* localSystem = nullptr;
+}
+
+
+JobSystem::JobSystem(const Params& params) : pinThreads(params.pinThreads)
+{
+	unsigned count = params.threads ? params.threads : std::thread::hardware_concurrency();
+	count = count ? count : 1;
+
+	for (unsigned i(0); i < count; ++i)
+		queues.push_back(std::make_unique<Queue>());
+
+	for (unsigned i(1); i < count; ++i)
+		threads.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+
+unsigned JobSystem::currentQueue() const
+{
+	// Any thread that is not a worker of this system shares queue 0
+	return localSystem == this ? localQueue : 0;
+}
+
+
+void JobSystem::runTask(Task& task, size_t chunks)
+{
+	const unsigned queueId = currentQueue();
+	task.chunksLeft = chunks;
+	push(queueId, Job{ &task, 0, chunks });
+
+	// Helping instead of waiting, nested calls from a job work the same way
+	while (task.chunksLeft.load(std::memory_order_acquire))
+		if (!tryRunOne(queueId))
+			std::this_thread::yield();
+
+	if (task.error)
+		std::rethrow_exception(task.error);
+}
+
+
+void JobSystem::run(std::function<void()> func, Counter* counter, Counter* after)
+{
+	// Counted before anything can finish it
+	if (counter)
+		counter->value.fetch_add(1, std::memory_order_relaxed);
+
+	Task* task = new Task;
+	task->func = std::move(func);
+	task->context = &task->func;
+	task->run = [](const void* ptr, size_t) {
+		(*static_cast<const std::function<void()>*>(ptr))();
+	};
+	task->chunksLeft = 1;
+	task->counter = counter;
+	task->owned = true;
+
+	if (after)
+	{
+		std::lock_guard<std::mutex> lock(after->mutex);
+		if (after->value.load(std::memory_order_acquire))
+		{
+			after->waiting.push_back(task);
+			return;
+		}
+	}
+
+	// Nobody else would run it before wait, so it is run right here
+	const unsigned queueId = currentQueue();
+	if (threads.empty())
+		execute(queueId, Job{ task, 0, 1 });
+	else
+		push(queueId, Job{ task, 0, 1 });
+}
+
+void JobSystem::wait(Counter& counter)
+{
+	const unsigned queueId = currentQueue();
+	while (counter.value.load(std::memory_order_acquire))
+		if (!tryRunOne(queueId))
+			std::this_thread::yield();
+
+	// The last job may still hold the lock, the counter can be destroyed only after it lets go
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(counter.mutex);
+		std::swap(error, counter.error);
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void JobSystem::finish(unsigned queueId, Counter& counter)
+{
+	std::vector<Task*> ready;
+	{
+		// Zero is reached under the lock, so run either sees it or adds to waiting before it is taken
+		std::lock_guard<std::mutex> lock(counter.mutex);
+		if (counter.value.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		ready.swap(counter.waiting);
+	}
+
+	for (Task* task : ready)
+		push(queueId, Job{ task, 0, 1 });
+}
+
+
+void JobSystem::push(unsigned queueId, const Job& job)
+{
+	// Counted first, so it never goes below zero when the job is taken right away
+	queuedJobs++;
+	{
+		std::lock_guard<std::mutex> lock(queues[queueId]->mutex);
+		queues[queueId]->jobs.push_back(job);
+	}
+
+	// Taking the lock orders this with a worker checking queuedJobs before it sleeps
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+
+bool JobSystem::tryRunOne(unsigned queueId)
+{
+	Job job{};
+	bool found = false;
+
+	// Own queue from the back, the newest (smallest, still cached) job
+	{
+		std::lock_guard<std::mutex> lock(queues[queueId]->mutex);
+		auto& jobs = queues[queueId]->jobs;
+		if (!jobs.empty())
+		{
+			job = jobs.back();
+			jobs.pop_back();
+			found = true;
+		}
+	}
+
+	// Others from the front, the oldest job is the biggest one
+	for (size_t i(1); i < queues.size() && !found; ++i)
+	{
+		Queue& victim = *queues[(queueId + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	queuedJobs--;
+	execute(queueId, job);
+	return true;
+}
+
+
+void JobSystem::execute(unsigned queueId, Job job)
+{
+	// Upper halves go back to the queue until a single chunk is left
+	while (job.lastChunk - job.firstChunk > 1)
+	{
+		size_t mid = job.firstChunk + (job.lastChunk - job.firstChunk) / 2;
+		push(queueId, Job{ job.task, mid, job.lastChunk });
+		job.lastChunk = mid;
+	}
+
+	Task& task = *job.task;
+	try
+	{
+		task.run(task.context, job.firstChunk);
+	}
+	catch (...)
+	{
+		// Run jobs report to their counter, without one the exception is lost
+		if (!task.owned)
+		{
+			std::lock_guard<std::mutex> lock(task.errorMutex);
+			if (!task.error)
+				task.error = std::current_exception();
+		}
+		else if (task.counter)
+		{
+			std::lock_guard<std::mutex> lock(task.counter->mutex);
+			if (!task.counter->error)
+				task.counter->error = std::current_exception();
+		}
+	}
+
+	if (task.owned)
+	{
+		Counter* counter = task.counter;
+		delete &task;
+		if (counter)
+			finish(queueId, *counter);
+		return;
+	}
+
+	// Last touch of the task, the caller may return right after
+	task.chunksLeft.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+
+void JobSystem::workerLoop(unsigned queueId)
+{
+	localQueue = queueId;
+	localSystem = this;
+
+	// Only a hint, a failed call leaves the thread unpinned
+	if (pinThreads)
+	{
+		unsigned cores = std::thread::hardware_concurrency();
+		unsigned core = cores ? queueId % cores : 0;
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+
+	while (!quit)
+	{
+		if (tryRunOne(queueId))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this]() { return quit || queuedJobs > 0; });
+	}
+}
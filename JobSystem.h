@@ -0,0 +1,166 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Worker threads with a deque each. Owners take the newest job, idle threads steal the oldest one from others
+// Work is split into fixed chunks, their bounds depend only on the item count and grain, never on the threads count,
+// so anything computed per chunk (and reduced in chunk order) is the same with any number of threads
+// One system is shared by every subsystem (renderer, physics), none of them starts compute threads of its own
+class JobSystem
+{
+	struct Task;
+
+public:
+	struct Params
+	{
+		unsigned threads = 0;	// Including the calling one, 0 - one per hardware thread
+		bool pinThreads = false; // Worker i runs only on core i, the calling thread is left as is
+	};
+
+	// Jobs not finished yet, run adds to it. Jobs can be started after one reaches zero, and wait blocks until it does
+	// Has to outlive its jobs and be waited for before the system is destroyed
+	class Counter
+	{
+	public:
+		Counter() = default;
+		Counter(const Counter&) = delete;
+		Counter& operator=(const Counter&) = delete;
+
+		bool isDone() const { return value.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class JobSystem;
+
+		std::atomic<size_t> value{ 0 };
+		std::mutex mutex;			// Guards waiting, and value reaching zero
+		std::vector<Task*> waiting;	// Started when value reaches zero
+		std::exception_ptr error;	// First one thrown by its jobs
+	};
+
+	JobSystem(const Params& params);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned getThreadsCount() const { return unsigned(threads.size()) + 1; }
+
+	/// @brief Calls func(first, last) for chunks of at most grain items covering 0..count-1, returns when all are done
+	/// The calling thread runs chunks too. A job throwing is rethrown here after the others finish
+	template <class Func>
+	void parallelFor(size_t count, size_t grain, const Func& func);
+
+	/// @brief map(first, last) per chunk, then combine(acc, chunkResult) in chunk order, starting from init
+	template <class T, class Map, class Combine>
+	T parallelReduce(size_t count, size_t grain, T init, const Map& map, const Combine& combine);
+
+	/// @brief Starts func as a job and returns right away, it has to be finished before the system is destroyed
+	/// @param counter Counts the job until it finishes, its exception is rethrown by wait(counter)
+	/// @param after The job starts only once this counter reaches zero
+	void run(std::function<void()> func, Counter* counter = nullptr, Counter* after = nullptr);
+
+	/// @brief Runs jobs (any of them) until the counter reaches zero, then rethrows the first exception of its jobs
+	void wait(Counter& counter);
+
+private:
+	// One parallelFor call (lives on the caller stack) or one run call (heap, deleted when done)
+	struct Task
+	{
+		void (*run)(const void* context, size_t chunk);
+		const void* context;
+		std::atomic<size_t> chunksLeft{ 0 };
+		std::mutex errorMutex;
+		std::exception_ptr error;
+
+		std::function<void()> func;	// Run only
+		Counter* counter = nullptr;
+		bool owned = false;
+	};
+
+	// Range of chunks, split in halves by whoever runs it, so idle threads have something to steal
+	struct Job
+	{
+		Task* task;
+		size_t firstChunk, lastChunk;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues; // 0 - the thread that calls parallelFor
+	std::vector<std::thread> threads;
+
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<size_t> queuedJobs{ 0 };
+	std::atomic<bool> quit{ false };
+	const bool pinThreads;
+
+	void runTask(Task& task, size_t chunks);
+	void push(unsigned queueId, const Job& job);
+	bool tryRunOne(unsigned queueId);
+	void execute(unsigned queueId, Job job);
+	void finish(unsigned queueId, Counter& counter);
+	void workerLoop(unsigned queueId);
+	unsigned currentQueue() const;
+};
+
+
+//// TEMPLATES ////
+
+
+template <class Func>
+void JobSystem::parallelFor(size_t count, size_t grain, const Func& func)
+{
+	if (!count)
+		return;
+	grain = grain ? grain : 1;
+	const size_t chunks = (count + grain - 1) / grain;
+
+	struct Context
+	{
+		const Func& func;
+		size_t count, grain;
+	} context{ func, count, grain };
+
+	if (threads.empty() || chunks == 1)
+	{
+		for (size_t chunk(0); chunk < chunks; ++chunk)
+			func(chunk * grain, std::min(count, (chunk + 1) * grain));
+		return;
+	}
+
+	Task task;
+	task.context = &context;
+	task.run = [](const void* ptr, size_t chunk) {
+		const Context& ctx = *static_cast<const Context*>(ptr);
+		ctx.func(chunk * ctx.grain, std::min(ctx.count, (chunk + 1) * ctx.grain));
+	};
+	runTask(task, chunks);
+}
+
+template <class T, class Map, class Combine>
+T JobSystem::parallelReduce(size_t count, size_t grain, T init, const Map& map, const Combine& combine)
+{
+	grain = grain ? grain : 1;
+	std::vector<T> partial((count + grain - 1) / grain);
+	parallelFor(count, grain, [&](size_t first, size_t last) {
+		partial[first / grain] = map(first, last);
+	});
+
+	for (const T& value : partial)
+		init = combine(init, value);
+	return init;
+}
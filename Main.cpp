@@ -2,6 +2,12 @@
 //
 
 #include <iostream>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
 
 #include "Canvas.h"
 #include "Vecd.h"
@@ -10,6 +16,12 @@
 #include "Texture.h"
 #include "Camera.h"
 #include "Physics.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Recorder.h"
+#include "Scene.h"
+#include "MeshFile.h"
+#include "FrameCapture.h"
 
 
 double mix(double x, double y, double a)
@@ -208,14 +220,14 @@ void triagFrag(const Vecd<4>& pos, const Vecd<4>& texture, Vecd<4>& col)
 	Vecd<4> ambient = 0.1 * lightCol;
 
 	// Diffuse
-	double diff = abs(max(dot(norm, lightDir), 0.0));
+	double diff = std::abs(std::max(dot(norm, lightDir), 0.0));
 	Vecd<4> diffuse = 0.6 * diff * lightCol;
 
 	// Specular
 	Vecd<3> viewDir = normalize(cam.getPos() - pos);
 	Vecd<3> reflectDir = reflect(-lightDir, norm);
 
-	double spec = pow(max(dot(viewDir, reflectDir), 0.0), 64);
+	double spec = fmath::powi(std::max(dot(viewDir, reflectDir), 0.0), 64);
 	Vecd<4> specular = 0.5 * spec * lightCol;
 
 	// Result
@@ -223,9 +235,53 @@ void triagFrag(const Vecd<4>& pos, const Vecd<4>& texture, Vecd<4>& col)
 }
 
 
+// Imported meshes, only texture coords reach the shader
+void meshFrag(const Vecd<4>& pos, const Vecd<4>& texture, Vecd<4>& col)
+{
+	col = goldTex.getPixel(texture.x(), texture.y());
+	col = (0.6 * lightCol) * col;
+}
+
+
+// Translucent quads (--glass), colors are premultiplied by alpha
+void glassFrag(const Vecd<4>& pos, const Vecd<4>& texture, Vecd<4>& col)
+{
+	// Looks thicker towards the edges
+	double edge = 2.0 * std::max(std::abs(texture.x() - 0.5), std::abs(texture.y() - 0.5));
+	double alpha = 0.2 + 0.4 * edge * edge;
+	col = Vecd<4>{ 0.7 * alpha, 0.9 * alpha, 0.6 * alpha, alpha };
+}
+
+void glowFrag(const Vecd<4>& pos, const Vecd<4>& texture, Vecd<4>& col)
+{
+	// Additive soft disc, alpha is not used
+	double dx = texture.x() - 0.5, dy = texture.y() - 0.5;
+	double falloff = std::max(0.0, 1.0 - 4.0 * (dx * dx + dy * dy));
+	col = Vecd<4>{ 0.9 * falloff, 0.5 * falloff, 0.2 * falloff, 0.0 };
+}
+
+
 bool changeForce(false);
-void rightClickCallback(long keyId, bool isPressed)
+InputRecorder* activeRecorder(nullptr);
+void keysCallback(long keyId, bool isPressed)
 {
+	if (activeRecorder)
+		activeRecorder->recordKey(keyId, isPressed);
+
+#ifdef CODESOUL_PROFILE
+	// Dumping frame timings
+	if (keyId == 'P')
+	{
+		if (isPressed)
+		{
+			Profiler::exportChromeTrace("Frame_Trace.json");
+			std::ofstream summary("Frame_Summary.txt");
+			Profiler::writeSummary(summary);
+		}
+		return;
+	}
+#endif
+
 	if (isPressed)
 		changeForce = 1; // Apply
 	else
@@ -233,15 +289,131 @@ void rightClickCallback(long keyId, bool isPressed)
 }
 
 
-int main()
+struct RunOptions
 {
+	const char* recordPath = nullptr;	// Writes input log of a live run
+	const char* replayPath = nullptr;	// Runs headless from an input log
+	const char* hashesPath = nullptr;	// Hash of every frame, for diffing runs
+	bool unthrottled = false;			// Replays as fast as possible instead of recorded times
+	unsigned threads = 0;				// Job system threads, 0 - one per hardware thread
+	const char* importObj = nullptr;	// Converts an OBJ into a binary mesh and exits
+	const char* importOut = nullptr;
+	const char* meshPath = nullptr;		// Binary mesh placed on the floor
+	const char* capturePath = nullptr;	// Y4M (raw RGB for .rgb) file of every frame, or "|command" to pipe it
+	bool glass = false;					// Glass pane in front of the thing and a glow behind it
+};
+
+uint64_t hashFrame(const UCHAR* pixels, size_t size)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i(0); i < size; ++i)
+		hash = (hash ^ pixels[i]) * 1099511628211ULL;
+	return hash;
+}
+
+
+int main(int argc, char* argv[])
+{
+	RunOptions opts;
+	for (int i(1); i < argc; ++i)
+	{
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--record") && hasValue) opts.recordPath = argv[++i];
+		else if (!strcmp(argv[i], "--replay") && hasValue) opts.replayPath = argv[++i];
+		else if (!strcmp(argv[i], "--hashes") && hasValue) opts.hashesPath = argv[++i];
+		else if (!strcmp(argv[i], "--unthrottled")) opts.unthrottled = true;
+		else if (!strcmp(argv[i], "--threads") && hasValue) opts.threads = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--import") && i + 2 < argc) { opts.importObj = argv[++i]; opts.importOut = argv[++i]; }
+		else if (!strcmp(argv[i], "--mesh") && hasValue) opts.meshPath = argv[++i];
+		else if (!strcmp(argv[i], "--capture") && hasValue) opts.capturePath = argv[++i];
+		else if (!strcmp(argv[i], "--glass")) opts.glass = true;
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--record input.log] [--replay input.log [--unthrottled]] [--hashes frames.txt] [--threads N] [--mesh level.csmb] [--import in.obj out.csmb] [--capture out.y4m] [--glass]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (opts.importObj)
+	{
+		try
+		{
+			MeshFile::ImportStats stats = MeshFile::importObj(opts.importObj, opts.importOut);
+			std::cout << stats.vertices << " vertices, " << stats.triangles << " triangles, ACMR " <<
+				stats.acmrBefore << " -> " << stats.acmrAfter << std::endl;
+		}
+		catch (const char* error)
+		{
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+#ifndef _WIN32
+	// Only replays are headless
+	if (!opts.replayPath)
+	{
+		std::cerr << "Live mode needs Windows, use --replay" << std::endl;
+		return 1;
+	}
+#endif
+
+	std::unique_ptr<InputRecorder> recorder;
+	std::unique_ptr<InputReplay> replay;
+	if (opts.replayPath)
+		replay = std::make_unique<InputReplay>(opts.replayPath);
+	else if (opts.recordPath)
+		recorder = std::make_unique<InputRecorder>(opts.recordPath);
+	activeRecorder = recorder.get();
+
+	std::ofstream hashes;
+	if (opts.hashesPath)
+		hashes.open(opts.hashesPath);
+
 	Canvas::Params cnvParams;
 	cnvParams.colorsCount = 4;
+	cnvParams.samplesCount = 4;
+	cnvParams.dynamicResolution = true;
+	cnvParams.resolution.targetFrameMs = 16.0;
+	cnvParams.partialRedraw = true; // Shaders read only their figures, the camera moving changes every vertex anyway
 	cnvParams.dontCloseWindow = true;
 	cnvParams.showMSPF = true;
 
-	Canvas cnv(GetConsoleWindow(), 1024, 512, cnvParams);
-	cnv.setAlignment(Canvas::HVCenter, -512, -256);
+	std::unique_ptr<Canvas> canvas;
+	if (replay)
+	{
+		// Resolution must not depend on how fast the replay runs
+		cnvParams.dynamicResolution = false;
+		cnvParams.dontCloseWindow = false;
+		canvas = std::make_unique<Canvas>(1024, 512, cnvParams);
+	}
+#ifdef _WIN32
+	else
+	{
+		canvas = std::make_unique<Canvas>(GetConsoleWindow(), 1024, 512, cnvParams);
+		canvas->setAlignment(Canvas::HVCenter, -512, -256);
+	}
+#endif
+	Canvas& cnv = *canvas;
+
+	// Live runs drop frames the writer cant keep up with, replays wait for it, so every frame is captured
+	std::unique_ptr<FrameCapture> capture;
+	if (opts.capturePath)
+	{
+		FrameCapture::Params captureParams;
+		const size_t pathLength = strlen(opts.capturePath);
+		if (pathLength > 4 && !strcmp(opts.capturePath + pathLength - 4, ".rgb"))
+			captureParams.format = FrameCapture::Format::RAW_RGB;
+		captureParams.blockWhenFull = replay != nullptr;
+		capture = std::make_unique<FrameCapture>(opts.capturePath, 1024, 512, captureParams);
+		cnv.setCapture(capture.get());
+	}
+
+	// Shared by the renderer and the physics, frames dont depend on the threads count
+	JobSystem jobs({ opts.threads });
+	cnv.setJobSystem(&jobs);
 
 	// Per vertex info
 	Vecd<4> floorTexCoords[3][2]
@@ -288,88 +460,177 @@ int main()
 	const double Kws = 10.0;		// Hooke's spring constant
 	const double Kwd = 10.0;		// Damping constant
 
-	Simulator phySim(thingVert, IbodyInv, 1.0, 5.0);
+	// Symplectic one stays stable at twice the default step
+	Simulator phySim(thingVert, IbodyInv, 1.0, 5.0, Integrator::SYMPLECTIC_EULER);
+	phySim.setTimestep({ 1.0 / 60, 8 });
+
+	// Spring is connected to thingVert[0], evaluated every step, so it stays stable at low frame rates
+	ForceGenerators& generators = phySim.getForceGenerators();
+	ForceGenerators::Id springId = generators.addSpring({ 0, thingVert[0], {}, Kws, Kwd, 0.0, false });
 
 	// View
-	cam.setCustomKeysCallback(rightClickCallback);
-	cam.addTrackingKey(VK_RBUTTON);
+	const long springKey = 0x02; // VK_RBUTTON
+	cam.setCustomKeysCallback(keysCallback);
+	cam.addTrackingKey(springKey);
+#ifdef CODESOUL_PROFILE
+	cam.addTrackingKey('P');
+#endif
 
 	// Perspective matrix
 	float nearPlane(0.1f), farPlane(1.0f);
 	Matd<4, 4> projMat(cam.perspective(1024.0 / 512.0, nearPlane, farPlane));
 
+	// Mapped before the scene, which draws straight from it
+	std::unique_ptr<MeshFile> meshFile;
+	if (opts.meshPath)
+		meshFile = std::make_unique<MeshFile>(opts.meshPath);
+
+	// Scene, the thing is placed with the pose its vertices were interpolated with
+	Scene scene;
+	auto toMesh = [](const Vecd<3> vertices[3], const Vecd<4> perVertex[3][2], Scene::FragmentShader shader) {
+		Scene::Mesh mesh{ { vertices[0], vertices[1], vertices[2] }, {}, shader };
+		for (int vId(0); vId < 3; ++vId)
+			mesh.perVertex.insert(mesh.perVertex.end(), { perVertex[vId][0], perVertex[vId][1] });
+		return mesh;
+	};
+	const Matd<3, 3> noRotation = Matd<3, 3>::getIdentityMatrix();
+	scene.addObject(scene.addMesh(toMesh(floorVert, floorTexCoords, floorFrag)), Vecd<3>{}, noRotation);
+	Scene::ObjectId thingObject = scene.addObject(scene.addMesh(toMesh(thingVert, thingTexCoords, triagFrag)), Vecd<3>{}, noRotation);
+	if (meshFile)
+	{
+		// Resting on the floor in front of the thing
+		const Vecd<3> lift{ 0.0, -5.0 - meshFile->getBoundsMin().y(), 0.0 };
+		scene.addObject(scene.addMesh(*meshFile, meshFrag), Vecd<3>{ 0.0, 0.0, -3.0 } + lift, noRotation);
+	}
+	if (opts.glass)
+	{
+		// Unit quad facing the camera, scaled per object
+		auto toQuad = [](double width, double height, Scene::FragmentShader shader, BlendMode blendMode) {
+			Scene::Mesh mesh{ {}, {}, shader, blendMode };
+			const double corners[6][2]{ { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 } };
+			for (const auto& corner : corners)
+			{
+				mesh.vertices.push_back(Vecd<3>{ (corner[0] - 0.5) * width, (corner[1] - 0.5) * height, 0.0 });
+				mesh.perVertex.insert(mesh.perVertex.end(), { Vecd<4>{ corner[0], corner[1], 0.0, 1.0 }, Vecd<4>{} });
+			}
+			return mesh;
+		};
+		scene.addObject(scene.addMesh(toQuad(1.5, 1.5, glassFrag, BlendMode::OVER)), Vecd<3>{ 0.6, -0.3, 1.5 }, noRotation);
+		scene.addObject(scene.addMesh(toQuad(2.5, 2.5, glowFrag, BlendMode::ADD)), Vecd<3>{ 0.0, 0.5, -1.0 }, noRotation);
+	}
+
 	double angle(0.0), deltaTime(0.0), lastTime(0.0);
-	while (true)
+	InputReplay::Frame replayFrame;
+	const auto replayStart = std::chrono::steady_clock::now();
+	for (uint64_t frameId(0); ; ++frameId)
 	{
-		Vecd<4> thingVert4[3], floorVert4[3];
+		Vecd<4> thingVert4[3];
+
+		// Frame time first, so physics can step while the input is handled
+		if (replay)
+		{
+			if (!replay->nextFrame(replayFrame))
+				break;
+			deltaTime = replayFrame.dTime;
+
+			if (!opts.unthrottled)
+				std::this_thread::sleep_until(replayStart + std::chrono::duration<double>(replayFrame.time));
+		}
+#ifdef _WIN32
+		else
+		{
+			deltaTime = cam.timeSinceStart() - lastTime;
+			lastTime = cam.timeSinceStart();
+		}
+#endif
+
+		// Translating and rotating, in fixed steps, as a job. Input touches only the camera, the recorder
+		// and changeForce, so it overlaps the step. Culling and the spring wait, they need the new pose
+		JobSystem::Counter physicsDone;
+		phySim.advanceAsync(deltaTime, jobs, physicsDone);
+
+		if (replay)
+		{
+			PROFILE_SCOPE("input");
+			cam.applyInput(replayFrame.input, deltaTime);
+			for (auto& key : replayFrame.keys)
+				cam.setCustomKeyState(key.first, key.second);
+		}
+#ifdef _WIN32
+		else
+		{
+			PROFILE_SCOPE("input");
+			Camera::InputState input = cam.pollInput();
+			if (recorder)
+			{
+				recorder->beginFrame(lastTime, deltaTime);
+				recorder->recordInput(input);
+			}
+			cam.applyInput(input, deltaTime);
+			cam.pollCustomKeys();
+		}
+#endif
 
-		// Updates
-		deltaTime = cam.timeSinceStart() - lastTime;
-		lastTime = cam.timeSinceStart();
-		cam.processInput(deltaTime);
+		// The calling thread helps while it waits
+		jobs.wait(physicsDone);
 
-		auto newThingVert = phySim.updatePhysics(deltaTime); // Translating and rotating
+		Vecd<3>* newThingVert = phySim.getInterpolatedVertices();
 		for (int vId(0); vId < 3; ++vId)
 		{
 			thingVert4[vId] = newThingVert[vId];
-			floorVert4[vId] = floorVert[vId];
 			thingVert4[vId].w() = 1.0;
-			floorVert4[vId].w() = 1.0;
 		}
+		scene.setTransform(thingObject, phySim.getInterpolatedPosition(), phySim.getInterpolatedOrientation());
 
-		if (changeForce == 1)
+		if (replay)
+		{
+			// Same forces as in the recorded run, whatever the interaction code does now
+			for (auto& force : replayFrame.forces)
+			{
+				phySim.applyForce(force.force);
+				phySim.applyTorque(force.torque);
+			}
+			for (auto& pos : replayFrame.teleports)
+				phySim.setCenterPos(pos);
+			for (auto& spring : replayFrame.springs)
+			{
+				generators.setSpringAnchor(springId, spring.anchor);
+				generators.setSpringActive(springId, spring.active);
+			}
+		}
+		else
 		{
-			// Spring is connected to thingVert4[0]
 			Vecd<3> anchor = cam.getPos() + (-5.0 * cam.getFront());
+			bool attached = changeForce == 1 && (thingVert4[0] - anchor).sqLength() < 100.0;
 
-			if ((thingVert4[0] - anchor).sqLength() < 100.0)
+			if (attached || generators.getSpring(springId).active)
 			{
-				Vecd<3> U = thingVert4[0] - phySim.getCenterPos();
-				Vecd<3> VU = phySim.getLinearVelocity() +
-					cross(phySim.getAngularVelocity(), U);
-
-				Vecd<3> spring = -Kws * (thingVert4[0] - anchor);
-				Vecd<3> dampingForce = spring + (-Kwd * (dot(VU, spring) / dot(spring, spring)) * spring);
-
-				phySim.applyForce(dampingForce);
-				phySim.applyTorque(cross(U, dampingForce));
+				generators.setSpringAnchor(springId, anchor);
+				generators.setSpringActive(springId, attached);
+				if (recorder)
+					recorder->recordSpring(attached, anchor);
 			}
-			else
+
+			if (changeForce == 1 && !attached)
 			{
 				if (anchor.y() <= 0)
 					anchor.y() = 0.5;
 
 				phySim.setCenterPos(anchor);
+				if (recorder)
+					recorder->recordTeleport(anchor);
 			}
 		}
 
 		triagRotatedNormal = cross(thingVert4[0] - thingVert4[1], thingVert4[2] - thingVert4[1]);
 
-		auto lookMat = cam.lookAt();
-		for (int i(0); i < 3; ++i)
-		{
-			// View
-			thingVert4[i] = lookMat * thingVert4[i];
-			floorVert4[i] = lookMat * floorVert4[i];
-
-			// Projection
-			thingVert4[i] = projMat * thingVert4[i];
-			floorVert4[i] = projMat * floorVert4[i];
-		}
-
+		// Objects out of view are dropped before any of their vertices is transformed
 		cnv.fill(RGB(0, 0, 0), 1.0f);
-
-		auto floor = new Triangle<4>(floorVert4);
-		floor->setFragmentShader(floorFrag);
-		floor->setPerVertexInfo(floorTexCoords);
-		cnv.addFigure(floor);
-
-		auto triag = new Triangle<4>(thingVert4);
-		triag->setFragmentShader(triagFrag);
-		triag->setPerVertexInfo(thingTexCoords);
-		cnv.addFigure(triag);
-
+		scene.draw(cnv, cam.lookAt(), projMat);
 		cnv.render();
+
+		if (hashes.is_open())
+			hashes << frameId << " " << std::hex << hashFrame(cnv.getArray(), cnv.getPixelsSize()) << std::dec << "\n";
 	}
 
 	return 0;
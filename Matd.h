@@ -144,4 +144,44 @@ Matd<M, N> transpose(const Matd<N, M>& mat)
 		for (int j(0); j < N; ++j)
 			toRet[i][j] = mat[j][i];
 	return toRet;
-}
\ No newline at end of file
+}
+
+
+//// STRUCTURE OF ARRAYS ////
+
+
+// Like Vec3Array, one std::vector per element
+struct Mat3Array
+{
+	std::vector<double> m[3][3];
+
+	void resize(size_t count)
+	{
+		for (auto& row : m)
+			for (auto& elem : row)
+				elem.resize(count);
+	}
+
+	void reserve(size_t count)
+	{
+		for (auto& row : m)
+			for (auto& elem : row)
+				elem.reserve(count);
+	}
+
+	Matd<3, 3> get(size_t id) const
+	{
+		Matd<3, 3> toRet;
+		for (int i(0); i < 3; ++i)
+			for (int j(0); j < 3; ++j)
+				toRet[i][j] = m[i][j][id];
+		return toRet;
+	}
+
+	void set(size_t id, const Matd<3, 3>& mat)
+	{
+		for (int i(0); i < 3; ++i)
+			for (int j(0); j < 3; ++j)
+				m[i][j][id] = mat[i][j];
+	}
+};
@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MeshFile.h"
+#include "Platform.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+	constexpr int scoreCacheSize = 32;	// Cache the order is scored for, bigger than the measured one so it suits any
+	constexpr int fifoCacheSize = 16;	// Cache ImportStats are measured with
+
+	uint16_t quantize(double value, double min, double max)
+	{
+		if (max <= min)
+			return 0;
+		return uint16_t(std::clamp(std::lround((value - min) / (max - min) * 65535.0), 0L, 65535L));
+	}
+
+	double dequantize(uint16_t value, float min, float max)
+	{
+		return min + value * ((double(max) - min) / 65535.0);
+	}
+
+	int16_t toSnorm(double value)
+	{
+		return int16_t(std::lround(std::clamp(value, -1.0, 1.0) * 32767.0));
+	}
+
+	double signNotZero(double value)
+	{
+		return value < 0.0 ? -1.0 : 1.0;
+	}
+
+
+	//// INDEX ORDER ////
+
+
+	// Forsyth's linear speed vertex cache optimization: the next triangle is the best scoring one among
+	// the triangles of the cached vertices. Recent vertices and vertices with few triangles left score higher
+	float vertexScore(int cachePos, uint32_t remaining)
+	{
+		if (!remaining)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePos >= 0)
+			score = cachePos < 3 ? 0.75f : std::pow(1.0f - float(cachePos - 3) / (scoreCacheSize - 3), 1.5f);
+		return score + 2.0f / std::sqrt(float(remaining));
+	}
+
+	std::vector<uint32_t> optimizeTriangles(const std::vector<uint32_t>& indices, size_t verticesCount)
+	{
+		const size_t trianglesCount = indices.size() / 3;
+
+		// Triangles of every vertex, the ones not yet emitted are in front
+		std::vector<uint32_t> first(verticesCount + 1), remaining(verticesCount);
+		for (uint32_t index : indices)
+			remaining[index]++;
+		for (size_t v(0); v < verticesCount; ++v)
+			first[v + 1] = first[v] + remaining[v];
+		std::vector<uint32_t> adjacency(indices.size()), filled(first.begin(), first.end() - 1);
+		for (size_t i(0); i < indices.size(); ++i)
+			adjacency[filled[indices[i]]++] = uint32_t(i / 3);
+
+		std::vector<int> cachePos(verticesCount, -1);
+		std::vector<float> score(verticesCount);
+		for (size_t v(0); v < verticesCount; ++v)
+			score[v] = vertexScore(-1, remaining[v]);
+
+		std::vector<bool> emitted(trianglesCount);
+		std::vector<uint32_t> cache, nextCache, out;
+		out.reserve(indices.size());
+		size_t scan(0);
+		int64_t best(-1);
+
+		while (out.size() < indices.size())
+		{
+			// Nothing cached has triangles left, take the next one in source order
+			if (best < 0)
+			{
+				while (emitted[scan])
+					scan++;
+				best = int64_t(scan);
+			}
+
+			emitted[best] = true;
+			const uint32_t* triangle = &indices[3 * best];
+			out.insert(out.end(), triangle, triangle + 3);
+
+			for (int i(0); i < 3; ++i)
+			{
+				uint32_t v = triangle[i];
+				uint32_t* begin = &adjacency[first[v]];
+				std::iter_swap(std::find(begin, begin + remaining[v], uint32_t(best)), begin + remaining[v] - 1);
+				remaining[v]--;
+			}
+
+			// Triangle vertices go to the front, vertices pushed out of the cache lose their cache score
+			nextCache.assign(triangle, triangle + 3);
+			for (uint32_t v : cache)
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache.push_back(v);
+			for (size_t i(scoreCacheSize); i < nextCache.size(); ++i)
+			{
+				cachePos[nextCache[i]] = -1;
+				score[nextCache[i]] = vertexScore(-1, remaining[nextCache[i]]);
+			}
+			nextCache.resize(std::min(nextCache.size(), size_t(scoreCacheSize)));
+			for (size_t i(0); i < nextCache.size(); ++i)
+			{
+				cachePos[nextCache[i]] = int(i);
+				score[nextCache[i]] = vertexScore(int(i), remaining[nextCache[i]]);
+			}
+			std::swap(cache, nextCache);
+
+			best = -1;
+			float bestScore(-1.0f);
+			for (uint32_t v : cache)
+			{
+				for (uint32_t a(first[v]); a < first[v] + remaining[v]; ++a)
+				{
+					const uint32_t* candidate = &indices[3 * adjacency[a]];
+					float candidateScore = score[candidate[0]] + score[candidate[1]] + score[candidate[2]];
+					if (candidateScore > bestScore)
+					{
+						bestScore = candidateScore;
+						best = adjacency[a];
+					}
+				}
+			}
+		}
+
+		return out;
+	}
+
+	double fifoAcmr(const std::vector<uint32_t>& indices, size_t verticesCount)
+	{
+		// A vertex is cached while fewer than the cache size misses happened since its own
+		std::vector<int64_t> missedAt(verticesCount, -fifoCacheSize - 1);
+		int64_t misses(0);
+		for (uint32_t index : indices)
+		{
+			if (misses - missedAt[index] > fifoCacheSize)
+				missedAt[index] = ++misses;
+		}
+		return indices.empty() ? 0.0 : double(misses) / (indices.size() / 3);
+	}
+
+
+	//// OBJ ////
+
+
+	struct ObjCorner
+	{
+		int position, texCoords, normal; // -1 if absent
+	};
+
+	int resolveIndex(long index, size_t count)
+	{
+		long resolved = index < 0 ? long(count) + index : index - 1;
+		if (resolved < 0 || size_t(resolved) >= count)
+			throw "OBJ face index is out of range";
+		return int(resolved);
+	}
+}
+
+
+MeshFile::ImportStats MeshFile::importObj(const char* objPath, const char* meshPath)
+{
+	std::ifstream obj(objPath);
+	if (!obj)
+		throw "Cant open OBJ file";
+
+	std::vector<Vecd<3>> positions, normals;
+	std::vector<Vecd<2>> texCoords;
+	std::vector<ObjCorner> corners; // Three per triangle
+
+	std::string line;
+	std::vector<ObjCorner> polygon;
+	while (std::getline(obj, line))
+	{
+		const char* cur = line.c_str();
+		while (*cur == ' ' || *cur == '\t')
+			cur++;
+
+		char* end = nullptr;
+		if (!strncmp(cur, "v ", 2) || !strncmp(cur, "vn ", 3))
+		{
+			bool isNormal = cur[1] == 'n';
+			Vecd<3> value;
+			cur += isNormal ? 3 : 2;
+			for (int axis(0); axis < 3; ++axis, cur = end)
+				value[axis] = strtod(cur, &end);
+			(isNormal ? normals : positions).push_back(value);
+		}
+		else if (!strncmp(cur, "vt ", 3))
+		{
+			Vecd<2> value;
+			cur += 3;
+			for (int axis(0); axis < 2; ++axis, cur = end)
+				value[axis] = strtod(cur, &end);
+			texCoords.push_back(value);
+		}
+		else if (!strncmp(cur, "f ", 2))
+		{
+			// p, p/t, p//n or p/t/n, polygons are fanned around the first corner
+			polygon.clear();
+			cur += 2;
+			while (true)
+			{
+				long position = strtol(cur, &end, 10);
+				if (end == cur)
+					break;
+
+				ObjCorner corner{ resolveIndex(position, positions.size()), -1, -1 };
+				cur = end;
+				if (*cur == '/')
+				{
+					cur++;
+					if (*cur != '/')
+					{
+						corner.texCoords = resolveIndex(strtol(cur, &end, 10), texCoords.size());
+						cur = end;
+					}
+					if (*cur == '/')
+					{
+						cur++;
+						corner.normal = resolveIndex(strtol(cur, &end, 10), normals.size());
+						cur = end;
+					}
+				}
+				polygon.push_back(corner);
+			}
+
+			for (size_t i(2); i < polygon.size(); ++i)
+				corners.insert(corners.end(), { polygon[0], polygon[i - 1], polygon[i] });
+		}
+	}
+
+	if (corners.empty())
+		throw "OBJ has no faces";
+
+	// Corners without a normal take the area weighted average of the faces around their position
+	std::vector<Vecd<3>> positionNormals(positions.size());
+	for (size_t i(0); i < corners.size(); i += 3)
+	{
+		const Vecd<3>& p0 = positions[corners[i].position];
+		Vecd<3> faceNormal = cross(Vecd<3>(positions[corners[i + 1].position] - p0), Vecd<3>(positions[corners[i + 2].position] - p0));
+		for (int c(0); c < 3; ++c)
+			positionNormals[corners[i + c].position] = positionNormals[corners[i + c].position] + faceNormal;
+	}
+
+	// Welding
+	std::map<std::array<int, 3>, uint32_t> welded;
+	std::vector<ObjCorner> unique;
+	std::vector<uint32_t> indices;
+	indices.reserve(corners.size());
+	for (const ObjCorner& corner : corners)
+	{
+		auto inserted = welded.insert({ { corner.position, corner.texCoords, corner.normal }, uint32_t(unique.size()) });
+		if (inserted.second)
+			unique.push_back(corner);
+		indices.push_back(inserted.first->second);
+	}
+
+	ImportStats stats;
+	stats.vertices = unique.size();
+	stats.triangles = indices.size() / 3;
+	stats.acmrBefore = fifoAcmr(indices, unique.size());
+
+	indices = optimizeTriangles(indices, unique.size());
+	stats.acmrAfter = fifoAcmr(indices, unique.size());
+
+	// Vertices in the order triangles first use them
+	std::vector<uint32_t> remap(unique.size(), UINT32_MAX);
+	std::vector<ObjCorner> ordered;
+	ordered.reserve(unique.size());
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = uint32_t(ordered.size());
+			ordered.push_back(unique[index]);
+		}
+		index = remap[index];
+	}
+
+	// Bounds are taken in float, so every quantized position is inside the stored ones
+	MeshFormat::Header header{};
+	memcpy(header.magic, MeshFormat::magic, sizeof(header.magic));
+	header.version = MeshFormat::version;
+	header.verticesCount = uint32_t(ordered.size());
+	header.indicesCount = uint32_t(indices.size());
+	header.indexSize = ordered.size() <= 65536 ? 2 : 4;
+	for (int axis(0); axis < 3; ++axis)
+	{
+		header.boundsMin[axis] = header.boundsMax[axis] = float(positions[ordered[0].position][axis]);
+		for (const ObjCorner& corner : ordered)
+		{
+			header.boundsMin[axis] = std::min(header.boundsMin[axis], float(positions[corner.position][axis]));
+			header.boundsMax[axis] = std::max(header.boundsMax[axis], float(positions[corner.position][axis]));
+		}
+	}
+	for (int axis(0); axis < 2; ++axis)
+	{
+		bool any = false;
+		for (const ObjCorner& corner : ordered)
+		{
+			if (corner.texCoords < 0)
+				continue;
+			float value = float(texCoords[corner.texCoords][axis]);
+			header.uvMin[axis] = any ? std::min(header.uvMin[axis], value) : value;
+			header.uvMax[axis] = any ? std::max(header.uvMax[axis], value) : value;
+			any = true;
+		}
+	}
+	header.verticesOffset = sizeof(MeshFormat::Header);
+	header.indicesOffset = header.verticesOffset + ordered.size() * sizeof(MeshFormat::Vertex);
+
+	std::vector<MeshFormat::Vertex> vertices(ordered.size());
+	for (size_t v(0); v < ordered.size(); ++v)
+	{
+		const ObjCorner& corner = ordered[v];
+		MeshFormat::Vertex& vertex = vertices[v];
+
+		for (int axis(0); axis < 3; ++axis)
+			vertex.position[axis] = quantize(float(positions[corner.position][axis]), header.boundsMin[axis], header.boundsMax[axis]);
+
+		if (corner.texCoords >= 0)
+			for (int axis(0); axis < 2; ++axis)
+				vertex.uv[axis] = quantize(float(texCoords[corner.texCoords][axis]), header.uvMin[axis], header.uvMax[axis]);
+
+		// Onto the octahedron, the lower half folded over the upper one
+		Vecd<3> normal = corner.normal >= 0 ? normals[corner.normal] : positionNormals[corner.position];
+		double sum = std::abs(normal.x()) + std::abs(normal.y()) + std::abs(normal.z());
+		if (sum <= 0.0)
+		{
+			normal = Vecd<3>{ 0.0, 0.0, 1.0 };
+			sum = 1.0;
+		}
+		double x = normal.x() / sum, y = normal.y() / sum;
+		if (normal.z() < 0.0)
+		{
+			double folded = (1.0 - std::abs(y)) * signNotZero(x);
+			y = (1.0 - std::abs(x)) * signNotZero(y);
+			x = folded;
+		}
+		vertex.normal[0] = toSnorm(x);
+		vertex.normal[1] = toSnorm(y);
+	}
+
+	std::ofstream out(meshPath, std::ios::binary);
+	if (!out)
+		throw "Cant open mesh file for writing";
+
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)vertices.data(), vertices.size() * sizeof(MeshFormat::Vertex));
+	if (header.indexSize == 2)
+	{
+		std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+		out.write((const char*)shortIndices.data(), shortIndices.size() * sizeof(uint16_t));
+	}
+	else
+		out.write((const char*)indices.data(), indices.size() * sizeof(uint32_t));
+
+	if (!out)
+		throw "Cant write mesh file";
+	return stats;
+}
+
+
+//// LOADING ////
+
+
+MeshFile::MeshFile(const char* path)
+{
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw "Cant open mesh file";
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= LONGLONG(sizeof(MeshFormat::Header)))
+	{
+		size = size_t(fileSize.QuadPart);
+		fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (fileMapping)
+			mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		throw "Cant open mesh file";
+
+	struct stat info;
+	if (!fstat(fd, &info) && size_t(info.st_size) >= sizeof(MeshFormat::Header))
+	{
+		size = size_t(info.st_size);
+		mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		mapping = mapping == MAP_FAILED ? nullptr : mapping;
+	}
+	close(fd); // Mapping keeps the file
+#endif
+
+	// Only the header is read, the rest is paged in when drawn
+	header = (const MeshFormat::Header*)mapping;
+	const char* error = nullptr;
+	if (!header)
+		error = "Cant map mesh file";
+	else if (memcmp(header->magic, MeshFormat::magic, sizeof(MeshFormat::magic)))
+		error = "Not a mesh file";
+	else if (header->version != MeshFormat::version)
+		error = "Unsupported mesh file version";
+	else if ((header->indexSize != 2 && header->indexSize != 4) || header->indicesCount % 3 ||
+		header->verticesOffset % alignof(MeshFormat::Vertex) || header->indicesOffset % header->indexSize ||
+		header->verticesOffset + uint64_t(header->verticesCount) * sizeof(MeshFormat::Vertex) > size ||
+		header->indicesOffset + uint64_t(header->indicesCount) * header->indexSize > size)
+		error = "Mesh file is corrupted";
+
+	if (error)
+	{
+		unmap();
+		throw error;
+	}
+
+	vertices = (const MeshFormat::Vertex*)((const char*)mapping + header->verticesOffset);
+	indices = (const char*)mapping + header->indicesOffset;
+}
+
+MeshFile::~MeshFile()
+{
+	unmap();
+}
+
+void MeshFile::unmap()
+{
+#ifdef _WIN32
+	if (mapping)
+		UnmapViewOfFile(mapping);
+	if (fileMapping)
+		CloseHandle(fileMapping);
+	if (file && file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	file = fileMapping = nullptr;
+#else
+	if (mapping)
+		munmap(mapping, size);
+#endif
+	mapping = nullptr;
+}
+
+
+Vecd<3> MeshFile::getPosition(const MeshFormat::Vertex& vertex) const
+{
+	return {
+		dequantize(vertex.position[0], header->boundsMin[0], header->boundsMax[0]),
+		dequantize(vertex.position[1], header->boundsMin[1], header->boundsMax[1]),
+		dequantize(vertex.position[2], header->boundsMin[2], header->boundsMax[2])
+	};
+}
+
+Vecd<3> MeshFile::getNormal(const MeshFormat::Vertex& vertex) const
+{
+	// Unfolds the lower half back
+	double x = vertex.normal[0] / 32767.0, y = vertex.normal[1] / 32767.0;
+	double z = 1.0 - std::abs(x) - std::abs(y);
+	double fold = std::max(-z, 0.0);
+	x += x >= 0.0 ? -fold : fold;
+	y += y >= 0.0 ? -fold : fold;
+
+	double length = std::sqrt(x * x + y * y + z * z);
+	return { x / length, y / length, z / length };
+}
+
+Vecd<4> MeshFile::getTexCoords(const MeshFormat::Vertex& vertex) const
+{
+	return {
+		dequantize(vertex.uv[0], header->uvMin[0], header->uvMax[0]),
+		dequantize(vertex.uv[1], header->uvMin[1], header->uvMax[1]),
+		0.0, 1.0
+	};
+}
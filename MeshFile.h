@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#include "Vecd.h"
+
+
+// Binary mesh written by the OBJ importer and mapped as is at runtime, nothing is parsed on load
+//
+// File is a Header, then verticesCount Vertex, then indicesCount indices of indexSize bytes (host byte order)
+// Triangles are ordered for a 16 entry vertex cache and vertices are stored in the order triangles first use them
+namespace MeshFormat
+{
+	constexpr char magic[4]{ 'C', 'S', 'M', 'B' };
+	constexpr uint32_t version = 1;
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t verticesCount;
+		uint32_t indicesCount;		// Three per triangle
+		uint32_t indexSize;			// 2 if every vertex fits uint16, else 4
+		uint32_t reserved;
+		float boundsMin[3];			// Positions are quantized over the bounds
+		float boundsMax[3];
+		float uvMin[2];				// Texture coords are quantized over these
+		float uvMax[2];
+		uint64_t verticesOffset;	// From the start of the file
+		uint64_t indicesOffset;
+	};
+
+	// 16 bytes
+	struct Vertex
+	{
+		uint16_t position[3];	// 0 - boundsMin, 65535 - boundsMax
+		int16_t normal[2];		// Octahedral, -32767 - -1.0, 32767 - 1.0
+		uint16_t uv[2];			// 0 - uvMin, 65535 - uvMax
+		uint16_t padding;
+	};
+
+	static_assert(sizeof(Header) == 80, "Header layout is the file layout");
+	static_assert(sizeof(Vertex) == 16, "Vertex layout is the file layout");
+}
+
+
+// Read only mapping of a binary mesh, the buffers point straight into the file
+class MeshFile
+{
+public:
+	struct ImportStats
+	{
+		size_t vertices = 0;		// After welding equal position, normal and texture coord triples
+		size_t triangles = 0;		// After fanning polygons
+		double acmrBefore = 0.0;	// Vertices transformed per triangle by a 16 entry FIFO cache, source order
+		double acmrAfter = 0.0;		// Same with the optimized order
+	};
+
+	/// @brief Converts an OBJ (v, vt, vn and f with polygons and negative indices) into the binary format
+	/// Missing normals are averaged from the faces around a position, missing texture coords are 0
+	static ImportStats importObj(const char* objPath, const char* meshPath);
+
+	/// @brief Maps the file and checks the header and sizes, indices are trusted to be in range (importer writes them)
+	MeshFile(const char* path);
+	~MeshFile();
+
+	MeshFile(const MeshFile&) = delete;
+	MeshFile& operator=(const MeshFile&) = delete;
+
+	const MeshFormat::Header& getHeader() const		{ return *header; }
+	const MeshFormat::Vertex* getVertices() const	{ return vertices; }
+	size_t getVerticesCount() const					{ return header->verticesCount; }
+	size_t getTrianglesCount() const				{ return header->indicesCount / 3; }
+
+	uint32_t getIndex(size_t id) const
+	{
+		return header->indexSize == 2 ? ((const uint16_t*)indices)[id] : ((const uint32_t*)indices)[id];
+	}
+
+	Vecd<3> getBoundsMin() const	{ return { header->boundsMin[0], header->boundsMin[1], header->boundsMin[2] }; }
+	Vecd<3> getBoundsMax() const	{ return { header->boundsMax[0], header->boundsMax[1], header->boundsMax[2] }; }
+
+	Vecd<3> getPosition(const MeshFormat::Vertex& vertex) const;
+	Vecd<3> getNormal(const MeshFormat::Vertex& vertex) const;
+	Vecd<4> getTexCoords(const MeshFormat::Vertex& vertex) const; // u, v, 0, 1
+
+private:
+	const MeshFormat::Header* header = nullptr;
+	const MeshFormat::Vertex* vertices = nullptr;
+	const void* indices = nullptr;
+
+	void* mapping = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr;		// HANDLE
+	void* fileMapping = nullptr;
+#endif
+
+	void unmap();
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "Physics.h"
 
 
@@ -17,12 +19,23 @@ void Simulator::computeForcesAndTorques(int stateId)
 	for (auto& torque : applicableTorques)
 		conf[stateId].sumTorque = conf[stateId].sumTorque + torque;
 
-	applicableForces.clear();
-	applicableTorques.clear();
+	// Registered generators, from the state this substep starts at
+	auto& state = conf[stateId];
+	BodyStateView view;
+	for (int i(0); i < 3; ++i)
+	{
+		view.pos[i] = &state.pos[i];
+		view.linearVel[i] = &state.linearVel[i];
+		view.angularVel[i] = &state.angularVel[i];
+		for (int j(0); j < 3; ++j)
+			view.orient[i][j] = &state.orientMat[i][j];
+	}
+	view.invMass = &invMass;
 
-	// Little dumping
-	conf[stateId].sumForce = conf[stateId].sumForce + (-coefs.noKdl * conf[stateId].linearVel);
-	conf[stateId].sumTorque = conf[stateId].sumTorque + (-coefs.noKda * conf[stateId].angularVel);
+	forceGenerators.evaluate(view, 0, 1, BodyForceView{
+		{ &state.sumForce[0], &state.sumForce[1], &state.sumForce[2] },
+		{ &state.sumTorque[0], &state.sumTorque[1], &state.sumTorque[2] }
+	});
 }
 
 
@@ -37,23 +50,97 @@ template<unsigned N, unsigned M> Matd<N, M> Simulator::star(const Vecd<N>& vec)
 }
 
 
+Simulator::Derivative Simulator::derive(const PhysicsConfig& state, const Vecd<3>& force, const Vecd<3>& torque) const
+{
+	Derivative deriv;
+	deriv.linearVel = state.linearVel;
+	deriv.spin = spin(state.orient, state.angularVel);
+
+	// Little dumping
+	deriv.linearAcc = invMass * (force + (-coefs.noKdl * state.linearVel));
+	deriv.torque = torque + (-coefs.noKda * state.angularVel);
+	return deriv;
+}
+
+
+void Simulator::integrate(const PhysicsConfig& from, const Derivative& deriv, double dTime, PhysicsConfig& to) const
+{
+	to.pos = from.pos + (deriv.linearVel * dTime);
+	to.orient = normalize(from.orient + deriv.spin * dTime);
+	to.linearVel = from.linearVel + (deriv.linearAcc * dTime);
+	to.angularMomentum = from.angularMomentum + (deriv.torque * dTime);
+
+	// Auxiliary //
+	to.orientMat = to.orient.toMatrix();
+	to.angularVel = angularVelocity(to.orientMat, to.angularMomentum);
+}
+
+
+Vecd<3> Simulator::angularVelocity(Matd<3, 3> orientMat, const Vecd<3>& angularMomentum) const
+{
+	// R * IbodyInv * Rt * L as three matrix-vector products, world space Iinv is not needed for that
+	Matd<3, 3> bodyInertia(IbodyInv);
+	return orientMat * (bodyInertia * (transpose(orientMat) * angularMomentum));
+}
+
+
+void Simulator::updateInertia(int stateId)
+{
+	auto& state = conf[stateId];
+	state.Iinv = state.orientMat * IbodyInv * transpose(state.orientMat);
+}
+
+
 void Simulator::ode(double dTime)
 {
 	auto& source = conf[SourceStateId];
 	auto& target = conf[TargetStateId];
 
-	target.pos = source.pos + (source.linearVel * dTime);
-
-	target.rotMatDot = star<3, 3>(source.angularVel) * source.orientMat;
-	target.orientMat = source.orientMat + (target.rotMatDot * dTime);
-	target.orientMat.orthonormalize3D();
+	switch (integrator)
+	{
+	case Integrator::EXPLICIT_EULER:
+		integrate(source, derive(source, source.sumForce, source.sumTorque), dTime, target);
+		break;
 
-	target.linearVel = source.linearVel + (dTime * invMass) * source.sumForce;
-	target.angularMomentum = source.angularMomentum + (source.sumTorque * dTime);
+	case Integrator::SYMPLECTIC_EULER:
+	{
+		Derivative deriv = derive(source, source.sumForce, source.sumTorque);
+		target.linearVel = source.linearVel + (deriv.linearAcc * dTime);
+		target.angularMomentum = source.angularMomentum + (deriv.torque * dTime);
+
+		// Moving with the new velocities, rotation through the halfway orientation, so a free tumble keeps its energy
+		target.pos = source.pos + (target.linearVel * dTime);
+		Vecd<3> angularVel = angularVelocity(source.orientMat, target.angularMomentum);
+		Quatd halfway = normalize(source.orient + spin(source.orient, angularVel) * (0.5 * dTime));
+		angularVel = angularVelocity(halfway.toMatrix(), target.angularMomentum);
+		target.orient = normalize(source.orient + spin(halfway, angularVel) * dTime);
+
+		target.orientMat = target.orient.toMatrix();
+		target.angularVel = angularVelocity(target.orientMat, target.angularMomentum);
+		break;
+	}
 
-	// Auxiliary //
-	target.Iinv = target.orientMat * IbodyInv * transpose(target.orientMat);
-	target.angularVel = target.Iinv * target.angularMomentum;
+	case Integrator::RK4:
+	{
+		// Applied and generator forces are taken at the step start, damping at every midpoint
+		PhysicsConfig midpoint;
+		Derivative k1 = derive(source, source.sumForce, source.sumTorque);
+		integrate(source, k1, 0.5 * dTime, midpoint);
+		Derivative k2 = derive(midpoint, source.sumForce, source.sumTorque);
+		integrate(source, k2, 0.5 * dTime, midpoint);
+		Derivative k3 = derive(midpoint, source.sumForce, source.sumTorque);
+		integrate(source, k3, dTime, midpoint);
+		Derivative k4 = derive(midpoint, source.sumForce, source.sumTorque);
+
+		Derivative deriv;
+		deriv.linearVel = (k1.linearVel + 2.0 * (k2.linearVel + k3.linearVel) + k4.linearVel) / 6.0;
+		deriv.spin = (k1.spin + 2.0 * (k2.spin + k3.spin) + k4.spin) * (1.0 / 6.0);
+		deriv.linearAcc = (k1.linearAcc + 2.0 * (k2.linearAcc + k3.linearAcc) + k4.linearAcc) / 6.0;
+		deriv.torque = (k1.torque + 2.0 * (k2.torque + k3.torque) + k4.torque) / 6.0;
+		integrate(source, deriv, dTime, target);
+		break;
+	}
+	}
 }
 
 
@@ -71,72 +158,187 @@ Collision::Type Simulator::checkCollisions(int stateId)
 	for (int vId(0); (vId < 3) && (coll.state != Collision::Type::PENETRATING); ++vId)
 	{
 		Vecd<3> vertPos = conf[stateId].vertices[vId];
-		Vecd<3> U = vertPos - conf[stateId].pos;
+		Floor plane = supportPlane(vertPos);
+		if (dot(vertPos, plane.normal) + plane.d < -coefs.colDepthEpsilon)
+			coll.state = Collision::Type::PENETRATING;
+	}
 
-		Vecd<3> fullVel = conf[stateId].linearVel + cross(conf[stateId].angularVel, U);
+	return coll.state;
+}
 
-		double wallDist = dot(vertPos, aFloor.normal) + aFloor.d;
-		if (wallDist < -coefs.colDepthEpsilon)
-		{
-			coll.state = Collision::Type::PENETRATING;
-		}
-		else if (wallDist < coefs.colDepthEpsilon)
+
+void Simulator::solveContacts(int stateId)
+{
+	auto& state = conf[stateId];
+
+	// All touching vertices at once (moving apart too, they get zero impulse)
+	bool touching[3];
+	Floor planes[3];
+	for (int vId(0); vId < 3; ++vId)
+	{
+		planes[vId] = supportPlane(state.vertices[vId]);
+		touching[vId] = dot(state.vertices[vId], planes[vId].normal) + planes[vId].d < coefs.colDepthEpsilon;
+	}
+
+	if (!touching[0] && !touching[1] && !touching[2])
+	{
+		for (auto& impulse : warmImpulses)
+			impulse = {};
+		return;
+	}
+
+	updateInertia(stateId);
+	BodyVelocity vel{ invMass, state.Iinv, state.linearVel, state.angularMomentum, state.angularVel };
+	ContactSolver solver(vel, coefs);
+
+	int contactIds[3];
+	for (int vId(0); vId < 3; ++vId)
+		contactIds[vId] = touching[vId] ? solver.addContact(state.vertices[vId] - state.pos, planes[vId].normal, warmImpulses[vId]) : -1;
+
+	solver.solve();
+
+	for (int vId(0); vId < 3; ++vId)
+		warmImpulses[vId] = contactIds[vId] >= 0 ? solver.getImpulse(contactIds[vId]) : ContactImpulse{};
+
+	state.linearVel = vel.linearVel;
+	state.angularMomentum = vel.angularMomentum;
+	state.angularVel = vel.angularVel;
+}
+
+
+double Simulator::timeOfImpact(double interval) const
+{
+	// Earliest time a penetrating vertex reaches the surface, vertex paths taken as straight lines
+	const auto& source = conf[SourceStateId];
+	const auto& target = conf[TargetStateId];
+
+	double toi = interval;
+	for (int vId(0); vId < 3; ++vId)
+	{
+		Floor plane = supportPlane(target.vertices[vId]);
+		double targetDist = dot(target.vertices[vId], plane.normal) + plane.d;
+		if (targetDist >= -coefs.colDepthEpsilon)
+			continue;
+
+		double sourceDist = dot(source.vertices[vId], plane.normal) + plane.d;
+		toi = std::min(toi, interval * sourceDist / (sourceDist - targetDist));
+	}
+
+	return std::max(toi, 0.0);
+}
+
+
+void Simulator::pushOutOfFloor(int stateId)
+{
+	auto& state = conf[stateId];
+
+	// Deepest vertex first, in a corner the push may move another one in, so a couple of rounds
+	for (int round(0); round < 3; ++round)
+	{
+		double minDist = 0.0;
+		Vecd<3> normal{};
+		for (int vId(0); vId < 3; ++vId)
 		{
-			double relVel = dot(aFloor.normal, fullVel);
-			if (relVel < 0.0)
+			Floor plane = supportPlane(state.vertices[vId]);
+			double dist = dot(state.vertices[vId], plane.normal) + plane.d;
+			if (dist < minDist)
 			{
-				coll.state = Collision::Type::COLLIDING;
-				coll.normal = aFloor.normal;
-				coll.vertexIndex = vId;
+				minDist = dist;
+				normal = plane.normal;
 			}
 		}
-	}
 
-	return coll.state;
+		if (minDist >= 0.0)
+			break;
+
+		state.pos = state.pos + (-minDist * normal);
+		for (int vId(0); vId < 3; ++vId)
+			state.vertices[vId] = state.vertices[vId] + (-minDist * normal);
+	}
 }
 
 
-void Simulator::resolveCollisions(int stateId)
+void Simulator::queryEnvironment(double dTime)
 {
-	auto& state = conf[stateId];
+	if (!environment)
+		return;
+
+	const auto& state = conf[SourceStateId];
+
+	// Vertices at the step start and where their current velocity takes them, grown by rotation, gravity and contact depth
+	double maxArmSq = 0.0;
+	for (int vId(0); vId < 3; ++vId)
+		maxArmSq = std::max(maxArmSq, bodyVertices[vId].sqLength());
+	double margin = (std::sqrt(state.angularVel.sqLength() * maxArmSq) + 9.8 * dTime) * dTime + coefs.meshContactDepth;
+
+	Vecd<3> boxMin = state.vertices[0], boxMax = boxMin;
+	Vecd<3> move = state.linearVel * dTime;
+	for (int vId(0); vId < 3; ++vId)
+		for (int axis(0); axis < 3; ++axis)
+		{
+			double from = state.vertices[vId][axis], to = from + move[axis];
+			boxMin[axis] = std::min({ boxMin[axis], from, to });
+			boxMax[axis] = std::max({ boxMax[axis], from, to });
+		}
 
-	Vecd<3> R = state.vertices[coll.vertexIndex] - state.pos;
-	Vecd<3> fullVel = state.linearVel + cross(state.angularVel, R);
+	environment->query(boxMin - margin, boxMax + margin, nearbyTriangles);
+}
 
-	double reactImpulseNumerator = -(1.0 + coefs.restitutionCoef) * dot(fullVel, coll.normal);
-	double reactImpulseDenominator = invMass +
-		dot(cross(state.Iinv * cross(R, coll.normal), R), coll.normal);
-	double reactImpulseMag = (reactImpulseNumerator / reactImpulseDenominator);
-	Vecd<3> reactImpulse = reactImpulseMag * coll.normal;
 
-	// Frictions //
-	Vecd<3> tangent = normalize(fullVel);
-	double staticFrictionMag = coefs.sFric * reactImpulseMag;
-	double dynamicFrictionMag = coefs.dFric * reactImpulseMag;
-	Vecd<3> frictionImpulse;
-	if (dot(fullVel, tangent) == 0 && dot(fullVel / invMass, tangent) <= staticFrictionMag)
-		frictionImpulse = -(dot(fullVel / invMass, tangent)) * tangent;
-	else
-		frictionImpulse = -dynamicFrictionMag * tangent;
+Floor Simulator::supportPlane(const Vecd<3>& point) const
+{
+	// Floor, unless an environment triangle is closer right under the point (or the point is a bit behind it)
+	Floor plane = aFloor;
+	double dist = dot(point, aFloor.normal) + aFloor.d;
 
-	reactImpulse = reactImpulse + frictionImpulse;
+	for (uint32_t triId : nearbyTriangles)
+	{
+		const auto& tri = environment->getTriangle(triId);
+		double triDist = dot(point - tri.vertices[0], tri.normal);
+		if (triDist >= dist || triDist < -coefs.meshContactDepth)
+			continue;
 
-	// Applying impulse
-	state.linearVel = state.linearVel + invMass * reactImpulse;
-	state.angularMomentum = state.angularMomentum + cross(R, reactImpulse);
+		// Projection has to be inside the triangle
+		bool inside = true;
+		for (int eId(0); eId < 3 && inside; ++eId)
+		{
+			const Vecd<3>& from = tri.vertices[eId];
+			const Vecd<3>& to = tri.vertices[(eId + 1) % 3];
+			inside = dot(cross(to - from, point - from), tri.normal) >= 0.0;
+		}
+		if (!inside)
+			continue;
 
-	// Auxilliary
-	state.angularVel = state.Iinv * state.angularMomentum;
+		dist = triDist;
+		plane.normal = tri.normal;
+		plane.d = -dot(tri.normal, tri.vertices[0]);
+	}
+
+	return plane;
 }
 
 
-Vecd<3>* Simulator::updatePhysics(const double dTime)
+void Simulator::simulate(const double dTime)
 {
+	if (!forceGenerators.getTouched().empty() || forceGenerators.isAllTouched())
+		wakeUp();
+	forceGenerators.clearTouched();
+
+	if (sleeping)
+		return;
+
 	double currentTime = 0.0;
 	double targetTime = dTime;
+	int toiSteps = 0;
+
+	// Source may have been moved by the setters since the last frame
+	updateVertices(SourceStateId);
+	queryEnvironment(dTime);
 
 	while (currentTime < dTime)
 	{
+		PROFILE_SCOPE("physics substep");
+
 		computeForcesAndTorques(SourceStateId);
 
 		ode(targetTime - currentTime);
@@ -147,35 +349,123 @@ Vecd<3>* Simulator::updatePhysics(const double dTime)
 
 		if (coll.state == Collision::Type::PENETRATING)
 		{
-			targetTime = (currentTime + targetTime) * 0.5;
-
-			// If it crashes here, impulse (resolveCollisions()) might not be able to correct collision with current restitutionCoef 
-			if (fabs(targetTime - currentTime) <= coefs.timeEpsilon)
-				throw "Interpenetrated at the start of a frame";
-
-			continue;
-		}
-
-		if (coll.state == Collision::Type::COLLIDING)
-		{
-			int counter(0);
-			do
+			// Straight to the contact time, rotation makes it approximate, so it may take a couple of tries
+			double toi = timeOfImpact(targetTime - currentTime);
+			if (toiSteps < coefs.toiIterations && toi > coefs.timeEpsilon)
 			{
-				resolveCollisions(TargetStateId);
-				counter++;
-			} while ((checkCollisions(TargetStateId) == Collision::Type::COLLIDING) && (counter < 100));
+				targetTime = currentTime + toi;
+				toiSteps++;
+				continue;
+			}
 
-			if (counter >= 100)
-				throw "Too much";
+			// Touching already at the start or out of retries, floor contact is resolved below
+			pushOutOfFloor(TargetStateId);
 		}
 
-		// No collision
+		// Resting ones too, so warm starting keeps them steady
+		solveContacts(TargetStateId);
+
 		currentTime = targetTime;
 		targetTime = dTime;
+		toiSteps = 0;
 
 		SourceStateId = SourceStateId ? 0 : 1;
 		TargetStateId = TargetStateId ? 0 : 1;
 	}
 
+	updateSleeping(dTime);
+}
+
+
+void Simulator::updateSleeping(double dTime)
+{
+	auto& state = conf[SourceStateId];
+
+	bool isStill = state.linearVel.sqLength() < coefs.sleepLinearVel * coefs.sleepLinearVel &&
+		state.angularVel.sqLength() < coefs.sleepAngularVel * coefs.sleepAngularVel;
+	stillTime = isStill ? stillTime + dTime : 0.0;
+	if (stillTime < coefs.sleepTime)
+		return;
+
+	sleeping = true;
+	state.linearVel = {};
+	state.angularMomentum = {};
+	state.angularVel = {};
+}
+
+
+Vecd<3>* Simulator::updatePhysics(const double dTime)
+{
+	simulate(dTime);
+
+	applicableForces.clear();
+	applicableTorques.clear();
+
 	return conf[SourceStateId].vertices;
+}
+
+
+//// FIXED TIMESTEP ////
+
+
+FixedTimestep::FixedTimestep(const Params& params) :
+	params(params)
+{
+	if (params.step <= 0.0)
+		throw "Step can be only > 0.0";
+	if (params.maxSteps < 1)
+		throw "At least one step per frame";
+}
+
+int FixedTimestep::advance(double frameTime)
+{
+	accumulator += frameTime;
+
+	lastSteps = int(accumulator / params.step);
+	if (lastSteps > params.maxSteps)
+	{
+		// Falling behind, the rest is lost instead of making the next frame even longer
+		droppedTime += accumulator - params.maxSteps * params.step;
+		accumulator = params.maxSteps * params.step;
+		lastSteps = params.maxSteps;
+	}
+
+	accumulator -= lastSteps * params.step;
+	return lastSteps;
+}
+
+
+Vecd<3>* Simulator::advance(double frameTime)
+{
+	int steps = timestep.advance(frameTime);
+	for (int i(0); i < steps; ++i)
+	{
+		prevPos = conf[SourceStateId].pos;
+		prevOrient = conf[SourceStateId].orient;
+		simulate(timestep.getStep());
+	}
+
+	applicableForces.clear();
+	applicableTorques.clear();
+
+	// Between the last two steps
+	double alpha = timestep.getAlpha();
+	const auto& state = conf[SourceStateId];
+	Vecd<3> pos = prevPos + alpha * (state.pos - prevPos);
+	Matd<3, 3> orientMat = nlerp(prevOrient, state.orient, alpha).toMatrix();
+
+	for (int vId(0); vId < 3; ++vId)
+		interpolatedVertices[vId] = pos + (orientMat * bodyVertices[vId]);
+
+	interpolatedPos = pos;
+	interpolatedOrient = orientMat;
+	return interpolatedVertices;
+}
+
+void Simulator::advanceAsync(double frameTime, JobSystem& jobs, JobSystem::Counter& done)
+{
+	jobs.run([this, frameTime]() {
+		PROFILE_SCOPE("physics");
+		advance(frameTime);
+	}, &done);
 }
\ No newline at end of file
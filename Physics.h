@@ -2,16 +2,22 @@
 #include <vector>
 
 #include "Logger.h"
+#include "Profiler.h"
 
 #include "Vecd.h"
 #include "Matd.h"
+#include "Quatd.h"
+#include "ContactSolver.h"
+#include "ForceGenerators.h"
+#include "StaticMesh.h"
+#include "JobSystem.h"
 
 
 struct Floor
 {
 	// Plane ax + by + cz + d = 0
 	Vecd<3> normal{ 0.0, 1.0, 0.0 };
-	double d = 0; // Always positive
+	double d = 0; // Always positive for the floor itself (environment triangles use this too)
 };
 
 struct Collision
@@ -19,24 +25,30 @@ struct Collision
 	enum class Type
 	{
 		CLEAR, // No collision
-		PENETRATING, // Inside a floor
-		COLLIDING // Right before actual physical collision
+		PENETRATING // Inside a floor (touching ones are left to solveContacts)
 	};
 
 	Type state = Type::CLEAR;
-	Vecd<3> normal{}; // Floor normal
-	int vertexIndex = 0; // Colliding vertex
 };
 
 struct Coefficients
 {
-	const double restitutionCoef = 0.2;
-	const double noKdl = 0.002;		// The no-damping linear damping factor
-	const double noKda = 0.001;		// The no-damping angular damping factor
-	const double timeEpsilon = 0.00001;
-	const double colDepthEpsilon = 0.001;
-	const double sFric = 0.5;		// Static friction
-	const double dFric = 0.3;		// Dynamic friction
+	double restitutionCoef = 0.2;
+	double noKdl = 0.002;		// The no-damping linear damping factor
+	double noKda = 0.001;		// The no-damping angular damping factor
+	double timeEpsilon = 0.00001;
+	double colDepthEpsilon = 0.001;
+	int toiIterations = 4;	// Time of impact refinements before the body is pushed out instead
+	int solverIterations = 10;	// Contact solver cap, the result is usable after any number
+	double solverTolerance = 1e-4;	// Stops earlier when impulses change less than that (N*s)
+	double warmStarting = 1.0;	// Part of the last step impulses to start from
+	double restingVel = 0.5;		// No bounce for slower hits (one step of gravity must stay below)
+	double sleepLinearVel = 0.05;	// Bodies slower than that (and sleepAngularVel)
+	double sleepAngularVel = 0.05;
+	double sleepTime = 0.5;		// for that many seconds fall asleep
+	double meshContactDepth = 0.5;	// Environment triangles hold points up to that far behind them (more than a step of motion)
+	double sFric = 0.5;		// Static friction
+	double dFric = 0.3;		// Dynamic friction
 };
 
 struct PhysicsConfig
@@ -44,28 +56,66 @@ struct PhysicsConfig
 	// States
 	Vecd<3> vertices[3]; // Only triangles
 	Vecd<3> pos{}; // Center of mass position
-	Matd<3, 3> orientMat{ Matd<3, 3>::getIdentityMatrix() }; // Triangle orientation in body space
+	Quatd orient{}; // Triangle orientation in body space, kept unit
 
 	Vecd<3> linearVel{};
 	Vecd<3> angularMomentum{};
 
 	// Derived (auxiliary)
-	Matd<3, 3> Iinv;
+	Matd<3, 3> orientMat{ Matd<3, 3>::getIdentityMatrix() }; // From orient
+	Matd<3, 3> Iinv;	// World space, only built when there are contacts
 	Vecd<3> angularVel;
-	Matd<3, 3> rotMatDot;
 
-	// Manually computed
+	// Manually computed, gravity, applied ones and generators (damping depends on the state, so it is added by the integrator)
 	Vecd<3> sumForce;
 	Vecd<3> sumTorque;
 };
 
+enum class Integrator
+{
+	EXPLICIT_EULER,		// Everything moves with the velocities from the step start
+	SYMPLECTIC_EULER,	// Velocities first, positions move with the new ones. Stays stable at larger steps
+	RK4					// Four derivative evaluations per step
+};
+
+
+// Splits frame times into equal physics steps, leftover time carries over to the next frame
+class FixedTimestep
+{
+public:
+	struct Params
+	{
+		double step = 1.0 / 120;	// Seconds
+		int maxSteps = 8;			// Per frame, time above that is dropped (no spiral of death after a hitch)
+	};
+
+	FixedTimestep(const Params& params);
+
+	/// @brief Adds frame time to the accumulator
+	/// @return Number of steps to run now
+	int advance(double frameTime);
+
+	/// @brief Part of a step left in the accumulator, 0..1, for interpolating between the last two steps
+	double getAlpha() const		{ return accumulator / params.step; }
+	double getStep() const		{ return params.step; }
+	int getLastSteps() const	{ return lastSteps; }
+	double getDroppedTime() const { return droppedTime; }
+
+private:
+	Params params;
+	double accumulator = 0.0;
+	double droppedTime = 0.0;	// Total, since construction
+	int lastSteps = 0;
+};
+
 
 // Interface pattern
 class Simulator
 {
 public:
-	Simulator(const Vecd<3> vertices[3], const Matd<3, 3> inverseBodyInertiaTensor, double mass, double floorHeight) :
-		IbodyInv(inverseBodyInertiaTensor), invMass(1.0 / mass)
+	Simulator(const Vecd<3> vertices[3], const Matd<3, 3> inverseBodyInertiaTensor, double mass, double floorHeight,
+		Integrator integrator = Integrator::EXPLICIT_EULER) :
+		IbodyInv(inverseBodyInertiaTensor), invMass(1.0 / mass), integrator(integrator)
 	{
 		for (int i(0); i < 3; ++i)
 			bodyVertices[i] = vertices[i];
@@ -76,51 +126,95 @@ public:
 		aFloor.d = floorHeight;
 	}
 
+	/// @brief Integrates exactly dTime, applied forces act during all of it
 	Vecd<3>* updatePhysics(double dTime);
 
+	/// @brief Fixed step mode, runs as many steps as frameTime covers (see setTimestep)
+	/// Applied forces act during all steps of the frame
+	/// @return Vertices interpolated between the last two steps, up to one step behind the simulation
+	Vecd<3>* advance(double frameTime);
+
+	/// @brief advance as a job, the simulator must not be touched until done reaches zero
+	/// Vertices are read with getInterpolatedVertices after that
+	void advanceAsync(double frameTime, JobSystem& jobs, JobSystem::Counter& done);
+	Vecd<3>* getInterpolatedVertices() { return interpolatedVertices; }
+	/// @brief Pose the vertices were interpolated with, body space vertices placed with it give the same values
+	Vecd<3> getInterpolatedPosition() const { return interpolatedPos; }
+	Matd<3, 3> getInterpolatedOrientation() const { return interpolatedOrient; }
+
 	// Getters&setters
 	void setFloorHeight(double floorHeight)
 	{
 		if (floorHeight < 0.0)
 			throw "Floor y can be only > 0.0";
 		aFloor.d = floorHeight;
+		wakeUp();
 	}
 
 	void setCoefficients(const Coefficients& coefs)
 	{
-		memcpy(&this->coefs, &coefs, sizeof(Coefficients));
+		this->coefs = coefs;
+	}
+
+	/// @brief Static triangles to collide with besides the floor, not owned, nullptr for none
+	void setEnvironment(const StaticMesh* mesh)
+	{
+		environment = mesh;
+		nearbyTriangles.clear();
+		wakeUp();
+	}
+
+	void setTimestep(const FixedTimestep::Params& params)
+	{
+		timestep = FixedTimestep(params);
 	}
 
 	void setCenterPos(const Vecd<3>& newPos)
 	{
+		wakeUp();
 		conf[SourceStateId].pos = newPos;
+		prevPos = newPos; // Teleport, nothing to interpolate
 	}
 	void setOrientation(Matd<3, 3> orientMat)
 	{
-		conf[SourceStateId].orientMat = orientMat;
+		wakeUp();
+		orientMat.orthonormalize3D();
+		auto& state = conf[SourceStateId];
+		state.orient = Quatd::fromMatrix(orientMat);
+		state.orientMat = state.orient.toMatrix();
+		state.angularVel = angularVelocity(state.orientMat, state.angularMomentum);
+		prevOrient = state.orient;
 	}
 
 	void setLinearVelocity(const Vecd<3>& newVel)
 	{
+		wakeUp();
 		conf[SourceStateId].linearVel = newVel;
 	}
 	void setAngularMomentum(const Vecd<3>& newMom)
 	{
-		conf[SourceStateId].angularMomentum = newMom;
+		wakeUp();
+		auto& state = conf[SourceStateId];
+		state.angularMomentum = newMom;
+		state.angularVel = angularVelocity(state.orientMat, newMom);
 	}
 
 	void applyForce(const Vecd<3>& force)
 	{
+		wakeUp();
 		applicableForces.push_back(force);
 	}
 	void applyTorque(const Vecd<3>& torque)
 	{
+		wakeUp();
 		applicableTorques.push_back(torque);
 	}
 
 
 	double getFloorHeight()				{ return aFloor.d; }
 	Coefficients& getCoefficients()		{ return coefs; }
+	ForceGenerators& getForceGenerators() { return forceGenerators; } // Body id is always 0
+	const FixedTimestep& getTimestep()	{ return timestep; }
 	const Vecd<3>& getCenterPos()		{ return conf[SourceStateId].pos; }
 	const Matd<3, 3>& getOrientation()	{ return conf[SourceStateId].orientMat; }
 	const Vecd<3>& getLinearVelocity()	{ return conf[SourceStateId].linearVel; }
@@ -128,7 +222,13 @@ public:
 	const Vecd<3>& getAngularMomentum()	{ return conf[SourceStateId].angularMomentum; }
 
 	double getInverseMass() { return invMass; }
-	Matd<3, 3>& getInverseInertiaTensor() { return conf[SourceStateId].Iinv; }
+	bool isSleeping() { return sleeping; }
+	Integrator getIntegrator() { return integrator; }
+	Matd<3, 3>& getInverseInertiaTensor()
+	{
+		updateInertia(SourceStateId);
+		return conf[SourceStateId].Iinv;
+	}
 
 private:
 	PhysicsConfig conf[2]; // Source and target states
@@ -137,21 +237,63 @@ private:
 
 	std::vector<Vecd<3>> applicableForces;
 	std::vector<Vecd<3>> applicableTorques;
+	ForceGenerators forceGenerators;
 
 	Collision coll;
+	ContactImpulse warmImpulses[3]; // Per vertex, from the last solve
 	Floor aFloor;
 	Coefficients coefs;
 
+	const StaticMesh* environment = nullptr;
+	std::vector<uint32_t> nearbyTriangles; // Under the swept box of the current step
+
 	/*const*/ Vecd<3> bodyVertices[3];
 
 	const double invMass;
 	const Matd<3, 3> IbodyInv;
+	const Integrator integrator;
+
+	// Sleeping, skipped until a setter or a force wakes it
+	bool sleeping = false;
+	double stillTime = 0.0;
+
+	// Fixed step mode
+	FixedTimestep timestep{ {} };
+	Vecd<3> prevPos{};
+	Quatd prevOrient{};
+	Vecd<3> interpolatedVertices[3];
+	Vecd<3> interpolatedPos{};
+	Matd<3, 3> interpolatedOrient = Matd<3, 3>::getIdentityMatrix();
+
+	void simulate(double dTime);
+	void updateSleeping(double dTime);
+	void wakeUp()
+	{
+		sleeping = false;
+		stillTime = 0.0;
+	}
+	// Time derivative of the state, accelerations include damping
+	struct Derivative
+	{
+		Vecd<3> linearVel;
+		Quatd spin;
+		Vecd<3> linearAcc;
+		Vecd<3> torque;
+	};
 
 	void computeForcesAndTorques(int stateId);
 	void ode(double dTime);
+	Derivative derive(const PhysicsConfig& state, const Vecd<3>& force, const Vecd<3>& torque) const;
+	void integrate(const PhysicsConfig& from, const Derivative& deriv, double dTime, PhysicsConfig& to) const;
+	Vecd<3> angularVelocity(Matd<3, 3> orientMat, const Vecd<3>& angularMomentum) const;
+	void updateInertia(int stateId);
 	void updateVertices(int stateId);
 	Collision::Type checkCollisions(int stateId);
-	void resolveCollisions(int stateId);
+	void solveContacts(int stateId);
+	double timeOfImpact(double interval) const;
+	void pushOutOfFloor(int stateId);
+	void queryEnvironment(double dTime);
+	Floor supportPlane(const Vecd<3>& point) const;
 
 	template<unsigned N, unsigned M> Matd<N, M> static star(const Vecd<N>& vec);
 };
@@ -0,0 +1,27 @@
+#pragma once
+
+// Windows builds use WinAPI as is, other platforms (headless benchmark and replay)
+// only get the few types and macros the renderer shares with it
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // std::min and std::max are used instead
+#endif
+#include <Windows.h>
+#else
+#include <cstdint>
+
+typedef unsigned char UCHAR, BYTE;
+typedef UCHAR* PUCHAR;
+typedef uint32_t COLORREF;
+typedef void* HWND;
+
+#define RGB(r, g, b) ((COLORREF)(((BYTE)(r) | ((uint32_t)((BYTE)(g)) << 8)) | (((uint32_t)(BYTE)(b)) << 16)))
+#define GetRValue(rgb) ((BYTE)(rgb))
+#define GetGValue(rgb) ((BYTE)(((uint32_t)(rgb)) >> 8))
+#define GetBValue(rgb) ((BYTE)(((uint32_t)(rgb)) >> 16))
+
+inline uint32_t _byteswap_ulong(uint32_t val)
+{
+	return __builtin_bswap32(val);
+}
+#endif
@@ -0,0 +1,118 @@
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+
+#include "Profiler.h"
+
+
+namespace
+{
+	struct ThreadRing
+	{
+		unsigned threadId;
+		std::atomic<uint64_t> head{ 0 }; // Written only by the owner thread
+		Profiler::Event events[Profiler::ringCapacity];
+	};
+
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<ThreadRing>> registry;
+	thread_local ThreadRing* localRing = nullptr;
+
+	const auto startTime = std::chrono::steady_clock::now();
+
+	ThreadRing* registerThread()
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		registry.push_back(std::make_unique<ThreadRing>());
+		registry.back()->threadId = (unsigned)registry.size();
+		return registry.back().get();
+	}
+
+	// Copies events that cant be overwritten while copying (a quarter of the ring is left as a margin)
+	template <class Func>
+	void forEachEvent(Func func)
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		for (auto& ring : registry)
+		{
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			const uint64_t window = Profiler::ringCapacity - Profiler::ringCapacity / 4;
+			uint64_t first = head > window ? head - window : 0;
+			for (uint64_t i(first); i < head; ++i)
+				func(ring->threadId, ring->events[i % Profiler::ringCapacity]);
+		}
+	}
+
+	double percentile(std::vector<double>& sorted, double part)
+	{
+		size_t index = (size_t)(part * (sorted.size() - 1) + 0.5);
+		return sorted[index];
+	}
+}
+
+
+uint64_t Profiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void Profiler::record(const char* name, uint64_t start, uint64_t end)
+{
+	if (!localRing)
+		localRing = registerThread();
+
+	uint64_t head = localRing->head.load(std::memory_order_relaxed);
+	localRing->events[head % ringCapacity] = Event{ name, start, end };
+	localRing->head.store(head + 1, std::memory_order_release);
+}
+
+
+std::vector<Profiler::Summary> Profiler::summarize()
+{
+	// Literals with the same text may have different addresses, so grouping is by text
+	std::map<std::string, std::vector<double>> durations;
+	forEachEvent([&durations](unsigned, const Event& event) {
+		durations[event.name].push_back(1e-6 * (event.end - event.start));
+	});
+
+	std::vector<Summary> toRet;
+	for (auto& stage : durations)
+	{
+		std::sort(stage.second.begin(), stage.second.end());
+		toRet.push_back(Summary{ stage.first, stage.second.size(),
+			percentile(stage.second, 0.50), percentile(stage.second, 0.95), percentile(stage.second, 0.99) });
+	}
+	return toRet;
+}
+
+void Profiler::writeSummary(std::ostream& out)
+{
+	out << std::left << std::setw(20) << "stage" << std::setw(10) << "count"
+		<< std::setw(12) << "p50 ms" << std::setw(12) << "p95 ms" << std::setw(12) << "p99 ms" << std::endl;
+	for (auto& stage : summarize())
+		out << std::left << std::setw(20) << stage.name << std::setw(10) << stage.count
+			<< std::setw(12) << stage.p50 << std::setw(12) << stage.p95 << std::setw(12) << stage.p99 << std::endl;
+}
+
+
+void Profiler::exportChromeTrace(const char* path)
+{
+	std::ofstream file(path);
+	if (!file)
+		throw "Cant open trace file";
+
+	file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+	bool first(true);
+	forEachEvent([&file, &first](unsigned threadId, const Event& event) {
+		file << (first ? "\n" : ",\n")
+			<< "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+			<< ",\"ts\":" << 1e-3 * event.start << ",\"dur\":" << 1e-3 * (event.end - event.start) << "}";
+		first = false;
+	});
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+
+
+// Scoped frame timers, compiled in only with CODESOUL_PROFILE (Debug configurations define it)
+// Names must be string literals, only the pointer is stored
+#ifdef CODESOUL_PROFILE
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
+
+
+class Profiler
+{
+public:
+	struct Event
+	{
+		const char* name;
+		uint64_t start;	// Nanoseconds since the first profiled event
+		uint64_t end;
+	};
+
+	struct Summary
+	{
+		std::string name;
+		size_t count;
+		double p50, p95, p99; // Milliseconds
+	};
+
+	// Every thread writes into its own ring of this many events
+	static constexpr size_t ringCapacity = 1 << 14;
+
+	static uint64_t now();
+
+	/// @brief Lock-free for the calling thread (its ring is registered once on the first call)
+	static void record(const char* name, uint64_t start, uint64_t end);
+
+	/// @brief Percentiles over the events still in the rings, so over a rolling window
+	static std::vector<Summary> summarize();
+	static void writeSummary(std::ostream& out);
+
+	/// @brief Writes every event still in the rings as chrome://tracing JSON
+	static void exportChromeTrace(const char* path);
+};
+
+
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name) : m_name(name), m_start(Profiler::now()) {}
+	~ProfileScope() { Profiler::record(m_name, m_start, Profiler::now()); }
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* m_name;
+	uint64_t m_start;
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cmath>
+
+#include "Vecd.h"
+#include "Matd.h"
+
+
+// w + xi + yj + zk, orientations are unit ones
+class Quatd
+{
+	double value[4]{ 1.0, 0.0, 0.0, 0.0 }; // w, x, y, z
+
+public:
+	Quatd() {};
+	Quatd(double w, double x, double y, double z) :
+		value{ w, x, y, z }
+	{}
+
+	// Rotation matrix has to be orthonormal
+	static Quatd fromMatrix(const Matd<3, 3>& mat)
+	{
+		// Largest of the four first, the others are divided by it
+		double trace = mat[0][0] + mat[1][1] + mat[2][2];
+		if (trace > 0.0)
+		{
+			double s = 0.5 / std::sqrt(trace + 1.0);
+			return Quatd{ 0.25 / s, (mat[2][1] - mat[1][2]) * s, (mat[0][2] - mat[2][0]) * s, (mat[1][0] - mat[0][1]) * s };
+		}
+		if (mat[0][0] > mat[1][1] && mat[0][0] > mat[2][2])
+		{
+			double s = 2.0 * std::sqrt(1.0 + mat[0][0] - mat[1][1] - mat[2][2]);
+			return Quatd{ (mat[2][1] - mat[1][2]) / s, 0.25 * s, (mat[0][1] + mat[1][0]) / s, (mat[0][2] + mat[2][0]) / s };
+		}
+		if (mat[1][1] > mat[2][2])
+		{
+			double s = 2.0 * std::sqrt(1.0 + mat[1][1] - mat[0][0] - mat[2][2]);
+			return Quatd{ (mat[0][2] - mat[2][0]) / s, (mat[0][1] + mat[1][0]) / s, 0.25 * s, (mat[1][2] + mat[2][1]) / s };
+		}
+		double s = 2.0 * std::sqrt(1.0 + mat[2][2] - mat[0][0] - mat[1][1]);
+		return Quatd{ (mat[1][0] - mat[0][1]) / s, (mat[0][2] + mat[2][0]) / s, (mat[1][2] + mat[2][1]) / s, 0.25 * s };
+	}
+
+
+	double& w() { return value[0]; }
+	double w() const { return value[0]; }
+	double& x() { return value[1]; }
+	double x() const { return value[1]; }
+	double& y() { return value[2]; }
+	double y() const { return value[2]; }
+	double& z() { return value[3]; }
+	double z() const { return value[3]; }
+
+	double sqLength() const
+	{
+		return value[0] * value[0] + value[1] * value[1] + value[2] * value[2] + value[3] * value[3];
+	}
+
+	Quatd operator+(const Quatd& other) const
+	{
+		return Quatd{ w() + other.w(), x() + other.x(), y() + other.y(), z() + other.z() };
+	}
+	Quatd operator*(double val) const
+	{
+		return Quatd{ w() * val, x() * val, y() * val, z() * val };
+	}
+
+	// Hamilton product, rotation by other first, then by this
+	Quatd operator*(const Quatd& other) const
+	{
+		return Quatd{
+			w() * other.w() - x() * other.x() - y() * other.y() - z() * other.z(),
+			w() * other.x() + x() * other.w() + y() * other.z() - z() * other.y(),
+			w() * other.y() - x() * other.z() + y() * other.w() + z() * other.x(),
+			w() * other.z() + x() * other.y() - y() * other.x() + z() * other.w()
+		};
+	}
+
+	// Unit quaternion only, always orthonormal
+	Matd<3, 3> toMatrix() const
+	{
+		double xx = x() * x(), yy = y() * y(), zz = z() * z();
+		double xy = x() * y(), xz = x() * z(), yz = y() * z();
+		double wx = w() * x(), wy = w() * y(), wz = w() * z();
+
+		return Matd<3, 3>{
+			{ 1.0 - 2.0 * (yy + zz), 2.0 * (xy - wz), 2.0 * (xz + wy) },
+			{ 2.0 * (xy + wz), 1.0 - 2.0 * (xx + zz), 2.0 * (yz - wx) },
+			{ 2.0 * (xz - wy), 2.0 * (yz + wx), 1.0 - 2.0 * (xx + yy) }
+		};
+	}
+};
+
+
+//// OUTER CLASS FUNCTIONS ////
+
+
+inline Quatd operator*(double val, const Quatd& quat)
+{
+	return quat * val;
+}
+
+inline double dot(const Quatd& first, const Quatd& second)
+{
+	return first.w() * second.w() + first.x() * second.x() + first.y() * second.y() + first.z() * second.z();
+}
+
+inline Quatd normalize(const Quatd& quat)
+{
+	double squaredLen = quat.sqLength();
+	if (squaredLen <= 0.0)
+		return Quatd{};
+	return quat * (1.0 / std::sqrt(squaredLen));
+}
+
+// Time derivative of an orientation rotating with angularVel (world space)
+inline Quatd spin(const Quatd& orient, const Vecd<3>& angularVel)
+{
+	return 0.5 * (Quatd{ 0.0, angularVel.x(), angularVel.y(), angularVel.z() } * orient);
+}
+
+// Normalized lerp along the shorter arc, close enough to slerp for small angles
+inline Quatd nlerp(const Quatd& from, const Quatd& to, double t)
+{
+	double sign = dot(from, to) < 0.0 ? -1.0 : 1.0;
+	return normalize(from * (1.0 - t) + to * (sign * t));
+}
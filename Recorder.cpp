@@ -0,0 +1,151 @@
+#include <cstring>
+
+#include "Recorder.h"
+
+
+InputRecorder::InputRecorder(const char* path)
+	: m_file(path, std::ios::binary)
+{
+	if (!m_file)
+		throw "Cant open input log for writing";
+
+	m_file.write(InputLog::magic, sizeof(InputLog::magic));
+	write(InputLog::version);
+}
+
+void InputRecorder::beginFrame(double time, double dTime)
+{
+	write(InputLog::Record::Frame);
+	write(time);
+	write(dTime);
+}
+
+void InputRecorder::recordInput(const Camera::InputState& input)
+{
+	write(InputLog::Record::Input);
+	write(input.keys);
+	write(input.mouseDx);
+	write(input.mouseDy);
+}
+
+void InputRecorder::recordKey(long keyId, bool isPressed)
+{
+	write(InputLog::Record::Key);
+	write((int32_t)keyId);
+	write((uint8_t)isPressed);
+}
+
+void InputRecorder::recordForce(const Vecd<3>& force, const Vecd<3>& torque)
+{
+	write(InputLog::Record::Force);
+	writeVec(force);
+	writeVec(torque);
+}
+
+void InputRecorder::recordTeleport(const Vecd<3>& pos)
+{
+	write(InputLog::Record::Teleport);
+	writeVec(pos);
+}
+
+void InputRecorder::recordSpring(bool active, const Vecd<3>& anchor)
+{
+	write(InputLog::Record::Spring);
+	write((uint8_t)active);
+	writeVec(anchor);
+}
+
+void InputRecorder::writeVec(const Vecd<3>& vec)
+{
+	for (int i(0); i < 3; ++i)
+		write(vec[i]);
+}
+
+
+
+InputReplay::InputReplay(const char* path)
+	: m_file(path, std::ios::binary)
+{
+	if (!m_file)
+		throw "Cant open input log";
+
+	char magic[sizeof(InputLog::magic)];
+	if (!m_file.read(magic, sizeof(magic)) || memcmp(magic, InputLog::magic, sizeof(magic)))
+		throw "Not an input log";
+	uint32_t version = read<uint32_t>();
+	if (version < 1 || version > InputLog::version)
+		throw "Unsupported input log version";
+}
+
+bool InputReplay::nextFrame(Frame& frame)
+{
+	frame = Frame{};
+
+	// The frame record was already consumed while looking for the end of the previous frame
+	if (!m_hasPendingFrame)
+	{
+		InputLog::Record type;
+		if (!m_file.read((char*)&type, sizeof(type)))
+			return false;
+		if (type != InputLog::Record::Frame)
+			throw "Input log doesnt start with a frame";
+	}
+	frame.time = read<double>();
+	frame.dTime = read<double>();
+	m_hasPendingFrame = false;
+
+	InputLog::Record type;
+	while (m_file.read((char*)&type, sizeof(type)))
+	{
+		switch (type)
+		{
+		case InputLog::Record::Frame:
+			m_hasPendingFrame = true;
+			return true;
+
+		case InputLog::Record::Input:
+			frame.input.keys = read<uint8_t>();
+			frame.input.mouseDx = read<float>();
+			frame.input.mouseDy = read<float>();
+			break;
+
+		case InputLog::Record::Key:
+		{
+			long keyId = read<int32_t>();
+			frame.keys.push_back({ keyId, read<uint8_t>() != 0 });
+			break;
+		}
+
+		case InputLog::Record::Force:
+		{
+			Vecd<3> force = readVec();
+			frame.forces.push_back(Force{ force, readVec() });
+			break;
+		}
+
+		case InputLog::Record::Teleport:
+			frame.teleports.push_back(readVec());
+			break;
+
+		case InputLog::Record::Spring:
+		{
+			bool active = read<uint8_t>() != 0;
+			frame.springs.push_back(Spring{ active, readVec() });
+			break;
+		}
+
+		default:
+			throw "Unknown record in input log";
+		}
+	}
+
+	return true;
+}
+
+Vecd<3> InputReplay::readVec()
+{
+	Vecd<3> toRet;
+	for (int i(0); i < 3; ++i)
+		toRet[i] = read<double>();
+	return toRet;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include <utility>
+
+#include "Camera.h"
+#include "Vecd.h"
+
+
+// Binary log of everything that makes a frame differ from run to run:
+// frame times, camera input, custom keys and forces applied to the simulation
+//
+// File is "CSIR" + uint32 version, then records of uint8 type + payload (host byte order)
+namespace InputLog
+{
+	constexpr char magic[4]{ 'C', 'S', 'I', 'R' };
+	constexpr uint32_t version = 2; // 1 has no spring records, still readable
+
+	enum class Record : uint8_t
+	{
+		Frame = 1,		// double time, double dTime (starts a frame)
+		Input = 2,		// uint8 keys, float mouseDx, float mouseDy
+		Key = 3,		// int32 keyId, uint8 pressed
+		Force = 4,		// double force[3], double torque[3]
+		Teleport = 5,	// double pos[3]
+		Spring = 6		// uint8 active, double anchor[3]
+	};
+}
+
+
+class InputRecorder
+{
+public:
+	InputRecorder(const char* path);
+
+	void beginFrame(double time, double dTime);
+	void recordInput(const Camera::InputState& input);
+	void recordKey(long keyId, bool isPressed);
+	void recordForce(const Vecd<3>& force, const Vecd<3>& torque);
+	void recordTeleport(const Vecd<3>& pos);
+	void recordSpring(bool active, const Vecd<3>& anchor);
+
+private:
+	std::ofstream m_file;
+
+	template <class T> void write(const T& value)
+	{
+		m_file.write((const char*)&value, sizeof(T));
+	}
+	void writeVec(const Vecd<3>& vec);
+};
+
+
+class InputReplay
+{
+public:
+	struct Force
+	{
+		Vecd<3> force;
+		Vecd<3> torque;
+	};
+
+	struct Spring
+	{
+		bool active;
+		Vecd<3> anchor;
+	};
+
+	// Everything recorded during one frame, in the order Main applies it
+	struct Frame
+	{
+		double time = 0.0;
+		double dTime = 0.0;
+		Camera::InputState input{};
+		std::vector<std::pair<long, bool>> keys;
+		std::vector<Force> forces;
+		std::vector<Vecd<3>> teleports;
+		std::vector<Spring> springs;
+	};
+
+	InputReplay(const char* path);
+
+	/// @return false when there are no frames left
+	bool nextFrame(Frame& frame);
+
+private:
+	std::ifstream m_file;
+	bool m_hasPendingFrame{ false };
+
+	template <class T> T read()
+	{
+		T value{};
+		if (!m_file.read((char*)&value, sizeof(T)))
+			throw "Truncated input log";
+		return value;
+	}
+	Vecd<3> readVec();
+};
@@ -0,0 +1,212 @@
+#include <algorithm>
+
+#include "RenderGraph.h"
+
+
+RenderGraph::ResourceId RenderGraph::importBuffer(const char* name, void* data, size_t bytes)
+{
+	if (!data)
+		throw "Imported buffer cant be nullptr";
+
+	resources.push_back(Resource{ name, data, bytes, false, -1, -1 });
+	compiled = false;
+	return ResourceId(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::createTransient(const char* name, size_t bytes)
+{
+	resources.push_back(Resource{ name, nullptr, bytes, true, -1, -1 });
+	compiled = false;
+	return ResourceId(resources.size() - 1);
+}
+
+RenderGraph::PassId RenderGraph::addPass(const char* name, const std::vector<Use>& uses, std::function<void()> run)
+{
+	for (const Use& use : uses)
+		if (use.resource >= resources.size())
+			throw "Pass uses an unknown buffer";
+
+	passes.push_back(Pass{ name, uses, std::move(run) });
+	compiled = false;
+	return PassId(passes.size() - 1);
+}
+
+
+void RenderGraph::compile()
+{
+	cull();
+	assignLevels();
+	allocate();
+	compiled = true;
+}
+
+void RenderGraph::cull()
+{
+	// Backwards, a buffer is needed while something later sees its current contents
+	// Imported ones are seen after the frame, transient ones are not
+	std::vector<bool> needed(resources.size());
+	for (size_t r(0); r < resources.size(); ++r)
+		needed[r] = !resources[r].transient;
+
+	for (size_t p(passes.size()); p-- > 0;)
+	{
+		Pass& pass = passes[p];
+		bool alive = false;
+		for (const Use& use : pass.uses)
+			alive |= use.access != Access::READ && needed[use.resource];
+
+		pass.level = alive ? 0 : -1;
+		if (!alive)
+			continue;
+
+		// Overwrites hide earlier contents, the other uses need them
+		for (const Use& use : pass.uses)
+			if (use.access == Access::OVERWRITE)
+				needed[use.resource] = false;
+		for (const Use& use : pass.uses)
+			if (use.access != Access::OVERWRITE)
+				needed[use.resource] = true;
+	}
+}
+
+void RenderGraph::assignLevels()
+{
+	// A pass goes after the last writer of everything it uses, and after the readers of everything it writes
+	std::vector<int> lastWriter(resources.size(), -1);
+	std::vector<std::vector<PassId>> readers(resources.size());
+
+	levels.clear();
+	for (auto& resource : resources)
+		resource.firstLevel = resource.lastLevel = -1;
+
+	for (PassId p(0); p < passes.size(); ++p)
+	{
+		Pass& pass = passes[p];
+		if (pass.level < 0)
+			continue;
+
+		int level = 0;
+		for (const Use& use : pass.uses)
+		{
+			if (lastWriter[use.resource] >= 0)
+				level = std::max(level, passes[lastWriter[use.resource]].level + 1);
+			if (use.access != Access::READ)
+				for (PassId reader : readers[use.resource])
+					level = std::max(level, passes[reader].level + 1);
+		}
+		pass.level = level;
+
+		for (const Use& use : pass.uses)
+		{
+			Resource& resource = resources[use.resource];
+			if (resource.transient && resource.firstLevel < 0 && use.access != Access::OVERWRITE)
+				throw "Transient buffer is used before it is overwritten";
+
+			if (use.access == Access::READ)
+				readers[use.resource].push_back(p);
+			else
+			{
+				lastWriter[use.resource] = int(p);
+				readers[use.resource].clear();
+			}
+
+			resource.firstLevel = resource.firstLevel < 0 ? level : std::min(resource.firstLevel, level);
+			resource.lastLevel = std::max(resource.lastLevel, level);
+		}
+
+		if (levels.size() <= size_t(level))
+			levels.resize(level + 1);
+		levels[level].push_back(p);
+	}
+}
+
+void RenderGraph::allocate()
+{
+	// Biggest buffers first among those starting at the same level, each one takes the free block closest in size
+	std::vector<ResourceId> order;
+	for (ResourceId r(0); r < resources.size(); ++r)
+	{
+		if (resources[r].transient)
+			resources[r].data = nullptr;
+		if (resources[r].transient && resources[r].firstLevel >= 0)
+			order.push_back(r);
+	}
+	std::sort(order.begin(), order.end(), [this](ResourceId a, ResourceId b) {
+		if (resources[a].firstLevel != resources[b].firstLevel)
+			return resources[a].firstLevel < resources[b].firstLevel;
+		return resources[a].bytes > resources[b].bytes;
+	});
+
+	struct Block
+	{
+		size_t bytes;
+		int freeAfter; // Last level of the buffer using it
+	};
+	std::vector<Block> assigned;
+	std::vector<size_t> blockOf(resources.size());
+
+	for (ResourceId r : order)
+	{
+		const Resource& resource = resources[r];
+		size_t best = assigned.size();
+		for (size_t b(0); b < assigned.size(); ++b)
+		{
+			if (assigned[b].freeAfter >= resource.firstLevel)
+				continue;
+
+			auto misfit = [&](size_t id) {
+				return assigned[id].bytes > resource.bytes ? assigned[id].bytes - resource.bytes : resource.bytes - assigned[id].bytes;
+			};
+			if (best == assigned.size() || misfit(b) < misfit(best))
+				best = b;
+		}
+
+		if (best == assigned.size())
+			assigned.push_back(Block{ 0, -1 });
+		assigned[best].bytes = std::max(assigned[best].bytes, resource.bytes);
+		assigned[best].freeAfter = resource.lastLevel;
+		blockOf[r] = best;
+	}
+
+	blocks.assign(assigned.size(), {});
+	for (size_t b(0); b < assigned.size(); ++b)
+		blocks[b].resize(assigned[b].bytes);
+	for (ResourceId r : order)
+		resources[r].data = blocks[blockOf[r]].data();
+}
+
+
+void RenderGraph::execute(JobSystem* jobs)
+{
+	if (!compiled)
+		throw "Render graph has to be compiled before execute";
+
+	for (const auto& level : levels)
+	{
+		if (jobs && level.size() > 1)
+			jobs->parallelFor(level.size(), 1, [&](size_t first, size_t) {
+				passes[level[first]].run();
+			});
+		else
+			for (PassId p : level)
+				passes[p].run();
+	}
+}
+
+
+size_t RenderGraph::getTransientBytes() const
+{
+	size_t bytes(0);
+	for (const auto& resource : resources)
+		if (resource.transient && resource.firstLevel >= 0)
+			bytes += resource.bytes;
+	return bytes;
+}
+
+size_t RenderGraph::getAllocatedBytes() const
+{
+	size_t bytes(0);
+	for (const auto& block : blocks)
+		bytes += block.size();
+	return bytes;
+}
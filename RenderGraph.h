@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "JobSystem.h"
+
+
+// A frame as passes that declare the buffers they read and write, added in the order they would run one by one
+// compile derives the rest: passes whose results nobody sees are dropped, passes that dont depend on each other
+// share a level and run in parallel, and transient buffers whose lifetimes dont overlap share memory
+class RenderGraph
+{
+public:
+	using ResourceId = uint32_t;
+	using PassId = uint32_t;
+
+	enum class Access
+	{
+		READ,
+		WRITE,		// Whatever is not written is kept, so earlier writes are still needed
+		OVERWRITE	// Every byte is written before it is read, earlier contents are dead
+	};
+
+	struct Use
+	{
+		ResourceId resource;
+		Access access;
+	};
+
+	/// @brief Memory owned elsewhere, its contents live across frames, so the last writes to it are always kept
+	ResourceId importBuffer(const char* name, void* data, size_t bytes);
+	/// @brief Memory owned by the graph and valid only from its first to its last use in a frame
+	/// The first use has to be OVERWRITE, the memory is shared with other transient buffers
+	ResourceId createTransient(const char* name, size_t bytes);
+
+	PassId addPass(const char* name, const std::vector<Use>& uses, std::function<void()> run);
+
+	/// @brief Culls, orders and allocates, has to be called after the last add and before execute
+	void compile();
+
+	/// @brief Runs the levels one after another, passes of a level as jobs when jobs is not nullptr
+	void execute(JobSystem* jobs);
+
+	template <class T>
+	T* getBuffer(ResourceId id) const	{ return static_cast<T*>(resources[id].data); }
+
+	bool isCulled(PassId id) const		{ return passes[id].level < 0; }
+	size_t getLevelsCount() const		{ return levels.size(); }
+	size_t getTransientBytes() const;	// Asked for by transient buffers
+	size_t getAllocatedBytes() const;	// Allocated for them, after aliasing
+
+private:
+	struct Resource
+	{
+		const char* name;
+		void* data;
+		size_t bytes;
+		bool transient;
+		int firstLevel, lastLevel; // Of the passes using it, -1 if none does
+	};
+
+	struct Pass
+	{
+		const char* name;
+		std::vector<Use> uses;
+		std::function<void()> run;
+		int level = -1; // -1 - culled
+	};
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<std::vector<PassId>> levels;
+	std::vector<std::vector<unsigned char>> blocks; // Transient memory, every block is shared by buffers that dont overlap
+	bool compiled = false;
+
+	void cull();
+	void assignLevels();
+	void allocate();
+};
@@ -0,0 +1,40 @@
+#include <cmath>
+
+#include "ResolutionScaler.h"
+
+
+ResolutionScaler::ResolutionScaler(const Params& params)
+	: m_params(params), m_scale(params.maxScale)
+{
+	if (params.minScale <= 0.0 || params.minScale > params.maxScale)
+		throw("Wrong resolution scale bounds");
+	if (params.targetFrameMs <= 0.0)
+		throw("Target frame time must be positive");
+}
+
+
+double ResolutionScaler::update(double frameMs)
+{
+	// Exponential moving average, so a single spike doesnt drop the resolution
+	const double smoothing = 0.2;
+	m_averageMs = m_averageMs > 0.0 ? m_averageMs + smoothing * (frameMs - m_averageMs) : frameMs;
+	if (m_averageMs <= 0.0)
+		return m_scale;
+
+	// Work is proportional to the pixels count, so to the squared scale
+	double desired = m_scale * sqrt(m_params.targetFrameMs / m_averageMs);
+
+	double lowest = m_scale * (1.0 - m_params.maxStep);
+	double highest = m_scale * (1.0 + m_params.maxStep);
+	desired = desired < lowest ? lowest : (desired > highest ? highest : desired);
+	desired = desired < m_params.minScale ? m_params.minScale : (desired > m_params.maxScale ? m_params.maxScale : desired);
+
+	if (fabs(desired - m_scale) < m_params.deadZone * m_scale &&
+		desired != m_params.minScale && desired != m_params.maxScale)
+		return m_scale;
+
+	// Average is expected to follow the new pixels count right away
+	m_averageMs *= (desired * desired) / (m_scale * m_scale);
+	m_scale = desired;
+	return m_scale;
+}
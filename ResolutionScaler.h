@@ -0,0 +1,31 @@
+#pragma once
+
+
+// Picks the render resolution scale from measured frame times
+class ResolutionScaler
+{
+public:
+	struct Params
+	{
+		double targetFrameMs = 16.0;	// Frame time budget for resolution dependent work
+		double minScale = 0.5;			// Of the output resolution, per axis
+		double maxScale = 1.0;
+		double deadZone = 0.05;			// Smaller scale changes are ignored, so the resolution doesnt flicker
+		double maxStep = 0.1;			// Largest relative change per frame
+	};
+
+	ResolutionScaler(const Params& params);
+
+	/// @brief Feeds the time of the last frame
+	/// @return Scale for the next frame
+	double update(double frameMs);
+
+	double getScale() const { return m_scale; }
+	double getAverageFrameMs() const { return m_averageMs; }
+	const Params& getParams() const { return m_params; }
+
+private:
+	const Params m_params;
+	double m_scale;
+	double m_averageMs{ 0.0 };
+};
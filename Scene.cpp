@@ -0,0 +1,412 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Scene.h"
+
+
+namespace
+{
+	constexpr int maxDepth = 64; // Walk stack size
+	constexpr unsigned allPlanes = (1u << 5) - 1;
+
+	void grow(Vecd<3>& boundsMin, Vecd<3>& boundsMax, const Vecd<3>& point)
+	{
+		for (int axis(0); axis < 3; ++axis)
+		{
+			boundsMin[axis] = std::min(boundsMin[axis], point[axis]);
+			boundsMax[axis] = std::max(boundsMax[axis], point[axis]);
+		}
+	}
+}
+
+
+//// FRUSTUM ////
+
+
+Frustum::Frustum(const Matd<4, 4>& viewProjection, double nearW)
+{
+	auto row = [&](int id) {
+		return Vecd<4>{ viewProjection[id][0], viewProjection[id][1], viewProjection[id][2], viewProjection[id][3] };
+	};
+
+	// -w <= x <= w, -w <= y <= w and w >= nearW
+	planes[0] = row(3) + row(0);
+	planes[1] = row(3) - row(0);
+	planes[2] = row(3) + row(1);
+	planes[3] = row(3) - row(1);
+	planes[4] = row(3) - Vecd<4>{ 0.0, 0.0, 0.0, nearW };
+
+	for (auto& plane : planes)
+	{
+		double length = std::sqrt(plane.x() * plane.x() + plane.y() * plane.y() + plane.z() * plane.z());
+		if (length <= 0.0)
+			throw "Degenerate view projection matrix";
+		plane = plane / length;
+	}
+}
+
+bool Frustum::intersect(const Vecd<3>& boundsMin, const Vecd<3>& boundsMax, unsigned& mask) const
+{
+	for (int i(0); i < 5; ++i)
+	{
+		if (!(mask & (1u << i)))
+			continue;
+
+		// Corners farthest along the normal and against it
+		const Vecd<4>& plane = planes[i];
+		Vecd<3> far, near;
+		for (int axis(0); axis < 3; ++axis)
+		{
+			far[axis] = plane[axis] >= 0.0 ? boundsMax[axis] : boundsMin[axis];
+			near[axis] = plane[axis] >= 0.0 ? boundsMin[axis] : boundsMax[axis];
+		}
+
+		if (far.x() * plane.x() + far.y() * plane.y() + far.z() * plane.z() + plane.w() < 0.0)
+			return false;
+		if (near.x() * plane.x() + near.y() * plane.y() + near.z() * plane.z() + plane.w() >= 0.0)
+			mask &= ~(1u << i);
+	}
+	return true;
+}
+
+bool Frustum::isOutside(const Vecd<3>& center, double radius, unsigned mask) const
+{
+	for (int i(0); i < 5; ++i)
+		if ((mask & (1u << i)) &&
+			center.x() * planes[i].x() + center.y() * planes[i].y() + center.z() * planes[i].z() + planes[i].w() < -radius)
+			return true;
+	return false;
+}
+
+
+//// SCENE ////
+
+
+Scene::Scene(const Params& params) :
+	params(params)
+{
+	if (params.leafSize < 1)
+		throw "Leaf size can be only > 0";
+}
+
+
+Scene::MeshId Scene::addMesh(const Mesh& mesh)
+{
+	if (mesh.vertices.empty() || mesh.vertices.size() % 3)
+		throw "Mesh vertices count can be only a non zero multiple of 3";
+	if (!mesh.perVertex.empty() && mesh.perVertex.size() != 2 * mesh.vertices.size())
+		throw "Mesh needs two per vertex values for every vertex or none";
+
+	MeshData data{ mesh, nullptr, mesh.vertices[0], mesh.vertices[0] };
+	for (const auto& vertex : mesh.vertices)
+		grow(data.boundsMin, data.boundsMax, vertex);
+
+	data.center = 0.5 * (data.boundsMin + data.boundsMax);
+	data.radius = 0.0;
+	for (const auto& vertex : mesh.vertices)
+		data.radius = std::max(data.radius, std::sqrt((vertex - data.center).sqLength()));
+
+	meshes.push_back(data);
+	return MeshId(meshes.size() - 1);
+}
+
+Scene::MeshId Scene::addMesh(const MeshFile& file, FragmentShader fragmentShader, BlendMode blendMode)
+{
+	// Bounds come from the header, vertices are not touched before they are drawn
+	MeshData data{ Mesh{ {}, {}, fragmentShader, blendMode }, &file, file.getBoundsMin(), file.getBoundsMax() };
+	data.center = 0.5 * (data.boundsMin + data.boundsMax);
+	data.radius = 0.5 * std::sqrt((data.boundsMax - data.boundsMin).sqLength());
+
+	meshes.push_back(data);
+	return MeshId(meshes.size() - 1);
+}
+
+Scene::ObjectId Scene::addObject(MeshId mesh, const Vecd<3>& position, const Matd<3, 3>& orientation)
+{
+	if (mesh >= meshes.size())
+		throw "Unknown mesh";
+
+	Object object{ mesh, position, orientation };
+	updateBounds(object);
+	objects.push_back(object);
+	isBuilt = false;
+	return ObjectId(objects.size() - 1);
+}
+
+void Scene::setTransform(ObjectId id, const Vecd<3>& position, const Matd<3, 3>& orientation)
+{
+	Object& object = objects[id];
+	object.position = position;
+	object.orientation = orientation;
+	updateBounds(object);
+
+	if (isBuilt)
+		refit(object.leaf);
+}
+
+
+void Scene::updateBounds(Object& object)
+{
+	const MeshData& data = meshes[object.mesh];
+	Matd<3, 3> orientation = object.orientation;
+
+	// Rotated box, every world axis takes the extreme of every local one (Arvo)
+	Vecd<3> localCenter = 0.5 * (data.boundsMin + data.boundsMax);
+	Vecd<3> halfSize = 0.5 * (data.boundsMax - data.boundsMin);
+	Vecd<3> center = object.position + (orientation * localCenter);
+	Vecd<3> extent;
+	for (int row(0); row < 3; ++row)
+		extent[row] = std::abs(orientation[row][0]) * halfSize[0] +
+			std::abs(orientation[row][1]) * halfSize[1] + std::abs(orientation[row][2]) * halfSize[2];
+
+	object.boundsMin = center - extent;
+	object.boundsMax = center + extent;
+	object.center = object.position + (orientation * data.center);
+}
+
+
+void Scene::rebuild()
+{
+	nodes.clear();
+	leafObjects.resize(objects.size());
+	for (ObjectId id(0); id < objects.size(); ++id)
+		leafObjects[id] = id;
+
+	if (!objects.empty())
+		build(0, objects.size(), 0, 0);
+	isBuilt = true;
+}
+
+uint32_t Scene::build(size_t first, size_t last, uint32_t parent, int level)
+{
+	const uint32_t id = uint32_t(nodes.size());
+	nodes.push_back(Node{ objects[leafObjects[first]].boundsMin, objects[leafObjects[first]].boundsMax, 0, 0, parent });
+
+	Vecd<3> centroidMin = objects[leafObjects[first]].center, centroidMax = centroidMin;
+	for (size_t i(first); i < last; ++i)
+	{
+		const Object& object = objects[leafObjects[i]];
+		grow(nodes[id].boundsMin, nodes[id].boundsMax, object.boundsMin);
+		grow(nodes[id].boundsMin, nodes[id].boundsMax, object.boundsMax);
+		grow(centroidMin, centroidMax, object.center);
+	}
+
+	// Few objects or too deep for the walk stack
+	if (last - first <= size_t(params.leafSize) || level >= maxDepth - 1)
+	{
+		nodes[id].offset = uint32_t(first);
+		nodes[id].count = uint32_t(last - first);
+		for (size_t i(first); i < last; ++i)
+			objects[leafObjects[i]].leaf = id;
+		return id;
+	}
+
+	// Median along the longest axis of the centers, objects are many and cheap to test, so no SAH
+	Vecd<3> size = centroidMax - centroidMin;
+	int axis = size.x() >= size.y() && size.x() >= size.z() ? 0 : (size.y() >= size.z() ? 1 : 2);
+	size_t mid = (first + last) / 2;
+	std::nth_element(leafObjects.begin() + first, leafObjects.begin() + mid, leafObjects.begin() + last, [&](ObjectId a, ObjectId b) {
+		return objects[a].center[axis] < objects[b].center[axis];
+	});
+
+	build(first, mid, id, level + 1);
+	nodes[id].offset = build(mid, last, id, level + 1);
+	return id;
+}
+
+void Scene::refit(uint32_t node)
+{
+	while (true)
+	{
+		Node& current = nodes[node];
+		if (current.count)
+		{
+			current.boundsMin = objects[leafObjects[current.offset]].boundsMin;
+			current.boundsMax = objects[leafObjects[current.offset]].boundsMax;
+			for (uint32_t i(current.offset); i < current.offset + current.count; ++i)
+			{
+				grow(current.boundsMin, current.boundsMax, objects[leafObjects[i]].boundsMin);
+				grow(current.boundsMin, current.boundsMax, objects[leafObjects[i]].boundsMax);
+			}
+		}
+		else
+		{
+			const Node& left = nodes[node + 1];
+			const Node& right = nodes[current.offset];
+			current.boundsMin = left.boundsMin;
+			current.boundsMax = left.boundsMax;
+			grow(current.boundsMin, current.boundsMax, right.boundsMin);
+			grow(current.boundsMin, current.boundsMax, right.boundsMax);
+		}
+
+		if (node == 0)
+			break;
+		node = current.parent;
+	}
+}
+
+
+size_t Scene::collectVisible(const Frustum& frustum, std::vector<ObjectId>& out)
+{
+	out.clear();
+	if (!isBuilt)
+		rebuild();
+	if (nodes.empty())
+		return 0;
+
+	// Planes the node is fully inside of are dropped from the mask, with none left the whole subtree is visible
+	struct Entry
+	{
+		uint32_t node;
+		unsigned mask;
+	};
+	Entry stack[maxDepth];
+	int stackSize(0);
+	size_t visited(0);
+	stack[stackSize++] = Entry{ 0, allPlanes };
+
+	while (stackSize)
+	{
+		Entry entry = stack[--stackSize];
+		const Node& node = nodes[entry.node];
+		visited++;
+
+		if (entry.mask && !frustum.intersect(node.boundsMin, node.boundsMax, entry.mask))
+			continue;
+
+		if (!node.count)
+		{
+			stack[stackSize++] = Entry{ node.offset, entry.mask };
+			stack[stackSize++] = Entry{ entry.node + 1, entry.mask };
+			continue;
+		}
+
+		for (uint32_t i(node.offset); i < node.offset + node.count; ++i)
+		{
+			const Object& object = objects[leafObjects[i]];
+			unsigned mask = entry.mask;
+			if (mask && (frustum.isOutside(object.center, meshes[object.mesh].radius, mask) ||
+				!frustum.intersect(object.boundsMin, object.boundsMax, mask)))
+				continue;
+			out.push_back(leafObjects[i]);
+		}
+	}
+
+	// Drawing order stays the adding order, whatever the hierarchy looks like
+	std::sort(out.begin(), out.end());
+	return visited;
+}
+
+
+Scene::DrawStats Scene::draw(Canvas& canvas, const Matd<4, 4>& view, const Matd<4, 4>& projection)
+{
+	DrawStats stats;
+	Matd<4, 4> viewMat = view, projMat = projection;
+
+	{
+		PROFILE_SCOPE("cull");
+		stats.nodesVisited = collectVisible(Frustum(projMat * viewMat, canvas.getNearW()), visible);
+		stats.visibleObjects = visible.size();
+	}
+
+	PROFILE_SCOPE("transform");
+	Matd<4, 4> viewProjection = projMat * viewMat;
+	blended.clear();
+	for (ObjectId id : visible)
+	{
+		const Object& object = objects[id];
+		if (meshes[object.mesh].mesh.blendMode == BlendMode::NONE)
+			drawObject(canvas, object, viewProjection, stats);
+		else
+			blended.emplace_back((viewProjection * Vecd<4>{ object.center.x(), object.center.y(), object.center.z(), 1.0 }).w(), id);
+	}
+
+	// Farthest first, each blends over what is behind it, equal depths keep the adding order
+	std::sort(blended.begin(), blended.end(), [](const std::pair<double, ObjectId>& a, const std::pair<double, ObjectId>& b) {
+		return a.first != b.first ? a.first > b.first : a.second < b.second;
+	});
+	for (const auto& entry : blended)
+		drawObject(canvas, objects[entry.second], viewProjection, stats);
+	stats.blendedObjects = blended.size();
+
+	return stats;
+}
+
+void Scene::drawObject(Canvas& canvas, const Object& object, const Matd<4, 4>& viewProjection, DrawStats& stats)
+{
+	if (meshes[object.mesh].file)
+	{
+		drawFile(canvas, object, viewProjection, stats);
+		return;
+	}
+
+	const Mesh& mesh = meshes[object.mesh].mesh;
+	Matd<4, 4> matrix = viewProjection;
+	Matd<3, 3> orientation = object.orientation;
+
+	for (size_t first(0); first < mesh.vertices.size(); first += 3)
+	{
+		Vecd<4> clip[3];
+		for (int i(0); i < 3; ++i)
+		{
+			Vecd<3> world = object.position + (orientation * mesh.vertices[first + i]);
+			clip[i] = matrix * Vecd<4>{ world.x(), world.y(), world.z(), 1.0 };
+		}
+
+		auto triangle = new Triangle<4>(clip);
+		if (mesh.fragmentShader)
+			triangle->setFragmentShader(mesh.fragmentShader);
+		triangle->setBlendMode(mesh.blendMode);
+		if (!mesh.perVertex.empty())
+		{
+			Vecd<4> perVertex[3][2];
+			for (int i(0); i < 3; ++i)
+			{
+				perVertex[i][0] = mesh.perVertex[2 * (first + i)];
+				perVertex[i][1] = mesh.perVertex[2 * (first + i) + 1];
+			}
+			triangle->setPerVertexInfo(perVertex);
+		}
+		canvas.addFigure(triangle);
+		stats.triangles++;
+	}
+}
+
+void Scene::drawFile(Canvas& canvas, const Object& object, const Matd<4, 4>& viewProjection, DrawStats& stats)
+{
+	const MeshFile& file = *meshes[object.mesh].file;
+	const MeshFormat::Vertex* vertices = file.getVertices();
+	Matd<4, 4> matrix = viewProjection;
+	Matd<3, 3> orientation = object.orientation;
+
+	// Indexed, so every vertex is decoded and transformed once and triangles only gather
+	clipVertices.resize(file.getVerticesCount());
+	fileVertexInfo.resize(2 * file.getVerticesCount());
+	for (size_t v(0); v < clipVertices.size(); ++v)
+	{
+		Vecd<3> world = object.position + (orientation * file.getPosition(vertices[v]));
+		clipVertices[v] = matrix * Vecd<4>{ world.x(), world.y(), world.z(), 1.0 };
+		fileVertexInfo[2 * v] = file.getTexCoords(vertices[v]);
+		fileVertexInfo[2 * v + 1] = orientation * file.getNormal(vertices[v]);
+	}
+
+	for (size_t first(0); first < 3 * file.getTrianglesCount(); first += 3)
+	{
+		Vecd<4> clip[3], perVertex[3][2];
+		for (int i(0); i < 3; ++i)
+		{
+			const uint32_t index = file.getIndex(first + i);
+			clip[i] = clipVertices[index];
+			perVertex[i][0] = fileVertexInfo[2 * index];
+			perVertex[i][1] = fileVertexInfo[2 * index + 1];
+		}
+
+		auto triangle = new Triangle<4>(clip);
+		if (meshes[object.mesh].mesh.fragmentShader)
+			triangle->setFragmentShader(meshes[object.mesh].mesh.fragmentShader);
+		triangle->setBlendMode(meshes[object.mesh].mesh.blendMode);
+		triangle->setPerVertexInfo(perVertex);
+		canvas.addFigure(triangle);
+		stats.triangles++;
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Vecd.h"
+#include "Matd.h"
+#include "Canvas.h"
+#include "MeshFile.h"
+
+
+// View volume of clip space as world space planes, extracted from projection * view (rows combined as w +- x, w +- y)
+// The rasterizer has no far plane and clips only at w = nearW, so there are five planes
+struct Frustum
+{
+	Vecd<4> planes[5]; // Inside where dot(plane.xyz, point) + plane.w >= 0, xyz is unit
+
+	Frustum(const Matd<4, 4>& viewProjection, double nearW);
+
+	/// @brief Bit per plane the box crosses, planes not in mask are skipped
+	/// @return false if the box is outside of any plane
+	bool intersect(const Vecd<3>& boundsMin, const Vecd<3>& boundsMax, unsigned& mask) const;
+	bool isOutside(const Vecd<3>& center, double radius, unsigned mask) const;
+};
+
+
+// Objects the frame is made of: a shared mesh placed with a position and rotation, bounded by a sphere and a box
+// A bounding volume hierarchy over the object boxes is walked with the frustum, so objects out of view cost
+// nothing per vertex and the walk itself grows with what is visible rather than with the scene size
+class Scene
+{
+public:
+	using MeshId = uint32_t;
+	using ObjectId = uint32_t;
+	using FragmentShader = void (*)(const Vecd<4>& fragPosition, const Vecd<4>& texture, Vecd<4>& color);
+
+	struct Mesh
+	{
+		std::vector<Vecd<3>> vertices;		// Local space, three per triangle
+		std::vector<Vecd<4>> perVertex;		// Two per vertex (texture coords and a free one), or empty
+		FragmentShader fragmentShader = nullptr;
+		BlendMode blendMode = BlendMode::NONE;	// Blended objects are drawn after the opaque ones, back to front
+	};
+
+	struct Params
+	{
+		int leafSize = 4; // Objects per leaf at most
+	};
+
+	struct DrawStats
+	{
+		size_t visibleObjects = 0;
+		size_t blendedObjects = 0;	// Of the visible ones
+		size_t triangles = 0;
+		size_t nodesVisited = 0;
+	};
+
+	Scene(const Params& params);
+	Scene() : Scene(Params{}) {}
+
+	MeshId addMesh(const Mesh& mesh);
+	/// @brief Drawn straight from the mapped file (texture coords, then the rotated normal per vertex), it has to outlive the scene
+	MeshId addMesh(const MeshFile& file, FragmentShader fragmentShader, BlendMode blendMode = BlendMode::NONE);
+	ObjectId addObject(MeshId mesh, const Vecd<3>& position, const Matd<3, 3>& orientation);
+
+	/// @brief Orientation is a rotation (no scale). Only the path to the object leaf is refit
+	void setTransform(ObjectId id, const Vecd<3>& position, const Matd<3, 3>& orientation);
+
+	/// @brief Builds the hierarchy again, objects moving for long make a refit one loose
+	void rebuild();
+
+	/// @brief Objects overlapping the frustum in the order they were added, out is cleared first
+	/// @return Nodes visited
+	size_t collectVisible(const Frustum& frustum, std::vector<ObjectId>& out);
+
+	/// @brief Culls, transforms the visible objects to clip space and adds their triangles to the canvas
+	/// Opaque objects go in the order they were added, blended ones after them from the farthest center (clip w)
+	DrawStats draw(Canvas& canvas, const Matd<4, 4>& view, const Matd<4, 4>& projection);
+
+	size_t getObjectsCount() const	{ return objects.size(); }
+	size_t getNodesCount() const	{ return nodes.size(); }
+
+private:
+	struct MeshData
+	{
+		Mesh mesh;						// Empty for file meshes
+		const MeshFile* file = nullptr;
+		Vecd<3> boundsMin{}, boundsMax{};	// Local space
+		Vecd<3> center{};					// Of the sphere, local space
+		double radius = 0.0;
+	};
+
+	struct Object
+	{
+		MeshId mesh;
+		Vecd<3> position;
+		Matd<3, 3> orientation;
+		Vecd<3> boundsMin{}, boundsMax{};	// World space
+		Vecd<3> center{};
+		uint32_t leaf = 0;					// Node holding it
+	};
+
+	struct Node
+	{
+		Vecd<3> boundsMin, boundsMax;
+		uint32_t offset;	// Interior - right child (left one is the next node), leaf - first in leafObjects
+		uint32_t count;		// Objects in a leaf, 0 for interior nodes
+		uint32_t parent;	// Root is its own parent
+	};
+
+	const Params params;
+	std::vector<MeshData> meshes;
+	std::vector<Object> objects;
+	std::vector<Node> nodes;
+	std::vector<ObjectId> leafObjects;
+	bool isBuilt = false;
+
+	std::vector<ObjectId> visible;		// Reused by draw
+	std::vector<std::pair<double, ObjectId>> blended; // Clip w of the center and the object, reused by draw
+	std::vector<Vecd<4>> clipVertices;	// File mesh vertices transformed once per object
+	std::vector<Vecd<4>> fileVertexInfo;	// And their texture coordinates and rotated normals, two per vertex
+
+	void drawObject(Canvas& canvas, const Object& object, const Matd<4, 4>& viewProjection, DrawStats& stats);
+	void drawFile(Canvas& canvas, const Object& object, const Matd<4, 4>& viewProjection, DrawStats& stats);
+	void updateBounds(Object& object);
+	uint32_t build(size_t first, size_t last, uint32_t parent, int level);
+	void refit(uint32_t node);
+};
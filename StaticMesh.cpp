@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "StaticMesh.h"
+
+
+namespace
+{
+	constexpr int maxDepth = 64; // Query stack size
+	constexpr int sahDepth = maxDepth / 2; // Deeper nodes are split at the median, halves always fit in the rest
+
+	float roundDown(double value)
+	{
+		float rounded = float(value);
+		return double(rounded) > value ? std::nextafter(rounded, -std::numeric_limits<float>::infinity()) : rounded;
+	}
+
+	float roundUp(double value)
+	{
+		float rounded = float(value);
+		return double(rounded) < value ? std::nextafter(rounded, std::numeric_limits<float>::infinity()) : rounded;
+	}
+
+	double halfArea(const Vecd<3>& boundsMin, const Vecd<3>& boundsMax)
+	{
+		Vecd<3> size = boundsMax - boundsMin;
+		return size.x() * size.y() + size.y() * size.z() + size.z() * size.x();
+	}
+
+	void grow(Vecd<3>& boundsMin, Vecd<3>& boundsMax, const Vecd<3>& point)
+	{
+		for (int axis(0); axis < 3; ++axis)
+		{
+			boundsMin[axis] = std::min(boundsMin[axis], point[axis]);
+			boundsMax[axis] = std::max(boundsMax[axis], point[axis]);
+		}
+	}
+}
+
+
+StaticMesh::StaticMesh(const std::vector<Vecd<3>>& vertices, const std::vector<uint32_t>& indices, const Params& params) :
+	params(params)
+{
+	if (indices.size() % 3)
+		throw "Mesh indices count can be only a multiple of 3";
+	if (params.leafSize < 1 || params.bins < 2)
+		throw "Leaf size can be only > 0, bins only > 1";
+
+	std::vector<Triangle> input;
+	std::vector<BuildItem> items;
+	input.reserve(indices.size() / 3);
+	items.reserve(indices.size() / 3);
+
+	for (size_t i(0); i < indices.size(); i += 3)
+	{
+		if (indices[i] >= vertices.size() || indices[i + 1] >= vertices.size() || indices[i + 2] >= vertices.size())
+			throw "Mesh index out of range";
+
+		const Vecd<3>& a = vertices[indices[i]];
+		const Vecd<3>& b = vertices[indices[i + 1]];
+		const Vecd<3>& c = vertices[indices[i + 2]];
+		Triangle tri{ { a, b, c }, normalize(cross(b - a, c - a)) };
+		if (tri.normal.sqLength() == 0.0)
+			continue; // Degenerate, nothing to collide with
+
+		BuildItem item{ tri.vertices[0], tri.vertices[0], {}, uint32_t(input.size()) };
+		grow(item.boundsMin, item.boundsMax, tri.vertices[1]);
+		grow(item.boundsMin, item.boundsMax, tri.vertices[2]);
+		item.centroid = (item.boundsMin + item.boundsMax) * 0.5;
+
+		input.push_back(tri);
+		items.push_back(item);
+	}
+
+	if (items.empty())
+		return;
+
+	nodes.reserve(2 * items.size() / params.leafSize + 1);
+	triangles.reserve(items.size());
+	build(items, 0, items.size(), 0);
+
+	// Leaves store item order, triangles are copied in it so a leaf reads one contiguous run
+	for (auto& item : items)
+		triangles.push_back(input[item.triangle]);
+}
+
+
+//// BUILD ////
+
+
+uint32_t StaticMesh::build(std::vector<BuildItem>& items, size_t first, size_t last, int level)
+{
+	depth = std::max(depth, level + 1);
+
+	Vecd<3> boundsMin = items[first].boundsMin, boundsMax = items[first].boundsMax;
+	Vecd<3> centroidMin = items[first].centroid, centroidMax = centroidMin;
+	for (size_t i(first); i < last; ++i)
+	{
+		grow(boundsMin, boundsMax, items[i].boundsMin);
+		grow(boundsMin, boundsMax, items[i].boundsMax);
+		grow(centroidMin, centroidMax, items[i].centroid);
+	}
+
+	uint32_t nodeId = uint32_t(nodes.size());
+	nodes.push_back(Node{
+		{ roundDown(boundsMin.x()), roundDown(boundsMin.y()), roundDown(boundsMin.z()) }, 0,
+		{ roundUp(boundsMax.x()), roundUp(boundsMax.y()), roundUp(boundsMax.z()) }, 0
+	});
+
+	// Few triangles, or too deep for the query stack (median splits from sahDepth on keep that from happening)
+	const size_t count = last - first;
+	if (count <= size_t(params.leafSize) || level >= maxDepth - 1)
+	{
+		nodes[nodeId].offset = uint32_t(first);
+		nodes[nodeId].count = uint32_t(count);
+		return nodeId;
+	}
+
+	// Unbalanced meshes can keep SAH peeling a few triangles off, so deep down it is the median of the longest axis
+	size_t mid = level < sahDepth ? splitSah(items, first, last, centroidMin, centroidMax) : first;
+	if (mid == first || mid == last)
+	{
+		// All centroids in one bin (or too deep), halves are as good as anything
+		Vecd<3> extent = centroidMax - centroidMin;
+		int axis = extent.x() >= extent.y() && extent.x() >= extent.z() ? 0 : (extent.y() >= extent.z() ? 1 : 2);
+		mid = first + count / 2;
+		std::nth_element(items.begin() + first, items.begin() + mid, items.begin() + last, [axis](const BuildItem& a, const BuildItem& b) {
+			return a.centroid[axis] < b.centroid[axis];
+		});
+	}
+
+	build(items, first, mid, level + 1); // Right after this node
+	uint32_t right = build(items, mid, last, level + 1);
+	nodes[nodeId].offset = right;
+	return nodeId;
+}
+
+size_t StaticMesh::splitSah(std::vector<BuildItem>& items, size_t first, size_t last, const Vecd<3>& centroidMin, const Vecd<3>& centroidMax) const
+{
+	struct Bin
+	{
+		Vecd<3> boundsMin, boundsMax;
+		size_t count = 0;
+	};
+
+	const double inf = std::numeric_limits<double>::infinity();
+	double bestCost = inf;
+	int bestAxis = -1, bestSplit = 0;
+	std::vector<Bin> bins(params.bins);
+	std::vector<double> rightArea(params.bins);
+
+	for (int axis(0); axis < 3; ++axis)
+	{
+		double extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0)
+			continue;
+
+		for (auto& bin : bins)
+			bin = Bin{ Vecd<3>{ inf, inf, inf }, Vecd<3>{ -inf, -inf, -inf }, 0 };
+
+		double scale = params.bins / extent;
+		for (size_t i(first); i < last; ++i)
+		{
+			int binId = std::min(params.bins - 1, int((items[i].centroid[axis] - centroidMin[axis]) * scale));
+			grow(bins[binId].boundsMin, bins[binId].boundsMax, items[i].boundsMin);
+			grow(bins[binId].boundsMin, bins[binId].boundsMax, items[i].boundsMax);
+			bins[binId].count++;
+		}
+
+		// Right side areas from the end, then a sweep from the start for the left ones
+		Vecd<3> sweepMin{ inf, inf, inf }, sweepMax{ -inf, -inf, -inf };
+		for (int b(params.bins - 1); b > 0; --b)
+		{
+			if (bins[b].count)
+			{
+				grow(sweepMin, sweepMax, bins[b].boundsMin);
+				grow(sweepMin, sweepMax, bins[b].boundsMax);
+			}
+			rightArea[b] = sweepMin.x() != inf ? halfArea(sweepMin, sweepMax) : 0.0;
+		}
+
+		sweepMin = Vecd<3>{ inf, inf, inf };
+		sweepMax = Vecd<3>{ -inf, -inf, -inf };
+		size_t leftCount = 0;
+		for (int b(0); b < params.bins - 1; ++b)
+		{
+			if (bins[b].count)
+			{
+				grow(sweepMin, sweepMax, bins[b].boundsMin);
+				grow(sweepMin, sweepMax, bins[b].boundsMax);
+			}
+			leftCount += bins[b].count;
+
+			size_t rightCount = (last - first) - leftCount;
+			if (!leftCount || !rightCount)
+				continue;
+
+			double cost = leftCount * halfArea(sweepMin, sweepMax) + rightCount * rightArea[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b + 1;
+			}
+		}
+	}
+
+	if (bestAxis < 0)
+		return first;
+
+	double scale = params.bins / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+	auto midIt = std::partition(items.begin() + first, items.begin() + last, [&](const BuildItem& item) {
+		return std::min(params.bins - 1, int((item.centroid[bestAxis] - centroidMin[bestAxis]) * scale)) < bestSplit;
+	});
+	return size_t(midIt - items.begin());
+}
+
+
+//// QUERY ////
+
+
+size_t StaticMesh::query(const Vecd<3>& boxMin, const Vecd<3>& boxMax, std::vector<uint32_t>& out) const
+{
+	out.clear();
+	if (nodes.empty())
+		return 0;
+
+	const float qMin[3]{ roundDown(boxMin.x()), roundDown(boxMin.y()), roundDown(boxMin.z()) };
+	const float qMax[3]{ roundUp(boxMax.x()), roundUp(boxMax.y()), roundUp(boxMax.z()) };
+
+	uint32_t stack[maxDepth];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	size_t visited = 0;
+
+	while (stackSize)
+	{
+		uint32_t nodeId = stack[--stackSize];
+		const Node& node = nodes[nodeId];
+		visited++;
+
+		if (node.boundsMin[0] > qMax[0] || node.boundsMax[0] < qMin[0] ||
+			node.boundsMin[1] > qMax[1] || node.boundsMax[1] < qMin[1] ||
+			node.boundsMin[2] > qMax[2] || node.boundsMax[2] < qMin[2])
+			continue;
+
+		if (node.count)
+		{
+			for (uint32_t triId = node.offset; triId < node.offset + node.count; ++triId)
+			{
+				// Node box is loose for some of them
+				const Vecd<3>* vert = triangles[triId].vertices;
+				bool outside = false;
+				for (int axis(0); axis < 3 && !outside; ++axis)
+					outside = std::min({ vert[0][axis], vert[1][axis], vert[2][axis] }) > boxMax[axis] ||
+						std::max({ vert[0][axis], vert[1][axis], vert[2][axis] }) < boxMin[axis];
+				if (!outside)
+					out.push_back(triId);
+			}
+			continue;
+		}
+
+		// Left child is the next node, it goes on top so memory is walked forward
+		stack[stackSize++] = node.offset;
+		stack[stackSize++] = nodeId + 1;
+	}
+
+	return visited;
+}
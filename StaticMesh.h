@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Vecd.h"
+
+
+// Static triangle soup bodies collide with (level geometry), kept in a bounding volume hierarchy
+// Built once with the surface area heuristic and flattened depth first, so a query walks memory mostly forward
+class StaticMesh
+{
+public:
+	// One sided, front face is counter clockwise
+	struct Triangle
+	{
+		Vecd<3> vertices[3];
+		Vecd<3> normal; // Unit
+	};
+
+	struct Params
+	{
+		int leafSize = 4;	// Triangles per leaf at most
+		int bins = 12;		// SAH split candidates per axis
+	};
+
+	/// @param vertices Shared by the triangles
+	/// @param indices Three per triangle
+	StaticMesh(const std::vector<Vecd<3>>& vertices, const std::vector<uint32_t>& indices, const Params& params);
+	StaticMesh(const std::vector<Vecd<3>>& vertices, const std::vector<uint32_t>& indices) :
+		StaticMesh(vertices, indices, Params{})
+	{}
+
+	/// @brief Triangles whose boxes overlap the box, out is cleared first
+	/// @return Nodes visited, grows with the log of the triangles count
+	size_t query(const Vecd<3>& boxMin, const Vecd<3>& boxMax, std::vector<uint32_t>& out) const;
+
+	const Triangle& getTriangle(uint32_t id) const	{ return triangles[id]; }
+	size_t getTrianglesCount() const				{ return triangles.size(); }
+	size_t getNodesCount() const					{ return nodes.size(); }
+	int getDepth() const							{ return depth; }
+
+private:
+	// 32 bytes, two per cache line. Bounds are rounded outwards to float
+	struct Node
+	{
+		float boundsMin[3];
+		uint32_t offset;	// Interior - right child (left one is the next node), leaf - first triangle
+		float boundsMax[3];
+		uint32_t count;		// Triangles in a leaf, 0 for interior nodes
+	};
+
+	struct BuildItem
+	{
+		Vecd<3> boundsMin, boundsMax, centroid;
+		uint32_t triangle;
+	};
+
+	const Params params;
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles; // Leaf order
+	int depth = 0;
+
+	uint32_t build(std::vector<BuildItem>& items, size_t first, size_t last, int level);
+	size_t splitSah(std::vector<BuildItem>& items, size_t first, size_t last, const Vecd<3>& centroidMin, const Vecd<3>& centroidMax) const;
+};
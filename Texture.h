@@ -1,21 +1,35 @@
 #pragma once
-#include <Windows.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cmath>
 
+#include "Platform.h"
 #include "Vecd.h"
 
 
 class Texture
 {
-	HDC m_memContext;
-	PUCHAR m_texPixels;
+	std::vector<UCHAR> m_texPixels;
 	size_t m_width, m_height, m_colorsCount;
 
 public:
+	/// @brief Texture from raw pixels (rows bottom to top, like in BMP)
+	Texture(const UCHAR* pixels, size_t width, size_t height, size_t colorsCount)
+		: m_width(width), m_height(height), m_colorsCount(colorsCount)
+	{
+		// getPixel always reads 4 bytes, so there is padding after the last pixel
+		m_texPixels.assign(pixels, pixels + width * height * colorsCount);
+		m_texPixels.resize(m_texPixels.size() + 4);
+	}
+
+#ifdef _WIN32
 	Texture(const wchar_t* path)
 	{
 		// Setting up memory context
-		m_memContext = CreateDC(L"DISPLAY", nullptr, nullptr, nullptr);
-		if (!m_memContext)
+		HDC memContext = CreateDC(L"DISPLAY", nullptr, nullptr, nullptr);
+		if (!memContext)
 			throw "Cant create memory context for texture";
 
 		HBITMAP bitmap = (HBITMAP)LoadImageW(NULL, path, IMAGE_BITMAP, 0, 0, LR_LOADFROMFILE);
@@ -29,7 +43,7 @@ public:
 		bmpInfo.bmiHeader.biSize = sizeof(bmpInfo.bmiHeader);
 
 		// Get the BITMAPINFO structure from the bitmap
-		if (!GetDIBits(m_memContext, bitmap, 0, 0, NULL, &bmpInfo, DIB_RGB_COLORS))
+		if (!GetDIBits(memContext, bitmap, 0, 0, NULL, &bmpInfo, DIB_RGB_COLORS))
 			throw "Cant read BMP data from image";
 
 		m_width = bmpInfo.bmiHeader.biWidth;
@@ -37,12 +51,56 @@ public:
 		m_colorsCount = bmpInfo.bmiHeader.biBitCount / 8;
 
 		// create the bitmap buffer
-		m_texPixels = new BYTE[bmpInfo.bmiHeader.biSizeImage]{};
+		m_texPixels.resize(bmpInfo.bmiHeader.biSizeImage + 4);
 
 		// get the actual bitmap buffer
-		if (!GetDIBits(m_memContext, bitmap, 0, bmpInfo.bmiHeader.biHeight, m_texPixels, &bmpInfo, DIB_RGB_COLORS))
+		if (!GetDIBits(memContext, bitmap, 0, bmpInfo.bmiHeader.biHeight, m_texPixels.data(), &bmpInfo, DIB_RGB_COLORS))
+			throw "Cant get pixel data from image";
+
+		::DeleteObject(bitmap);
+		::DeleteDC(memContext);
+	}
+#else
+	/// @brief Uncompressed 24 and 32 bit BMP, pixels end up as GetDIBits gives them on Windows
+	Texture(const wchar_t* path)
+	{
+		std::string narrowPath;
+		for (const wchar_t* c = path; *c; ++c)
+			narrowPath += char(*c);
+
+		std::ifstream file(narrowPath, std::ios::binary);
+		if (!file)
+			throw "Cant load image";
+
+		// BITMAPFILEHEADER and BITMAPINFOHEADER
+		UCHAR header[54];
+		if (!file.read((char*)header, sizeof(header)) || header[0] != 'B' || header[1] != 'M')
+			throw "Cant read BMP data from image";
+
+		auto read32 = [&header](size_t offset) {
+			int32_t toRet;
+			memcpy(&toRet, header + offset, sizeof(toRet));
+			return toRet;
+		};
+		int32_t dataOffset = read32(10);
+		int32_t width = read32(18);
+		int32_t height = read32(22);
+		unsigned bitCount = header[28] | (header[29] << 8);
+		if ((bitCount != 24 && bitCount != 32) || read32(30) != 0)
+			throw "Only uncompressed 24 and 32 bit BMP are supported";
+
+		m_width = width;
+		m_height = abs(height - 1);
+		m_colorsCount = bitCount / 8;
+
+		// Rows are aligned to 4 bytes
+		size_t dataSize = ((m_width * m_colorsCount + 3) & ~size_t(3)) * abs(height);
+		m_texPixels.resize(dataSize + 4);
+		file.seekg(dataOffset);
+		if (!file.read((char*)m_texPixels.data(), dataSize))
 			throw "Cant get pixel data from image";
 	}
+#endif
 
 
 	Vecd<4> getPixel(double x, double y)
@@ -54,7 +112,7 @@ public:
 		size_t intX = size_t(x * m_width);
 		size_t intY = size_t(y * m_height);
 
-		PUCHAR colBegin = m_texPixels + intY * m_width * m_colorsCount + intX * m_colorsCount;
+		const UCHAR* colBegin = m_texPixels.data() + intY * m_width * m_colorsCount + intX * m_colorsCount;
 		for (size_t i(0); i < 4ULL; ++i)
 			toRet[i] = colBegin[i] * 0.00390625;
 
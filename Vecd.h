@@ -1,7 +1,11 @@
 #pragma once
+#include <cstring>
 #include <memory>
+#include <vector>
 #include <initializer_list>
 
+#include "FastMath.h"
+
 
 template <unsigned N>
 class Vecd
@@ -164,22 +168,35 @@ Vecd<N> cross(const Vecd<N>& first, const Vecd<N>& second)
 	};
 }
 
+// Zero vector stays zero
+// Squared lengths that under- or overflow are redone on the vector divided by its largest component
 template <unsigned N>
 Vecd<N> normalize(const Vecd<N>& vec)
 {
-	float squaredLen = (float)vec.sqLength();
+	Vecd<N> scaled = vec;
+	double squaredLen = vec.sqLength();
+	if (squaredLen < fmath::minNormal || squaredLen > fmath::maxFinite)
+	{
+		double largest(0.0);
+		for (int i(0); i < N; ++i)
+			largest = std::max(largest, std::abs(vec[i]));
+		if (largest == 0.0)
+			return Vecd<N>{};
+
+		// Infinite components stay as they are and give NaN
+		if (largest <= fmath::maxFinite)
+		{
+			for (int i(0); i < N; ++i)
+				scaled[i] = vec[i] / largest;
+			squaredLen = scaled.sqLength();
+		}
+	}
 
-	// Inverse square root
-	const float threehalfs = 1.5F;
-	float invRoot = squaredLen; // ONLY FLOAT
-	long i = *(long*)&invRoot;
-	i = 0x5f3759df - (i >> 1);
-	invRoot = *(float*)&i;
-	invRoot *= threehalfs - ((squaredLen * 0.5F) * invRoot * invRoot);
+	double invRoot = fmath::rsqrt(squaredLen);
 
 	Vecd<N> normalized{};
 	for (int i(0); i < N; ++i)
-		normalized[i] = vec[i] * invRoot;
+		normalized[i] = scaled[i] * invRoot;
 
 	return normalized;
 }
@@ -188,4 +205,40 @@ template <unsigned N>
 Vecd<N> reflect(const Vecd<N>& toReflect, const Vecd<N>& norm)
 {
 	return toReflect - 2.0 * dot(toReflect, norm) * norm;
-}
\ No newline at end of file
+}
+
+
+//// STRUCTURE OF ARRAYS ////
+
+
+// One std::vector per component, so loops over all bodies read contiguous memory
+struct Vec3Array
+{
+	std::vector<double> x, y, z;
+
+	void resize(size_t count)
+	{
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+	}
+
+	void reserve(size_t count)
+	{
+		x.reserve(count);
+		y.reserve(count);
+		z.reserve(count);
+	}
+
+	Vecd<3> get(size_t id) const
+	{
+		return Vecd<3>{ x[id], y[id], z[id] };
+	}
+
+	void set(size_t id, const Vecd<3>& vec)
+	{
+		x[id] = vec.x();
+		y[id] = vec.y();
+		z[id] = vec.z();
+	}
+};
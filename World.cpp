@@ -0,0 +1,660 @@
+#include <algorithm>
+#include <cmath>
+
+#include "World.h"
+
+
+//// BODIES ////
+
+
+World::BodyId World::addBody(const Vecd<3> bodyVerts[3], const Matd<3, 3>& inverseBodyInertiaTensor, double mass, const Vecd<3>& centerPos)
+{
+	if (mass <= 0.0)
+		throw "Body mass can be only > 0.0";
+
+	BodyId id = invMass.size();
+	size_t count = id + 1;
+
+	invMass.push_back(1.0 / mass);
+	IbodyInv.resize(count);
+	pos.resize(count);
+	orientMat.resize(count);
+	linearVel.resize(count);
+	angularMomentum.resize(count);
+	Iinv.resize(count);
+	angularVel.resize(count);
+	appliedForce.resize(count);
+	appliedTorque.resize(count);
+	aabbMin.resize(count);
+	aabbMax.resize(count);
+	sleeping.push_back(0);
+	stillTime.push_back(0.0);
+	awakeIds.push_back(uint32_t(id));
+	islandParent.push_back(uint32_t(id));
+	islandNext.push_back(uint32_t(id));
+	inIsland.push_back(0);
+	islandStillTime.push_back(0.0);
+	islandsCount++;
+	for (int vId(0); vId < 3; ++vId)
+	{
+		warmImpulses[vId].resize(count);
+		bodyVertices[vId].resize(count);
+		vertices[vId].resize(count);
+		bodyVertices[vId].set(id, bodyVerts[vId]);
+	}
+
+	IbodyInv.set(id, inverseBodyInertiaTensor);
+	pos.set(id, centerPos);
+	orientMat.set(id, Matd<3, 3>::getIdentityMatrix());
+
+	// Derived values of the new body are valid right away
+	Iinv.set(id, inverseBodyInertiaTensor);
+	Vecd<3> boundsMin = centerPos + bodyVerts[0], boundsMax = boundsMin;
+	for (int vId(0); vId < 3; ++vId)
+	{
+		Vecd<3> vert = centerPos + bodyVerts[vId];
+		vertices[vId].set(id, vert);
+		for (int axis(0); axis < 3; ++axis)
+		{
+			boundsMin[axis] = std::min(boundsMin[axis], vert[axis]);
+			boundsMax[axis] = std::max(boundsMax[axis], vert[axis]);
+		}
+	}
+	aabbMin.set(id, boundsMin);
+	aabbMax.set(id, boundsMax);
+
+	return id;
+}
+
+void World::reserve(size_t count)
+{
+	invMass.reserve(count);
+	IbodyInv.reserve(count);
+	pos.reserve(count);
+	orientMat.reserve(count);
+	linearVel.reserve(count);
+	angularMomentum.reserve(count);
+	Iinv.reserve(count);
+	angularVel.reserve(count);
+	appliedForce.reserve(count);
+	appliedTorque.reserve(count);
+	aabbMin.reserve(count);
+	aabbMax.reserve(count);
+	sleeping.reserve(count);
+	stillTime.reserve(count);
+	awakeIds.reserve(count);
+	islandParent.reserve(count);
+	islandNext.reserve(count);
+	inIsland.reserve(count);
+	islandStillTime.reserve(count);
+	for (int vId(0); vId < 3; ++vId)
+	{
+		warmImpulses[vId].reserve(count);
+		bodyVertices[vId].reserve(count);
+		vertices[vId].reserve(count);
+	}
+}
+
+
+void World::setCenterPos(BodyId id, const Vecd<3>& newPos)
+{
+	wakeUp(id);
+	pos.set(id, newPos);
+	for (int vId(0); vId < 3; ++vId)
+		vertices[vId].set(id, newPos + orientMat.get(id) * bodyVertices[vId].get(id));
+}
+
+void World::setOrientation(BodyId id, Matd<3, 3> newOrient)
+{
+	wakeUp(id);
+	orientMat.set(id, newOrient);
+
+	Matd<3, 3> newIinv = newOrient * IbodyInv.get(id) * transpose(newOrient);
+	Iinv.set(id, newIinv);
+	angularVel.set(id, newIinv * angularMomentum.get(id));
+	for (int vId(0); vId < 3; ++vId)
+		vertices[vId].set(id, pos.get(id) + newOrient * bodyVertices[vId].get(id));
+}
+
+void World::setLinearVelocity(BodyId id, const Vecd<3>& newVel)
+{
+	wakeUp(id);
+	linearVel.set(id, newVel);
+}
+
+void World::setAngularMomentum(BodyId id, const Vecd<3>& newMom)
+{
+	wakeUp(id);
+	angularMomentum.set(id, newMom);
+	angularVel.set(id, Iinv.get(id) * newMom);
+}
+
+void World::applyForce(BodyId id, const Vecd<3>& force)
+{
+	wakeUp(id);
+	appliedForce.set(id, appliedForce.get(id) + force);
+}
+
+void World::applyTorque(BodyId id, const Vecd<3>& torque)
+{
+	wakeUp(id);
+	appliedTorque.set(id, appliedTorque.get(id) + torque);
+}
+
+
+//// STEP ////
+// Stages below are branchless loops over raw arrays, so the compiler can vectorize them
+
+
+void World::step(double dTime)
+{
+	PROFILE_SCOPE("world step");
+
+	// Changed generators move their bodies
+	for (uint32_t id : forceGenerators.getTouched())
+		if (id < getBodyCount())
+			wakeUp(id);
+	if (forceGenerators.isAllTouched())
+		for (BodyId id(0); id < getBodyCount(); ++id)
+			wakeUp(id);
+	forceGenerators.clearTouched();
+
+	// Sleeping bodies are skipped, awake ones are mostly in long runs, so the loops stay contiguous
+	updateAwakeRanges();
+	if (!awakeCount)
+		return; // Nothing moved, pairs and islands are the same as before
+
+	if (!jobs)
+	{
+		for (auto& range : awakeRanges)
+			runStages(dTime, range.first, range.second);
+	}
+	else
+	{
+		// Pieces never cross an awake range, every body is in exactly one of them
+		jobRanges.clear();
+		for (auto& range : awakeRanges)
+			for (size_t first = range.first; first < range.second; first += jobGrain)
+				jobRanges.push_back({ first, std::min(first + jobGrain, range.second) });
+
+		jobs->parallelFor(jobRanges.size(), 1, [&](size_t firstJob, size_t lastJob) {
+			for (size_t jobId = firstJob; jobId < lastJob; ++jobId)
+				runStages(dTime, jobRanges[jobId].first, jobRanges[jobId].second);
+		});
+	}
+
+	broadphase.update(aabbMin, aabbMax, awakeIds);
+	updateSleeping();
+}
+
+
+void World::runStages(double dTime, size_t first, size_t last)
+{
+	// Bodies only touch their own data in these, so any piece can run on any thread
+	integrate(dTime, first, last);
+	orthonormalize(first, last);
+	updateInertia(first, last);
+	updateVertices(first, last);
+	resolveFloorContacts(first, last);
+	updateBounds(first, last);
+	updateStillTime(dTime, first, last);
+}
+
+
+double World::getKineticEnergy() const
+{
+	auto energy = [this](size_t first, size_t last) {
+		double sum = 0.0;
+		for (size_t i(first); i < last; ++i)
+		{
+			sum += 0.5 * linearVel.get(i).sqLength() / invMass[i];
+			sum += 0.5 * dot(angularMomentum.get(i), angularVel.get(i));
+		}
+		return sum;
+	};
+
+	// Serial sum goes over the same pieces, so it gives the same bits as a parallel one
+	if (!jobs)
+	{
+		double sum = 0.0;
+		for (size_t first(0); first < getBodyCount(); first += jobGrain)
+			sum += energy(first, std::min(first + jobGrain, getBodyCount()));
+		return sum;
+	}
+
+	return jobs->parallelReduce(getBodyCount(), jobGrain, 0.0, energy, [](double acc, double part) { return acc + part; });
+}
+
+
+void World::integrate(double dTime, size_t first, size_t last)
+{
+	const double noKdl = coefs.noKdl;
+	const double noKda = coefs.noKda;
+
+	if (forceGenerators.getGeneratorsCount())
+	{
+		BodyStateView view;
+		for (int i(0); i < 3; ++i)
+			for (int j(0); j < 3; ++j)
+				view.orient[i][j] = orientMat.m[i][j].data();
+		view.pos[0] = pos.x.data(); view.pos[1] = pos.y.data(); view.pos[2] = pos.z.data();
+		view.linearVel[0] = linearVel.x.data(); view.linearVel[1] = linearVel.y.data(); view.linearVel[2] = linearVel.z.data();
+		view.angularVel[0] = angularVel.x.data(); view.angularVel[1] = angularVel.y.data(); view.angularVel[2] = angularVel.z.data();
+		view.invMass = invMass.data();
+
+		forceGenerators.evaluate(view, first, last, BodyForceView{
+			{ appliedForce.x.data(), appliedForce.y.data(), appliedForce.z.data() },
+			{ appliedTorque.x.data(), appliedTorque.y.data(), appliedTorque.z.data() }
+		});
+	}
+
+	const double* im = invMass.data();
+	double* px = pos.x.data(); double* py = pos.y.data(); double* pz = pos.z.data();
+	double* vx = linearVel.x.data(); double* vy = linearVel.y.data(); double* vz = linearVel.z.data();
+	double* lx = angularMomentum.x.data(); double* ly = angularMomentum.y.data(); double* lz = angularMomentum.z.data();
+	const double* wx = angularVel.x.data(); const double* wy = angularVel.y.data(); const double* wz = angularVel.z.data();
+	double* fx = appliedForce.x.data(); double* fy = appliedForce.y.data(); double* fz = appliedForce.z.data();
+	double* tx = appliedTorque.x.data(); double* ty = appliedTorque.y.data(); double* tz = appliedTorque.z.data();
+
+	// Linear part (gravity, applied force and a little damping, same as Simulator)
+	for (size_t i(first); i < last; ++i)
+	{
+		double sumX = fx[i] - noKdl * vx[i];
+		double sumY = fy[i] - noKdl * vy[i] - 9.8 / im[i];
+		double sumZ = fz[i] - noKdl * vz[i];
+
+		px[i] += vx[i] * dTime;
+		py[i] += vy[i] * dTime;
+		pz[i] += vz[i] * dTime;
+
+		vx[i] += dTime * im[i] * sumX;
+		vy[i] += dTime * im[i] * sumY;
+		vz[i] += dTime * im[i] * sumZ;
+
+		fx[i] = 0.0; fy[i] = 0.0; fz[i] = 0.0;
+	}
+
+	// Angular momentum
+	for (size_t i(first); i < last; ++i)
+	{
+		lx[i] += (tx[i] - noKda * wx[i]) * dTime;
+		ly[i] += (ty[i] - noKda * wy[i]) * dTime;
+		lz[i] += (tz[i] - noKda * wz[i]) * dTime;
+
+		tx[i] = 0.0; ty[i] = 0.0; tz[i] = 0.0;
+	}
+
+	// Orientation, R += star(w) * R * dTime, one column at a time
+	for (int col(0); col < 3; ++col)
+	{
+		double* r0 = orientMat.m[0][col].data();
+		double* r1 = orientMat.m[1][col].data();
+		double* r2 = orientMat.m[2][col].data();
+		for (size_t i(first); i < last; ++i)
+		{
+			double d0 = -wz[i] * r1[i] + wy[i] * r2[i];
+			double d1 = +wz[i] * r0[i] - wx[i] * r2[i];
+			double d2 = -wy[i] * r0[i] + wx[i] * r1[i];
+			r0[i] += d0 * dTime;
+			r1[i] += d1 * dTime;
+			r2[i] += d2 * dTime;
+		}
+	}
+}
+
+
+void World::orthonormalize(size_t first, size_t last)
+{
+	// Same as Matd::orthonormalize3D: X = |c0|, Z = |X x c1|, Y = Z x X
+	double* r[3][3];
+	for (int i(0); i < 3; ++i)
+		for (int j(0); j < 3; ++j)
+			r[i][j] = orientMat.m[i][j].data();
+
+	for (size_t i(first); i < last; ++i)
+	{
+		double xx = r[0][0][i], xy = r[1][0][i], xz = r[2][0][i];
+		double invLen = 1.0 / std::sqrt(xx * xx + xy * xy + xz * xz);
+		xx *= invLen; xy *= invLen; xz *= invLen;
+
+		double yx = r[0][1][i], yy = r[1][1][i], yz = r[2][1][i];
+		double zx = xy * yz - xz * yy;
+		double zy = xz * yx - xx * yz;
+		double zz = xx * yy - xy * yx;
+		invLen = 1.0 / std::sqrt(zx * zx + zy * zy + zz * zz);
+		zx *= invLen; zy *= invLen; zz *= invLen;
+
+		// Unit already, X and Z are orthonormal
+		yx = zy * xz - zz * xy;
+		yy = zz * xx - zx * xz;
+		yz = zx * xy - zy * xx;
+
+		r[0][0][i] = xx; r[0][1][i] = yx; r[0][2][i] = zx;
+		r[1][0][i] = xy; r[1][1][i] = yy; r[1][2][i] = zy;
+		r[2][0][i] = xz; r[2][1][i] = yz; r[2][2][i] = zz;
+	}
+}
+
+
+void World::updateInertia(size_t first, size_t last)
+{
+	// Iinv = R * IbodyInv * R^T, w = Iinv * L
+	const double* r[3][3];
+	const double* b[3][3];
+	double* out[3][3];
+	for (int i(0); i < 3; ++i)
+		for (int j(0); j < 3; ++j)
+		{
+			r[i][j] = orientMat.m[i][j].data();
+			b[i][j] = IbodyInv.m[i][j].data();
+			out[i][j] = Iinv.m[i][j].data();
+		}
+
+	const double* lx = angularMomentum.x.data(); const double* ly = angularMomentum.y.data(); const double* lz = angularMomentum.z.data();
+	double* wx = angularVel.x.data(); double* wy = angularVel.y.data(); double* wz = angularVel.z.data();
+
+	for (size_t i(first); i < last; ++i)
+	{
+		double rb[3][3];
+		for (int row(0); row < 3; ++row)
+			for (int col(0); col < 3; ++col)
+				rb[row][col] = r[row][0][i] * b[0][col][i] + r[row][1][i] * b[1][col][i] + r[row][2][i] * b[2][col][i];
+
+		double res[3][3];
+		for (int row(0); row < 3; ++row)
+			for (int col(0); col < 3; ++col)
+				res[row][col] = rb[row][0] * r[col][0][i] + rb[row][1] * r[col][1][i] + rb[row][2] * r[col][2][i];
+
+		for (int row(0); row < 3; ++row)
+			for (int col(0); col < 3; ++col)
+				out[row][col][i] = res[row][col];
+
+		wx[i] = res[0][0] * lx[i] + res[0][1] * ly[i] + res[0][2] * lz[i];
+		wy[i] = res[1][0] * lx[i] + res[1][1] * ly[i] + res[1][2] * lz[i];
+		wz[i] = res[2][0] * lx[i] + res[2][1] * ly[i] + res[2][2] * lz[i];
+	}
+}
+
+
+void World::updateVertices(size_t first, size_t last)
+{
+	const double* r[3][3];
+	for (int i(0); i < 3; ++i)
+		for (int j(0); j < 3; ++j)
+			r[i][j] = orientMat.m[i][j].data();
+
+	const double* px = pos.x.data(); const double* py = pos.y.data(); const double* pz = pos.z.data();
+
+	for (int vId(0); vId < 3; ++vId)
+	{
+		const double* bx = bodyVertices[vId].x.data();
+		const double* by = bodyVertices[vId].y.data();
+		const double* bz = bodyVertices[vId].z.data();
+		double* ox = vertices[vId].x.data();
+		double* oy = vertices[vId].y.data();
+		double* oz = vertices[vId].z.data();
+
+		for (size_t i(first); i < last; ++i)
+		{
+			ox[i] = px[i] + r[0][0][i] * bx[i] + r[0][1][i] * by[i] + r[0][2][i] * bz[i];
+			oy[i] = py[i] + r[1][0][i] * bx[i] + r[1][1][i] * by[i] + r[1][2][i] * bz[i];
+			oz[i] = pz[i] + r[2][0][i] * bx[i] + r[2][1][i] * by[i] + r[2][2][i] * bz[i];
+		}
+	}
+}
+
+
+void World::updateBounds(size_t first, size_t last)
+{
+	double* minX = aabbMin.x.data(); double* minY = aabbMin.y.data(); double* minZ = aabbMin.z.data();
+	double* maxX = aabbMax.x.data(); double* maxY = aabbMax.y.data(); double* maxZ = aabbMax.z.data();
+	const double* v0x = vertices[0].x.data(); const double* v0y = vertices[0].y.data(); const double* v0z = vertices[0].z.data();
+	const double* v1x = vertices[1].x.data(); const double* v1y = vertices[1].y.data(); const double* v1z = vertices[1].z.data();
+	const double* v2x = vertices[2].x.data(); const double* v2y = vertices[2].y.data(); const double* v2z = vertices[2].z.data();
+
+	for (size_t i(first); i < last; ++i)
+	{
+		minX[i] = std::min(v0x[i], std::min(v1x[i], v2x[i]));
+		minY[i] = std::min(v0y[i], std::min(v1y[i], v2y[i]));
+		minZ[i] = std::min(v0z[i], std::min(v1z[i], v2z[i]));
+		maxX[i] = std::max(v0x[i], std::max(v1x[i], v2x[i]));
+		maxY[i] = std::max(v0y[i], std::max(v1y[i], v2y[i]));
+		maxZ[i] = std::max(v0z[i], std::max(v1z[i], v2z[i]));
+	}
+}
+
+
+//// FLOOR CONTACTS ////
+
+
+void World::resolveFloorContacts(size_t first, size_t last)
+{
+	// No bisection here (it would stall the whole batch), penetrating bodies are pushed out instead
+	const Vecd<3>& normal = aFloor.normal;
+
+	for (size_t i(first); i < last; ++i)
+	{
+		// Cheap reject, most bodies are in the air
+		double minDist = dot(vertices[0].get(i), normal);
+		for (int vId(1); vId < 3; ++vId)
+			minDist = std::min(minDist, dot(vertices[vId].get(i), normal));
+		minDist += aFloor.d;
+		if (minDist >= coefs.colDepthEpsilon)
+		{
+			for (int vId(0); vId < 3; ++vId)
+				warmImpulses[vId][i] = {};
+			continue;
+		}
+
+		Vecd<3> center = pos.get(i);
+		if (minDist < 0.0)
+		{
+			center = center + (-minDist) * normal;
+			pos.set(i, center);
+			for (int vId(0); vId < 3; ++vId)
+				vertices[vId].set(i, vertices[vId].get(i) + (-minDist) * normal);
+		}
+
+		BodyVelocity vel{ invMass[i], Iinv.get(i), linearVel.get(i), angularMomentum.get(i), angularVel.get(i) };
+		ContactSolver solver(vel, coefs);
+
+		int contactIds[3];
+		for (int vId(0); vId < 3; ++vId)
+		{
+			Vecd<3> vertPos = vertices[vId].get(i);
+			contactIds[vId] = -1;
+			if (dot(vertPos, normal) + aFloor.d < coefs.colDepthEpsilon)
+				contactIds[vId] = solver.addContact(vertPos - center, normal, warmImpulses[vId][i]);
+		}
+		solver.solve();
+
+		for (int vId(0); vId < 3; ++vId)
+			warmImpulses[vId][i] = contactIds[vId] >= 0 ? solver.getImpulse(contactIds[vId]) : ContactImpulse{};
+
+		linearVel.set(i, vel.linearVel);
+		angularMomentum.set(i, vel.angularMomentum);
+		angularVel.set(i, vel.angularVel);
+	}
+}
+
+
+//// SLEEPING ////
+
+
+void World::wakeUp(BodyId id)
+{
+	if (sleeping[id])
+	{
+		sleeping[id] = 0;
+		awakeIds.push_back(uint32_t(id));
+	}
+	stillTime[id] = 0.0;
+}
+
+
+void World::updateAwakeRanges()
+{
+	awakeRanges.clear();
+	awakeCount = awakeIds.size();
+
+	// Only the awake bodies are walked, never all of them (they are mostly in order already)
+	if (!std::is_sorted(awakeIds.begin(), awakeIds.end()))
+		std::sort(awakeIds.begin(), awakeIds.end());
+	for (size_t i(0); i < awakeIds.size(); )
+	{
+		size_t first = awakeIds[i], last = first + 1;
+		for (++i; i < awakeIds.size() && awakeIds[i] == last; ++i)
+			++last;
+		awakeRanges.push_back({ first, last });
+	}
+}
+
+
+void World::addIsland(uint32_t body)
+{
+	if (inIsland[body])
+		return;
+
+	// Whole ring goes in, so its sleeping bodies can be connected again
+	uint32_t member = body;
+	do
+	{
+		inIsland[member] = 1;
+		islandParent[member] = member;
+		islandBodies.push_back(member);
+		member = islandNext[member];
+	} while (member != body);
+	islandsCount--;
+}
+
+
+uint32_t World::findIsland(uint32_t body)
+{
+	while (islandParent[body] != body)
+	{
+		islandParent[body] = islandParent[islandParent[body]];
+		body = islandParent[body];
+	}
+	return body;
+}
+
+
+uint32_t World::getIsland(uint32_t body) const
+{
+	// Same as findIsland, but only reads, so jobs can look up islands at once
+	while (islandParent[body] != body)
+		body = islandParent[body];
+	return body;
+}
+
+
+void World::updateStillTime(double dTime, size_t first, size_t last)
+{
+	const double linearSq = coefs.sleepLinearVel * coefs.sleepLinearVel;
+	const double angularSq = coefs.sleepAngularVel * coefs.sleepAngularVel;
+
+	for (size_t i(first); i < last; ++i)
+	{
+		bool isStill = linearVel.get(i).sqLength() < linearSq && angularVel.get(i).sqLength() < angularSq;
+		stillTime[i] = isStill ? stillTime[i] + dTime : 0.0;
+	}
+}
+
+
+void World::updateSleeping()
+{
+	PROFILE_SCOPE("islands");
+
+	// Islands are bodies connected through overlapping boxes, they fall asleep and wake up together
+	// Only islands with an awake body are rebuilt, the rest (and their pairs) are the same as before
+	islandBodies.clear();
+	auto join = [this](uint32_t first, uint32_t second) {
+		first = findIsland(first);
+		second = findIsland(second);
+		if (first != second)
+			islandParent[std::max(first, second)] = std::min(first, second);
+	};
+
+	for (uint32_t body : awakeIds)
+		addIsland(body);
+	for (auto& pair : broadphase.getMovedPairs())
+	{
+		addIsland(pair.first);
+		addIsland(pair.second);
+		join(pair.first, pair.second);
+	}
+
+	// Pairs of two sleeping bodies didnt change, every ring holds both bodies of them
+	// Searched by jobs (islands are only read), then joined in job order, so the islands are the same on any threads count
+	const std::vector<Broadphase::Pair>& pairs = broadphase.getPairs();
+	const size_t jobsCount = (islandBodies.size() + jobGrain - 1) / jobGrain;
+	islandJoins.resize(std::max(islandJoins.size(), jobsCount));
+	runPieces(islandBodies.size(), [&](size_t first, size_t last) {
+		std::vector<Broadphase::Pair>& found = islandJoins[first / jobGrain];
+		found.clear();
+		for (size_t i(first); i < last; ++i)
+		{
+			uint32_t body = islandBodies[i];
+			if (!sleeping[body])
+				continue;
+
+			auto pair = std::lower_bound(pairs.begin(), pairs.end(), body, [](const Broadphase::Pair& lhs, uint32_t rhs) { return lhs.first < rhs; });
+			for (; pair != pairs.end() && pair->first == body; ++pair)
+				if (sleeping[pair->second] && inIsland[pair->second])
+					found.push_back(*pair);
+		}
+	});
+	for (size_t jobId(0); jobId < jobsCount; ++jobId)
+		for (auto& pair : islandJoins[jobId])
+			join(pair.first, pair.second);
+
+	// Islands dont change anymore, every body looks its one up once
+	islandRoots.resize(islandBodies.size());
+	runPieces(islandBodies.size(), [&](size_t first, size_t last) {
+		for (size_t i(first); i < last; ++i)
+			islandRoots[i] = getIsland(islandBodies[i]);
+	});
+
+	// Island is as still as its least still body, a sleeping body counts as still enough
+	for (uint32_t body : islandBodies)
+	{
+		islandStillTime[body] = coefs.sleepTime;
+		islandNext[body] = body;
+	}
+	for (size_t i(0); i < islandBodies.size(); ++i)
+	{
+		uint32_t body = islandBodies[i], island = islandRoots[i];
+		islandsCount += island == body;
+		if (!sleeping[body])
+			islandStillTime[island] = std::min(islandStillTime[island], stillTime[body]);
+	}
+
+	awakeIds.clear();
+	for (size_t i(0); i < islandBodies.size(); ++i)
+	{
+		uint32_t body = islandBodies[i], island = islandRoots[i];
+		if (island != body)
+		{
+			islandNext[body] = islandNext[island];
+			islandNext[island] = body;
+		}
+		inIsland[body] = 0;
+
+		bool isStill = islandStillTime[island] >= coefs.sleepTime;
+		if (isStill && !sleeping[body])
+		{
+			sleeping[body] = 1;
+			linearVel.set(body, Vecd<3>{});
+			angularMomentum.set(body, Vecd<3>{});
+			angularVel.set(body, Vecd<3>{});
+		}
+		else if (!isStill && sleeping[body])
+		{
+			wakeUp(body);
+		}
+		else if (!isStill)
+		{
+			awakeIds.push_back(body);
+		}
+	}
+}
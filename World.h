@@ -0,0 +1,166 @@
+#pragma once
+#include <vector>
+
+#include "Physics.h"
+#include "Broadphase.h"
+#include "JobSystem.h"
+
+
+// Many triangle bodies against the floor (Simulator is the single body version)
+// State is kept as structure of arrays, every stage is a plain loop over the awake bodies
+class World
+{
+public:
+	using BodyId = size_t;
+
+	World(double floorHeight, const Broadphase::Params& broadphaseParams = {}) :
+		broadphase(broadphaseParams)
+	{
+		setFloorHeight(floorHeight);
+	}
+
+	/// @brief Adds a triangle body
+	/// @param vertices Triangle in body space (around its center of mass)
+	/// @return Index of the body, stays valid for the lifetime of the world
+	BodyId addBody(const Vecd<3> vertices[3], const Matd<3, 3>& inverseBodyInertiaTensor, double mass, const Vecd<3>& pos);
+	void reserve(size_t count);
+
+	/// @brief Integrates all bodies by dTime, pushes them out of the floor and finds candidate body pairs
+	/// Applied forces and torques are used up by the step
+	/// Islands that stay still for sleepTime fall asleep and are skipped until a setter, a force or an awake body wakes them
+	void step(double dTime);
+
+	// Getters&setters
+	void setFloorHeight(double floorHeight)
+	{
+		if (floorHeight < 0.0)
+			throw "Floor y can be only > 0.0";
+		aFloor.d = floorHeight;
+		for (BodyId id(0); id < getBodyCount(); ++id)
+			wakeUp(id);
+	}
+
+	/// @brief Body stages of step run as jobs on it, not owned, nullptr - on the calling thread
+	/// Every body is handled by one job in the same order, so results dont depend on the threads count
+	/// So do the broadphase pair tests and the island pair search and lookups, their results are merged in job order
+	/// Still serial: grid cell updates, the sweep and prune sweep, island joins and the sleep and wake pass over island bodies
+	void setJobSystem(JobSystem* jobSystem)
+	{
+		jobs = jobSystem;
+		broadphase.setJobSystem(jobSystem);
+	}
+
+	void setCoefficients(const Coefficients& coefs)
+	{
+		this->coefs = coefs;
+	}
+
+	void setCenterPos(BodyId id, const Vecd<3>& newPos);
+	void setOrientation(BodyId id, Matd<3, 3> orientMat);
+	void setLinearVelocity(BodyId id, const Vecd<3>& newVel);
+	void setAngularMomentum(BodyId id, const Vecd<3>& newMom);
+
+	void applyForce(BodyId id, const Vecd<3>& force);
+	void applyTorque(BodyId id, const Vecd<3>& torque);
+
+	size_t getBodyCount() const					{ return invMass.size(); }
+	double getFloorHeight() const				{ return aFloor.d; }
+	Coefficients& getCoefficients()				{ return coefs; }
+	ForceGenerators& getForceGenerators()		{ return forceGenerators; } // Evaluated by every step, added to applied forces
+	Vecd<3> getCenterPos(BodyId id) const		{ return pos.get(id); }
+	Matd<3, 3> getOrientation(BodyId id) const	{ return orientMat.get(id); }
+	Vecd<3> getLinearVelocity(BodyId id) const	{ return linearVel.get(id); }
+	Vecd<3> getAngularVelocity(BodyId id) const	{ return angularVel.get(id); }
+	Vecd<3> getAngularMomentum(BodyId id) const	{ return angularMomentum.get(id); }
+	Vecd<3> getVertex(BodyId id, int vId) const	{ return vertices[vId].get(id); }
+	double getInverseMass(BodyId id) const		{ return invMass[id]; }
+	bool isSleeping(BodyId id) const			{ return sleeping[id] != 0; }
+	size_t getAwakeCount() const				{ return awakeCount; }
+	size_t getIslandsCount() const				{ return islandsCount; }
+	Vecd<3> getAabbMin(BodyId id) const			{ return aabbMin.get(id); }
+	Vecd<3> getAabbMax(BodyId id) const			{ return aabbMax.get(id); }
+	double getKineticEnergy() const; // Linear and angular, summed in the same order on any threads count
+
+	/// @brief Bodies with overlapping AABBs after the last step
+	const std::vector<Broadphase::Pair>& getCandidatePairs() const	{ return broadphase.getPairs(); }
+	const Broadphase::Stats& getBroadphaseStats() const				{ return broadphase.getStats(); }
+
+private:
+	// Constant per body
+	std::vector<double> invMass;
+	Mat3Array IbodyInv;
+	Vec3Array bodyVertices[3];
+
+	// States
+	Vec3Array pos;
+	Mat3Array orientMat;
+	Vec3Array linearVel;
+	Vec3Array angularMomentum;
+
+	// Derived (auxiliary)
+	Mat3Array Iinv;
+	Vec3Array angularVel;
+	Vec3Array vertices[3];
+	Vec3Array aabbMin;
+	Vec3Array aabbMax;
+
+	// Manually applied, cleared by every step
+	Vec3Array appliedForce;
+	Vec3Array appliedTorque;
+	ForceGenerators forceGenerators;
+
+	// Sleeping
+	std::vector<uint8_t> sleeping;
+	std::vector<double> stillTime;		// Below the sleep velocities for that long
+	std::vector<uint32_t> awakeIds;		// Sorted by the step
+	std::vector<std::pair<size_t, size_t>> awakeRanges;
+	size_t awakeCount = 0;
+	std::vector<uint32_t> islandParent;	// Union-find over broadphase pairs
+	std::vector<uint32_t> islandNext;	// Ring of the island every body was in after the last step
+	std::vector<uint8_t> inIsland;		// Set only while islands are rebuilt
+	std::vector<uint32_t> islandBodies;	// Bodies whose islands are rebuilt
+	std::vector<uint32_t> islandRoots;	// Island of every one of them, once joined
+	std::vector<std::vector<Broadphase::Pair>> islandJoins; // Sleeping pairs found by every job, joined in job order
+	std::vector<double> islandStillTime;
+	size_t islandsCount = 0;
+
+	// Floor contact impulses of every vertex from the last step, for warm starting
+	std::vector<ContactImpulse> warmImpulses[3];
+
+	Floor aFloor;
+	Coefficients coefs;
+	Broadphase broadphase;
+
+	// Threading
+	static constexpr size_t jobGrain = 256; // Bodies per job
+	JobSystem* jobs = nullptr;
+	std::vector<std::pair<size_t, size_t>> jobRanges; // Awake ranges cut into jobGrain pieces
+
+	/// @brief func(first, last) over jobGrain pieces of 0..count-1, as jobs when there is a job system
+	template <class Func>
+	void runPieces(size_t count, const Func& func)
+	{
+		if (jobs)
+			jobs->parallelFor(count, jobGrain, func);
+		else
+			for (size_t first(0); first < count; first += jobGrain)
+				func(first, std::min(first + jobGrain, count));
+	}
+
+	void runStages(double dTime, size_t first, size_t last);
+
+	void integrate(double dTime, size_t first, size_t last);
+	void orthonormalize(size_t first, size_t last);
+	void updateInertia(size_t first, size_t last);
+	void updateVertices(size_t first, size_t last);
+	void resolveFloorContacts(size_t first, size_t last);
+	void updateBounds(size_t first, size_t last);
+	void updateStillTime(double dTime, size_t first, size_t last);
+
+	void wakeUp(BodyId id);
+	void updateAwakeRanges();
+	void updateSleeping();
+	void addIsland(uint32_t body);
+	uint32_t findIsland(uint32_t body);
+	uint32_t getIsland(uint32_t body) const;
+};